@@ -0,0 +1,226 @@
+#include "VOC_binlog.h"
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Records are written and mapped in host order, which the format defines as little-endian
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary log format requires a little-endian host"
+#endif
+
+#define BINLOG_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+static size_t binlog_presence_words(int site_count) {
+    return (site_count + 63) / 64;
+}
+
+size_t binlog_record_size(int site_count, uint32_t flags) {
+    size_t site_size = (flags & BINLOG_FLAG_VOC_INDEX) ? 8 : 6;
+    return BINLOG_ALIGN(8 + 8 * binlog_presence_words(site_count) + site_size * site_count);
+}
+
+size_t binlog_tables_size(size_t fixed_size, int site_count, uint32_t flags) {
+    size_t size = BINLOG_ALIGN(fixed_size + site_count * sizeof(BinlogSite));
+    if (flags & BINLOG_FLAG_SENSORS) size += site_count * sizeof(BinlogSensor);
+    return size;
+}
+
+const BinlogSensor* binlog_sensor_table(const uint8_t* header, size_t fixed_size, int site_count, uint32_t flags) {
+    if (!(flags & BINLOG_FLAG_SENSORS)) return NULL;
+    return (const BinlogSensor*)(header + binlog_tables_size(fixed_size, site_count, 0));
+}
+
+int binlog_write_tables(FILE* logfile, size_t fixed_size, const BinlogSite sites[], const BinlogSensor sensors[],
+                        int site_count) {
+    static const uint8_t padding[8];
+    size_t table_size = site_count * sizeof(BinlogSite);
+
+    if (site_count && fwrite(sites, table_size, 1, logfile) != 1) return -1;
+    size_t pad = binlog_tables_size(fixed_size, site_count, 0) - fixed_size - table_size;
+    if (pad && fwrite(padding, pad, 1, logfile) != 1) return -1;
+    if (sensors && site_count && fwrite(sensors, sizeof(BinlogSensor), site_count, logfile) != (size_t)site_count) {
+        return -1;
+    }
+    return 0;
+}
+
+int binlog_write_header(FILE* logfile, const BinlogSite sites[], const BinlogSensor sensors[], int site_count,
+                        int oversample_count, uint32_t flags) {
+    flags = sensors ? flags | BINLOG_FLAG_SENSORS : flags & ~BINLOG_FLAG_SENSORS;
+    BinlogHeader header = {
+        .magic = {BINLOG_MAGIC[0], BINLOG_MAGIC[1], BINLOG_MAGIC[2], BINLOG_MAGIC[3]},
+        .version = BINLOG_VERSION,
+        .header_size = binlog_tables_size(sizeof(BinlogHeader), site_count, flags),
+        .record_size = binlog_record_size(site_count, flags),
+        .site_count = site_count,
+        .oversample_count = oversample_count,
+        .temperature_scale = BINLOG_TEMPERATURE_SCALE,
+        .humidity_scale = BINLOG_HUMIDITY_SCALE,
+        .flags = flags,
+    };
+
+    if (fwrite(&header, sizeof(header), 1, logfile) != 1) return -1;
+    return binlog_write_tables(logfile, sizeof(header), sites, sensors, site_count);
+}
+
+int16_t binlog_scale(float value, int scale) {
+    float scaled = roundf(value * scale);
+    if (!(scaled > INT16_MIN)) return INT16_MIN;
+    if (scaled > INT16_MAX) return INT16_MAX;
+    return (int16_t)scaled;
+}
+
+size_t binlog_encode_record(const LogRecord* record, uint8_t* buffer, size_t size) {
+    int n = record->site_count;
+    size_t words = binlog_presence_words(n);
+    size_t record_size = binlog_record_size(n, record->has_voc_index ? BINLOG_FLAG_VOC_INDEX : 0);
+    if (record_size > size) return 0;
+
+    int64_t timestamp_ns = (int64_t)record->timestamp * 1000000000;
+    int16_t* temperature = (int16_t*)(buffer + 8 + 8 * words);
+    int16_t* humidity = temperature + n;
+    uint16_t* voc = (uint16_t*)(humidity + n);
+    uint16_t* voc_index = voc + n;
+
+    memset(buffer, 0, record_size);
+    memcpy(buffer, &timestamp_ns, 8);
+    memcpy(buffer + 8, record->valid, 8 * words);
+    for (int site = 0; site < n; site++) {
+        if (!(record->valid[site / 64] & ((uint64_t)1 << (site % 64)))) continue;
+        temperature[site] = binlog_scale(record->temperature[site], BINLOG_TEMPERATURE_SCALE);
+        humidity[site] = binlog_scale(record->humidity[site], BINLOG_HUMIDITY_SCALE);
+        voc[site] = record->voc[site];
+        if (record->has_voc_index) voc_index[site] = record->voc_index[site];
+    }
+    return record_size;
+}
+
+int binlog_open(BinlogReader* reader, const char* path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinlogHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    reader->map = map;
+    reader->size = st.st_size;
+    reader->header = map;
+    reader->sites = (const BinlogSite*)(reader->map + sizeof(BinlogHeader));
+
+    const BinlogHeader* header = reader->header;
+    if (memcmp(header->magic, BINLOG_MAGIC, 4) != 0 || header->version != BINLOG_VERSION ||
+        (header->flags & ~(BINLOG_FLAG_VOC_INDEX | BINLOG_FLAG_SENSORS)) || header->header_size > reader->size ||
+        header->record_size != binlog_record_size(header->site_count, header->flags) ||
+        header->header_size < binlog_tables_size(sizeof(BinlogHeader), header->site_count, header->flags)) {
+        binlog_close(reader);
+        return -1;
+    }
+    reader->sensors = binlog_sensor_table(reader->map, sizeof(BinlogHeader), header->site_count, header->flags);
+    reader->record_count = (reader->size - header->header_size) / header->record_size;
+    return 0;
+}
+
+void binlog_close(BinlogReader* reader) {
+    if (reader->map) munmap((void*)reader->map, reader->size);
+    reader->map = NULL;
+}
+
+static const uint8_t* binlog_record(const BinlogReader* reader, size_t index) {
+    return reader->map + reader->header->header_size + index * reader->header->record_size;
+}
+
+static const int16_t* binlog_temperatures(const BinlogReader* reader, size_t index) {
+    return (const int16_t*)(binlog_record(reader, index) + 8 + 8 * binlog_presence_words(reader->header->site_count));
+}
+
+int64_t binlog_timestamp_ns(const BinlogReader* reader, size_t index) {
+    return *(const int64_t*)binlog_record(reader, index);
+}
+
+bool binlog_site_valid(const BinlogReader* reader, size_t index, int site) {
+    const uint64_t* presence = (const uint64_t*)(binlog_record(reader, index) + 8);
+    return presence[site / 64] & ((uint64_t)1 << (site % 64));
+}
+
+float binlog_temperature(const BinlogReader* reader, size_t index, int site) {
+    return (float)binlog_temperatures(reader, index)[site] / reader->header->temperature_scale;
+}
+
+float binlog_humidity(const BinlogReader* reader, size_t index, int site) {
+    const int16_t* humidity = binlog_temperatures(reader, index) + reader->header->site_count;
+    return (float)humidity[site] / reader->header->humidity_scale;
+}
+
+uint16_t binlog_voc(const BinlogReader* reader, size_t index, int site) {
+    const uint16_t* voc = (const uint16_t*)(binlog_temperatures(reader, index) + 2 * reader->header->site_count);
+    return voc[site];
+}
+
+uint16_t binlog_voc_index(const BinlogReader* reader, size_t index, int site) {
+    const uint16_t* voc_index = (const uint16_t*)(binlog_temperatures(reader, index) + 3 * reader->header->site_count);
+    return voc_index[site];
+}
+
+void binlog_write_csv_header(FILE* out, const BinlogSite sites[], const BinlogSensor sensors[], int site_count,
+                             bool voc_index, bool stats) {
+    fprintf(out, "Timestamp");
+    for (int site = 0; site < site_count; site++) {
+        const BinlogSite* s = &sites[site];
+        char name[40];
+        if (sensors && sensors[site].sgp_serial) {
+            // Two sites reporting the same serial would otherwise share their column names
+            bool duplicate = false;
+            for (int other = 0; other < site_count && !duplicate; other++) {
+                duplicate = other != site && sensors[other].sgp_serial == sensors[site].sgp_serial;
+            }
+            int len = snprintf(name, sizeof(name), "_%012llx", (unsigned long long)sensors[site].sgp_serial);
+            if (duplicate) snprintf(name + len, sizeof(name) - len, "_%d_%02x_%d", s->bus, s->mux_address, s->port);
+        } else {
+            snprintf(name, sizeof(name), "%d_%02x_%d", s->bus, s->mux_address, s->port);
+        }
+        fprintf(out, ",T%s,H%s,VOC%s", name, name, name);
+        if (voc_index) fprintf(out, ",VOCI%s", name);
+        for (int channel = 0; stats && channel < 3; channel++) {
+            const char* prefix = channel == 0 ? "T" : channel == 1 ? "H" : "VOC";
+            fprintf(out, ",%ssd%s,%smin%s,%smax%s,%slast%s", prefix, name, prefix, name, prefix, name, prefix, name);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+int binlog_write_csv(const BinlogReader* reader, FILE* out) {
+    int site_count = reader->header->site_count;
+    bool voc_index = reader->header->flags & BINLOG_FLAG_VOC_INDEX;
+
+    binlog_write_csv_header(out, reader->sites, reader->sensors, site_count, voc_index, false);
+
+    for (size_t i = 0; i < reader->record_count; i++) {
+        char timestamp[32];
+        struct tm tm;
+        time_t seconds = (time_t)(binlog_timestamp_ns(reader, i) / 1000000000);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", localtime_r(&seconds, &tm));
+        fprintf(out, "%s", timestamp);
+
+        for (int site = 0; site < site_count; site++) {
+            if (binlog_site_valid(reader, i, site)) {
+                fprintf(out, ",%.2f,%.2f,%u", binlog_temperature(reader, i, site), binlog_humidity(reader, i, site),
+                        binlog_voc(reader, i, site));
+                if (voc_index) fprintf(out, ",%u", binlog_voc_index(reader, i, site));
+            } else {
+                fprintf(out, voc_index ? ",NaN,NaN,NaN,NaN" : ",NaN,NaN,NaN");
+            }
+        }
+        fprintf(out, "\n");
+    }
+    return ferror(out) ? -1 : 0;
+}
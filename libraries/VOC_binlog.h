@@ -0,0 +1,279 @@
+//
+// Binary log format, with an mmap based reader.
+//
+
+#ifndef VOC_BINLOG_H
+#define VOC_BINLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "VOC_essentials.h"
+
+#define BINLOG_MAGIC "VOCB"
+#define BINLOG_VERSION 1
+#define BINLOG_TEMPERATURE_SCALE 100   /**< Counts per °C. */
+#define BINLOG_HUMIDITY_SCALE 100      /**< Counts per %RH. */
+#define BINLOG_FLAG_VOC_INDEX 0x1        /**< Records end with the VOC index of every site. */
+#define BINLOG_FLAG_SENSORS 0x2          /**< The site table is followed by a BinlogSensor table. */
+#define BINLOG_RECORD_MAX_SIZE (8 + LOG_RECORD_MAX_SITES / 8 + LOG_RECORD_MAX_SITES * 8)
+
+/**
+ * @struct BinlogHeader
+ * @brief Start of a binary log file, followed by site_count BinlogSite entries, and with
+ * BINLOG_FLAG_SENSORS by site_count BinlogSensor entries from the next multiple of 8.
+ *
+ * All fields are little-endian. header_size and record_size are multiples of 8, so the int64 timestamp
+ * of every record is aligned in a mapped file.
+ */
+typedef struct {
+    char magic[4];               /**< BINLOG_MAGIC. */
+    uint16_t version;            /**< BINLOG_VERSION. */
+    uint16_t header_size;        /**< Bytes before the first record, site table and padding included. */
+    uint32_t record_size;        /**< Bytes per record, see binlog_record_size(). */
+    uint16_t site_count;         /**< Number of sites in every record. */
+    uint16_t oversample_count;   /**< Samples averaged per record. */
+    uint16_t temperature_scale;  /**< Counts per °C of the temperatures. */
+    uint16_t humidity_scale;     /**< Counts per %RH of the humidities. */
+    uint32_t flags;              /**< BINLOG_FLAG_* bits, zero in logs without a VOC index. */
+} BinlogHeader;
+
+/**
+ * @struct BinlogSite
+ * @brief Position of one site in the acquisition topology.
+ */
+typedef struct {
+    uint8_t bus;                 /**< i2c bus index. */
+    uint8_t mux_address;         /**< Address of the multiplexer in front of the site. */
+    uint8_t port;                /**< Port of the multiplexer. */
+    uint8_t reserved;            /**< Zero. */
+} BinlogSite;
+
+/**
+ * @struct BinlogSensor
+ * @brief Identity of the sensors of one site, whose values would otherwise only be known by their port.
+ */
+typedef struct {
+    uint64_t sgp_serial;         /**< 48-bit serial number of the SGP40, 0 if unknown. */
+    uint32_t sht_serial;         /**< Serial number of the SHT3x, 0 if unknown. */
+    uint32_t reserved;           /**< Zero. */
+} BinlogSensor;
+
+/**
+ * @struct BinlogReader
+ * @brief Binary log file mapped in memory.
+ *
+ * Records are read in place: the accessors below only compute offsets into the mapping, so scanning a
+ * log costs no parsing and no copy. A record is laid out as an int64 timestamp in nanoseconds, the
+ * presence bitmap in 64 bit words, then site_count int16 temperatures, int16 humidities and uint16
+ * VOC values, and with BINLOG_FLAG_VOC_INDEX site_count uint16 VOC indices.
+ */
+typedef struct {
+    const uint8_t* map;          /**< Mapped file. */
+    size_t size;                 /**< Size of the mapping. */
+    const BinlogHeader* header;  /**< Header at the start of the mapping. */
+    const BinlogSite* sites;     /**< Site table following the header. */
+    const BinlogSensor* sensors; /**< Sensor table following the site table, NULL without BINLOG_FLAG_SENSORS. */
+    size_t record_count;         /**< Complete records in the file. */
+} BinlogReader;
+
+/**
+ * binlog_record_size() - Returns the size of a record with the given number of sites.
+ *
+ * @param site_count Number of sites.
+ * @param flags BINLOG_FLAG_* bits of the log.
+ *
+ * @return Record size in bytes, a multiple of 8.
+ */
+size_t binlog_record_size(int site_count, uint32_t flags);
+
+/**
+ * binlog_tables_size() - Returns the size of a header followed by its site and sensor tables.
+ *
+ * @param fixed_size Size of the header structure, a multiple of 8.
+ * @param site_count Number of sites.
+ * @param flags BINLOG_FLAG_* bits of the log, BINLOG_FLAG_SENSORS adds the sensor table.
+ *
+ * @return Header size in bytes, a multiple of 8.
+ */
+size_t binlog_tables_size(size_t fixed_size, int site_count, uint32_t flags);
+
+/**
+ * binlog_sensor_table() - Returns the sensor table of a mapped header.
+ *
+ * @param header Start of the mapped header.
+ * @param fixed_size Size of the header structure.
+ * @param site_count Number of sites.
+ * @param flags BINLOG_FLAG_* bits of the log.
+ *
+ * @return Sensor table, NULL without BINLOG_FLAG_SENSORS.
+ */
+const BinlogSensor* binlog_sensor_table(const uint8_t* header, size_t fixed_size, int site_count, uint32_t flags);
+
+/**
+ * binlog_write_tables() - Writes the site table and the sensor table that follow a header.
+ *
+ * @param logfile File positioned right after a header of fixed_size bytes.
+ * @param fixed_size Size of the header structure, a multiple of 8.
+ * @param sites Site table.
+ * @param sensors Sensor table, NULL for none.
+ * @param site_count Number of entries in each table.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int binlog_write_tables(FILE* logfile, size_t fixed_size, const BinlogSite sites[], const BinlogSensor sensors[],
+                        int site_count);
+
+/**
+ * binlog_write_header() - Writes the header and site table of a new binary log.
+ *
+ * @param logfile Empty file opened for writing.
+ * @param sites Site table, one entry per site of the records.
+ * @param sensors Identity of the sensors of each site, NULL for none.
+ * @param site_count Number of entries in sites, at most LOG_RECORD_MAX_SITES.
+ * @param oversample_count Samples averaged per record.
+ * @param flags BINLOG_FLAG_VOC_INDEX if the records have VOC indices, 0 otherwise. BINLOG_FLAG_SENSORS
+ * follows sensors.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int binlog_write_header(FILE* logfile, const BinlogSite sites[], const BinlogSensor sensors[], int site_count,
+                        int oversample_count, uint32_t flags);
+
+/**
+ * binlog_scale() - Converts a value to the fixed point representation of the format.
+ *
+ * @param value Temperature or humidity.
+ * @param scale Counts per unit, BINLOG_TEMPERATURE_SCALE or BINLOG_HUMIDITY_SCALE.
+ *
+ * @return Value rounded to the scale and saturated to int16, INT16_MIN for NaN.
+ */
+int16_t binlog_scale(float value, int scale);
+
+/**
+ * binlog_encode_record() - Encodes a record in the binary format.
+ *
+ * Temperatures and humidities are rounded to the scale of the format and saturated to int16. VOC indices
+ * are appended if record->has_voc_index, which must match the flags of the header.
+ *
+ * @param record Record to encode.
+ * @param buffer Destination, BINLOG_RECORD_MAX_SIZE bytes are always enough.
+ * @param size Size of buffer.
+ *
+ * @return Size of the encoded record, 0 if buffer is too small.
+ */
+size_t binlog_encode_record(const LogRecord* record, uint8_t* buffer, size_t size);
+
+/**
+ * binlog_open() - Maps a binary log file for reading.
+ *
+ * A record being written at the end of the file is ignored.
+ *
+ * @param reader Reader to initialize.
+ * @param path Path of the binary log.
+ *
+ * @return 0 on success, -1 if the file cannot be mapped or is not a binary log.
+ */
+int binlog_open(BinlogReader* reader, const char* path);
+
+/**
+ * binlog_close() - Unmaps a binary log.
+ *
+ * @param reader Open reader.
+ */
+void binlog_close(BinlogReader* reader);
+
+/**
+ * binlog_timestamp_ns() - Returns the time of a record.
+ *
+ * @param reader Open reader.
+ * @param index Record index, below reader->record_count.
+ *
+ * @return Wall-clock time of the window start in nanoseconds since the epoch.
+ */
+int64_t binlog_timestamp_ns(const BinlogReader* reader, size_t index);
+
+/**
+ * binlog_site_valid() - Tells whether a site has values in a record.
+ *
+ * @param reader Open reader.
+ * @param index Record index.
+ * @param site Site index.
+ *
+ * @return true if the site had a complete window.
+ */
+bool binlog_site_valid(const BinlogReader* reader, size_t index, int site);
+
+/**
+ * binlog_temperature() - Returns the temperature of a site in a record.
+ *
+ * @param reader Open reader.
+ * @param index Record index.
+ * @param site Site index.
+ *
+ * @return Temperature in °C.
+ */
+float binlog_temperature(const BinlogReader* reader, size_t index, int site);
+
+/**
+ * binlog_humidity() - Returns the humidity of a site in a record.
+ *
+ * @param reader Open reader.
+ * @param index Record index.
+ * @param site Site index.
+ *
+ * @return Humidity in %RH.
+ */
+float binlog_humidity(const BinlogReader* reader, size_t index, int site);
+
+/**
+ * binlog_voc() - Returns the raw VOC signal of a site in a record.
+ *
+ * @param reader Open reader.
+ * @param index Record index.
+ * @param site Site index.
+ *
+ * @return Raw VOC signal in ticks.
+ */
+uint16_t binlog_voc(const BinlogReader* reader, size_t index, int site);
+
+/**
+ * binlog_voc_index() - Returns the VOC index of a site in a record.
+ *
+ * @param reader Open reader, of a log with BINLOG_FLAG_VOC_INDEX.
+ * @param index Record index.
+ * @param site Site index.
+ *
+ * @return Average VOC index.
+ */
+uint16_t binlog_voc_index(const BinlogReader* reader, size_t index, int site);
+
+/**
+ * binlog_write_csv_header() - Writes the CSV header line of a site table.
+ *
+ * The columns of a site are named after the serial number of its SGP40 when known, e.g. T_00000000abcd,
+ * so they follow the sensor across re-cabling, and after its bus, multiplexer and port otherwise, e.g.
+ * T0_70_3. A serial reported by several sites is followed by the port of each, e.g. T_00000000abcd_0_70_3.
+ *
+ * @param out Destination of the CSV text.
+ * @param sites Site table of the log.
+ * @param sensors Sensors of each site, NULL to name every column after its port.
+ * @param site_count Number of entries in sites.
+ * @param voc_index Whether to add a VOC index column after the VOC column of every site.
+ * @param stats Whether to add the statistics columns of every site, see finalize_record().
+ */
+void binlog_write_csv_header(FILE* out, const BinlogSite sites[], const BinlogSensor sensors[], int site_count,
+                             bool voc_index, bool stats);
+
+/**
+ * binlog_write_csv() - Converts a binary log to the CSV format of the acquisition program.
+ *
+ * @param reader Open reader.
+ * @param out Destination of the CSV text, header line included.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int binlog_write_csv(const BinlogReader* reader, FILE* out);
+
+#endif //VOC_BINLOG_H
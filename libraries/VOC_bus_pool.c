@@ -0,0 +1,263 @@
+#include "VOC_bus_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "VOC_gas_index.h"
+#include "VOC_scheduler.h"
+#include "VOC_sensor_map.h"
+#include "VOC_snapshot.h"
+
+// Threads blocked on a barrier leave the virtual clock of the HAL, which would otherwise wait for them
+// to sleep before advancing. The thread releasing the workers attaches them, so that time cannot move
+// between the release and their first sleep.
+static void bus_pool_barrier_wait(pthread_barrier_t* barrier) {
+    sensirion_i2c_hal_clock_detach();
+    pthread_barrier_wait(barrier);
+}
+
+static void bus_worker_setup(BusWorker* worker) {
+    const VOCConfig* config = worker->pool->config;
+
+    SensorBus* sensors = &worker->sensors;
+
+    sensor_bus_init(sensors, sensirion_i2c_hal_get_bus(worker->bus_idx), config->reprobe_interval,
+                    config->breaker_threshold, config->breaker_max_backoff);
+    sensor_bus_set_echo(sensors, config->sample_echo ? config->sample_echo_interval : -1);
+    sensor_bus_set_calibration(sensors, worker->pool->calibration, config->humidity_offset);
+    printf("Bus %d | Multiplexers: %d, sites: %d\n", worker->bus_idx, sensors->topology.mux_count,
+           sensors->presence.site_count);
+    for (int site = 0; site < sensors->presence.site_count; site++) {
+        uint8_t devices = sensors->presence.devices[site];
+        if (devices) {
+            char name[16];
+            sensor_bus_site_name(sensors, site, name, sizeof(name));
+            printf("Bus %d Site %s | SHT3x: %s %08x | SGP40: %s %012llx\n", worker->bus_idx, name,
+                   (devices & PRESENCE_SHT3X_44) ? ((devices & PRESENCE_SHT3X_45) ? "0x44+0x45" : "0x44") :
+                   (devices & PRESENCE_SHT3X_45) ? "0x45" : "none",
+                   (unsigned)sensors->presence.sht_serial[site], (devices & PRESENCE_SGP40) ? "0x59" : "none",
+                   (unsigned long long)sensors->presence.sgp_serial[site]);
+        }
+    }
+
+    for (int mux_idx = 0; config->sweep_mode == SWEEP_BROADCAST && mux_idx < sensors->topology.mux_count; mux_idx++) {
+        uint8_t conflict_mask = 0;
+        topology_find_broadcast_channels(&sensors->topology, mux_idx, SHT31_I2C_ADDR_44,
+                                         &sensors->broadcast_mask[mux_idx], &conflict_mask);
+        printf("Bus %d Mux 0x%02x | Broadcast group: 0x%02x, per-port fallback for conflicting ports: 0x%02x\n",
+               worker->bus_idx, sensors->topology.muxes[mux_idx].address, sensors->broadcast_mask[mux_idx],
+               conflict_mask);
+    }
+}
+
+// Runs the VOC index algorithm on the sites of a bus once its sweep is done, in one pass over all of them
+static void bus_worker_update_index(BusWorker* worker) {
+    GasIndexEngine* engine = worker->pool->gas_index;
+    SensorBus* sensors = &worker->sensors;
+    int count = sensors->presence.site_count;
+
+    if (!engine) return;
+    gas_index_process(engine, worker->pool->accum, worker->site_offset, count);
+    for (int site = worker->site_offset; sensors->snapshot && site < worker->site_offset + count; site++) {
+        snapshot_publish_voc_index(sensors->snapshot, site, engine->index[site]);
+    }
+}
+
+static void bus_worker_sweep(BusWorker* worker) {
+    const VOCConfig* config = worker->pool->config;
+
+    if (config->sweep_mode == SWEEP_BROADCAST) {
+        sample_all_ports_broadcast(worker->pool->accum, &worker->sensors);
+    } else if (config->sweep_mode == SWEEP_PIPELINED) {
+        sample_all_ports_pipelined(worker->pool->accum, &worker->sensors);
+    } else {
+        sample_all_ports(worker->pool->accum, &worker->sensors);
+    }
+    bus_worker_update_index(worker);
+}
+
+static void* bus_worker_main(void* arg) {
+    BusWorker* worker = arg;
+    BusPool* pool = worker->pool;
+
+    bus_worker_setup(worker);
+    bus_pool_barrier_wait(&pool->sweep_done);
+
+    while (1) {
+        pthread_barrier_wait(&pool->sweep_start);
+        if (!pool->running) break;
+        bus_worker_sweep(worker);
+        bus_pool_barrier_wait(&pool->sweep_done);
+    }
+    return NULL;
+}
+
+static void bus_pool_sweep_all(BusPool* pool) {
+    const VOCConfig* config = pool->config;
+    EventLoop loop;
+
+    if (config->sweep_mode == SWEEP_SEQUENTIAL) {
+        for (int i = 0; i < pool->bus_count; i++) {
+            bus_worker_sweep(&pool->workers[i]);
+        }
+        return;
+    }
+
+    // The conversions of all buses overlap in one event loop
+    event_loop_init(&loop);
+    for (int i = 0; i < pool->bus_count; i++) {
+        BusWorker* worker = &pool->workers[i];
+        event_loop_issue_bus(&loop, &worker->sensors, pool->accum, config->sweep_mode == SWEEP_BROADCAST);
+    }
+    event_loop_run(&loop);
+    for (int i = 0; i < pool->bus_count; i++) {
+        bus_worker_update_index(&pool->workers[i]);
+    }
+}
+
+static void* bus_pool_single_main(void* arg) {
+    BusPool* pool = arg;
+
+    for (int i = 0; i < pool->bus_count; i++) {
+        bus_worker_setup(&pool->workers[i]);
+    }
+    bus_pool_barrier_wait(&pool->sweep_done);
+
+    while (1) {
+        pthread_barrier_wait(&pool->sweep_start);
+        if (!pool->running) break;
+        bus_pool_sweep_all(pool);
+        bus_pool_barrier_wait(&pool->sweep_done);
+    }
+    return NULL;
+}
+
+int bus_pool_start(BusPool* pool, const VOCConfig* config) {
+    pool->bus_count = config->bus_count;
+    pool->thread_count = config->single_thread ? 1 : config->bus_count;
+    pool->config = config;
+    pool->accum = NULL;
+    pool->site_count = 0;
+    pool->gas_index = NULL;
+    pool->calibration = NULL;
+    pool->running = 1;
+    pthread_barrier_init(&pool->sweep_start, NULL, pool->thread_count + 1);
+    pthread_barrier_init(&pool->sweep_done, NULL, pool->thread_count + 1);
+
+    for (int i = 0; i < pool->bus_count; i++) {
+        pool->workers[i].bus_idx = i;
+        pool->workers[i].pool = pool;
+    }
+
+    // Loaded before the workers start, they resolve the calibration of their sites during discovery
+    if (config->calibration_file[0]) {
+        pool->calibration = malloc(sizeof(CalibrationTable));
+        if (!pool->calibration) {
+            perror("Failed to allocate calibration table");
+            return -1;
+        }
+        if (calibration_load(pool->calibration, config->calibration_file) >= 0) {
+            printf("Loaded %d sensor calibrations from %s\n", pool->calibration->count, config->calibration_file);
+        }
+    }
+
+    sensirion_i2c_hal_clock_attach(pool->thread_count);
+    if (config->single_thread) {
+        if (pthread_create(&pool->workers[0].thread, NULL, bus_pool_single_main, pool) != 0) {
+            perror("Failed to start bus thread");
+            return -1;
+        }
+    }
+    for (int i = 0; i < pool->bus_count && !config->single_thread; i++) {
+        BusWorker* worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, bus_worker_main, worker) != 0) {
+            // Threads already started wait on the setup barrier, which can no longer complete
+            perror("Failed to start bus thread");
+            return -1;
+        }
+    }
+
+    bus_pool_barrier_wait(&pool->sweep_done);
+    sensirion_i2c_hal_clock_attach(1);
+
+    // Workers wait for the first sweep, so the accumulators can be handed out now that the sites are known
+    for (int i = 0; i < pool->bus_count; i++) {
+        pool->workers[i].site_offset = pool->site_count;
+        pool->workers[i].sensors.site_offset = pool->site_count;
+        pool->site_count += pool->workers[i].sensors.presence.site_count;
+    }
+    pool->accum = calloc(1, sizeof(SensorAccumulator));
+    if (!pool->accum) {
+        perror("Failed to allocate accumulators");
+        bus_pool_stop(pool);
+        return -1;
+    }
+    pool->accum->filter = config->window_filter;
+    pool->accum->filter_threshold = config->window_filter_threshold;
+
+    if (config->voc_index) {
+        pool->gas_index = malloc(sizeof(GasIndexEngine));
+        if (!pool->gas_index) {
+            perror("Failed to allocate VOC index engine");
+            bus_pool_stop(pool);
+            return -1;
+        }
+        gas_index_init(pool->gas_index, pool->site_count, SAMPLE_PERIOD_NS / 1e9f);
+        for (int i = 0; i < pool->bus_count; i++) {
+            sensor_bus_set_gas_index(&pool->workers[i].sensors, pool->gas_index);
+        }
+    }
+    return 0;
+}
+
+void bus_pool_sweep(BusPool* pool) {
+    sensirion_i2c_hal_clock_attach(pool->thread_count);
+    pthread_barrier_wait(&pool->sweep_start);
+    bus_pool_barrier_wait(&pool->sweep_done);
+    sensirion_i2c_hal_clock_attach(1);
+}
+
+void bus_pool_set_snapshot(BusPool* pool, struct SnapshotSegment* snapshot) {
+    for (int i = 0; i < pool->bus_count; i++) {
+        sensor_bus_set_snapshot(&pool->workers[i].sensors, snapshot);
+    }
+}
+
+void bus_pool_get_sensors(const BusPool* pool, BinlogSensor sensors[]) {
+    for (int i = 0; i < pool->bus_count; i++) {
+        const PortPresence* presence = &pool->workers[i].sensors.presence;
+        for (int site = 0; site < presence->site_count; site++) {
+            sensors[pool->workers[i].site_offset + site] = (BinlogSensor){
+                .sgp_serial = presence->sgp_serial[site],
+                .sht_serial = presence->sht_serial[site],
+            };
+        }
+    }
+}
+
+int bus_pool_take_replaced(BusPool* pool, int sites[]) {
+    int count = 0;
+
+    for (int i = 0; i < pool->bus_count; i++) {
+        SensorBus* sensors = &pool->workers[i].sensors;
+        for (uint64_t replaced = sensors->replaced_mask; replaced; replaced &= replaced - 1) {
+            sites[count++] = pool->workers[i].site_offset + __builtin_ctzll(replaced);
+        }
+        sensors->replaced_mask = 0;
+    }
+    return count;
+}
+
+void bus_pool_stop(BusPool* pool) {
+    pool->running = 0;
+    pthread_barrier_wait(&pool->sweep_start);
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&pool->sweep_start);
+    pthread_barrier_destroy(&pool->sweep_done);
+    free(pool->accum);
+    pool->accum = NULL;
+    free(pool->gas_index);
+    pool->gas_index = NULL;
+    free(pool->calibration);
+    pool->calibration = NULL;
+}
@@ -0,0 +1,116 @@
+//
+// Acquisition threads, one per i2c bus.
+//
+
+#ifndef VOC_BUS_POOL_H
+#define VOC_BUS_POOL_H
+
+#include <pthread.h>
+#include "VOC_binlog.h"
+#include "VOC_essentials.h"
+
+struct BusPool;
+struct CalibrationTable;
+struct GasIndexEngine;
+
+/**
+ * @struct BusWorker
+ * @brief State of the acquisition thread driving one i2c bus.
+ *
+ * The worker owns the sensor contexts of its bus and the range of BusPool.accum holding its sites, so
+ * sweeps on different buses never share data and run without locks.
+ */
+typedef struct {
+    uint8_t bus_idx;              /**< HAL bus index driven by this worker. */
+    int site_offset;              /**< Index of the first site of this bus in BusPool.accum. */
+    SensorBus sensors;            /**< Multiplexer and sensors of this bus. */
+    struct BusPool* pool;         /**< Pool the worker belongs to. */
+    pthread_t thread;             /**< Acquisition thread, only workers[0] has one with VOCConfig.single_thread. */
+} BusWorker;
+
+/**
+ * @struct BusPool
+ * @brief Set of acquisition threads sweeping their buses in parallel.
+ *
+ * The main thread calls bus_pool_sweep() once per sample; every worker then runs one sweep of its
+ * bus and bus_pool_sweep() returns once all of them are done. With VOCConfig.single_thread, a single
+ * thread sweeps all buses instead, overlapping their conversions in one EventLoop.
+ */
+typedef struct BusPool {
+    int bus_count;                    /**< Number of workers. */
+    int thread_count;                 /**< Number of acquisition threads, 1 if all buses share one. */
+    BusWorker workers[MAX_BUSES];     /**< One worker per bus. */
+    const VOCConfig* config;          /**< Configuration shared by all workers (read only). */
+    SensorAccumulator* accum;         /**< Accumulators of all sites, bus after bus. */
+    int site_count;                   /**< Number of sites in accum. */
+    struct GasIndexEngine* gas_index; /**< VOC index algorithm of all sites, NULL unless VOCConfig.voc_index. */
+    struct CalibrationTable* calibration; /**< Calibration of the sensors, NULL without VOCConfig.calibration_file. */
+    pthread_barrier_t sweep_start;    /**< Released by the main thread to start a sweep. */
+    pthread_barrier_t sweep_done;     /**< Released once every worker finished its sweep. */
+    volatile int running;             /**< Cleared by bus_pool_stop(). */
+} BusPool;
+
+/**
+ * bus_pool_start() - Starts one acquisition thread per configured bus.
+ *
+ * The HAL must be initialized with the bus paths of config. Each thread discovers the sensors on the
+ * multiplexers of its bus and waits for sweeps. The function returns once every bus is ready, with
+ * pool->accum sized for the sites found on all buses and reset, and with VOCConfig.voc_index, the
+ * VOC index engine of those sites. Each sweep then ends with the update of the indices of its bus.
+ *
+ * @param pool Pool to start.
+ * @param config Configuration, must outlive the pool.
+ *
+ * @return 0 on success, -1 if a thread could not be created or the accumulators could not be allocated.
+ */
+int bus_pool_start(BusPool* pool, const VOCConfig* config);
+
+/**
+ * bus_pool_sweep() - Runs one sweep on every bus in parallel and waits for all of them.
+ *
+ * @param pool Started pool.
+ */
+void bus_pool_sweep(BusPool* pool);
+
+/**
+ * bus_pool_set_snapshot() - Publishes the samples of every bus to a shared memory snapshot.
+ *
+ * Must be called between two sweeps, the sites of the snapshot are in the order of pool->accum.
+ *
+ * @param pool Started pool.
+ * @param snapshot Segment from snapshot_create(), NULL to stop publishing.
+ */
+void bus_pool_set_snapshot(BusPool* pool, struct SnapshotSegment* snapshot);
+
+/**
+ * bus_pool_get_sensors() - Copies the serial numbers of the sensors of every site, see PortPresence.
+ *
+ * Must be called between two sweeps, the sites are in the order of pool->accum.
+ *
+ * @param pool Started pool.
+ * @param sensors Set to the sensors last found on each of the pool->site_count sites, 0 if unknown.
+ */
+void bus_pool_get_sensors(const BusPool* pool, BinlogSensor sensors[]);
+
+/**
+ * bus_pool_take_replaced() - Lists the sites whose sensors were replaced since the previous call.
+ *
+ * The sweeps already gave those sites the calibration of their new sensors and restarted their VOC
+ * index algorithm. Must be called between two sweeps.
+ *
+ * @param pool Started pool.
+ * @param sites Set to the index of each replaced site, room for pool->site_count.
+ *
+ * @return Number of sites listed.
+ */
+int bus_pool_take_replaced(BusPool* pool, int sites[]);
+
+/**
+ * bus_pool_stop() - Stops and joins the acquisition threads, then frees the accumulators, the VOC index
+ * engine and the calibration.
+ *
+ * @param pool Started pool.
+ */
+void bus_pool_stop(BusPool* pool);
+
+#endif //VOC_BUS_POOL_H
@@ -0,0 +1,80 @@
+#include "VOC_csv.h"
+#include <math.h>
+
+static const uint32_t csv_pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+void csv_row_init(CsvRow* row, char* buffer, size_t size) {
+    row->start = buffer;
+    row->cursor = buffer;
+    row->end = buffer + size - 1;
+}
+
+void csv_put_char(CsvRow* row, char c) {
+    if (row->cursor < row->end) *row->cursor++ = c;
+}
+
+void csv_put_text(CsvRow* row, const char* text) {
+    while (*text && row->cursor < row->end) *row->cursor++ = *text++;
+}
+
+// Writes value with at least width digits, zero padded
+static void csv_put_digits(CsvRow* row, uint64_t value, int width) {
+    char digits[20];
+    int count = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value || count < width);
+    while (count > 0 && row->cursor < row->end) *row->cursor++ = digits[--count];
+}
+
+void csv_put_uint(CsvRow* row, uint32_t value) {
+    csv_put_digits(row, value, 1);
+}
+
+void csv_put_fixed(CsvRow* row, float value, int decimals) {
+    if (!isfinite(value)) {
+        csv_put_text(row, "NaN");
+        return;
+    }
+
+    // A float times 10^6 at most is exact in a double, so rint() rounds half to even on the exact
+    // value, like printf does
+    uint32_t scale = csv_pow10[decimals];
+    double scaled = rint(fabs((double)value) * scale);
+    if (scaled >= 1e18) {
+        csv_put_text(row, "NaN");
+        return;
+    }
+    uint64_t fixed = (uint64_t)scaled;
+
+    if (signbit(value)) csv_put_char(row, '-');
+    csv_put_digits(row, fixed / scale, 1);
+    if (decimals > 0) {
+        csv_put_char(row, '.');
+        csv_put_digits(row, fixed % scale, decimals);
+    }
+}
+
+void csv_put_timestamp(CsvRow* row, time_t time) {
+    struct tm tm;
+    localtime_r(&time, &tm);
+
+    csv_put_digits(row, tm.tm_year + 1900, 4);
+    csv_put_char(row, '-');
+    csv_put_digits(row, tm.tm_mon + 1, 2);
+    csv_put_char(row, '-');
+    csv_put_digits(row, tm.tm_mday, 2);
+    csv_put_char(row, 'T');
+    csv_put_digits(row, tm.tm_hour, 2);
+    csv_put_char(row, ':');
+    csv_put_digits(row, tm.tm_min, 2);
+    csv_put_char(row, ':');
+    csv_put_digits(row, tm.tm_sec, 2);
+}
+
+size_t csv_row_finish(CsvRow* row) {
+    *row->cursor = '\0';
+    return row->cursor - row->start;
+}
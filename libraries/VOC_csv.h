@@ -0,0 +1,86 @@
+//
+// CSV row encoder writing numbers with integer arithmetic.
+//
+
+#ifndef VOC_CSV_H
+#define VOC_CSV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @struct CsvRow
+ * @brief Write cursor into a row buffer.
+ *
+ * Every csv_put_*() call appends at the cursor, so building a row costs its length and never rescans
+ * the text already written. Output that does not fit is dropped, the buffer always keeps room for the
+ * terminating NUL. Numbers are formatted without printf and without the locale: fixed-point decimals
+ * are rounded like printf("%.*f") and always use '.' as the decimal separator.
+ */
+typedef struct {
+    char* start;    /**< Start of the buffer. */
+    char* cursor;   /**< Next character written. */
+    char* end;      /**< Last byte of the buffer, reserved for the terminating NUL. */
+} CsvRow;
+
+/**
+ * csv_row_init() - Starts a row in a buffer.
+ *
+ * @param row Row to initialize.
+ * @param buffer Destination of the text.
+ * @param size Size of buffer, at least 1.
+ */
+void csv_row_init(CsvRow* row, char* buffer, size_t size);
+
+/**
+ * csv_put_char() - Appends one character.
+ *
+ * @param row Row being written.
+ * @param c Character.
+ */
+void csv_put_char(CsvRow* row, char c);
+
+/**
+ * csv_put_text() - Appends a string.
+ *
+ * @param row Row being written.
+ * @param text NUL terminated string.
+ */
+void csv_put_text(CsvRow* row, const char* text);
+
+/**
+ * csv_put_uint() - Appends an unsigned integer in decimal.
+ *
+ * @param row Row being written.
+ * @param value Value.
+ */
+void csv_put_uint(CsvRow* row, uint32_t value);
+
+/**
+ * csv_put_fixed() - Appends a value with a fixed number of decimals, like printf("%.*f").
+ *
+ * @param row Row being written.
+ * @param value Value, "NaN" is written if it is not finite.
+ * @param decimals Digits after the decimal point, 0 to 6.
+ */
+void csv_put_fixed(CsvRow* row, float value, int decimals);
+
+/**
+ * csv_put_timestamp() - Appends a local time in the format of get_timestamp(), YYYY-MM-DDTHH:MM:SS.
+ *
+ * @param row Row being written.
+ * @param time Time to write.
+ */
+void csv_put_timestamp(CsvRow* row, time_t time);
+
+/**
+ * csv_row_finish() - Terminates the text of a row.
+ *
+ * @param row Row being written.
+ *
+ * @return Length of the row, terminating NUL excluded.
+ */
+size_t csv_row_finish(CsvRow* row);
+
+#endif //VOC_CSV_H
@@ -1,53 +1,585 @@
 #include "VOC_essentials.h"
 #include "sensirion_i2c_hal.h"
+#include "VOC_csv.h"
+#include "VOC_gas_index.h"
+#include "VOC_sensor_map.h"
+#include "VOC_snapshot.h"
+#include "VOC_tslog.h"
+#include <math.h>
 #include <stdio.h>
 #include <time.h>
 
-static uint8_t _mux_addr;
+// Multiplexer used by the functions without context, per thread so that every bus thread drives its own
+static _Thread_local MuxDevice _default_mux;
 
 void mux_init_address(uint8_t mux_addr) {
-    _mux_addr = mux_addr;
+    mux_dev_init(&_default_mux, NULL, mux_addr);
 }
 
 int16_t mux_port_select(uint8_t mux_port) {
-    if (mux_port > 7) return 1;
-    uint8_t data = 1 << mux_port;
-    return sensirion_i2c_hal_write(_mux_addr, &data, 1);
+    return mux_dev_port_select(&_default_mux, mux_port);
 }
 
 int16_t mux_i2c_detect() {
     for (uint8_t addr = 0; addr <= 127; addr++) {
-        if (addr == _mux_addr) continue;
-        if (sensirion_i2c_hal_write(addr, NULL, 0) == 0) {
+        if (addr == _default_mux.address) continue;
+        if (sensirion_i2c_hal_bus_probe(NULL, addr, NULL, 0) == 0) {
             return 0; // Device detected
         }
     }
     return 1; // No devices found
 }
 
+void mux_dev_init(MuxDevice* mux, sensirion_i2c_hal_bus* bus, uint8_t mux_addr) {
+    mux->bus = bus;
+    mux->address = mux_addr;
+}
+
+int16_t mux_dev_port_select(MuxDevice* mux, uint8_t mux_port) {
+    if (mux_port > 7) return 1;
+    return mux_dev_channels_select(mux, 1 << mux_port);
+}
+
+int16_t mux_dev_channels_select(MuxDevice* mux, uint8_t channel_mask) {
+    // Sent together with the next transaction, errors are reported by that transaction
+    return sensirion_i2c_hal_bus_defer_write(mux->bus, mux->address, &channel_mask, 1);
+}
+
+int16_t mux_dev_probe(MuxDevice* mux, uint8_t addr) {
+    return sensirion_i2c_hal_bus_probe(mux->bus, addr, NULL, 0) == 0 ? 0 : 1;
+}
+
+int topology_discover(MuxTopology* topology, sensirion_i2c_hal_bus* bus) {
+    topology->mux_count = 0;
+    topology->active_mux = -1;
+    topology->active_mask = 0;
+    topology->active_stale = false;
+
+    for (uint8_t addr = TCA_ADDR_70; addr <= TCA_ADDR_77; addr++) {
+        // Probe with an empty channel mask, which also disables channels left enabled by a previous run
+        uint8_t no_channels = 0;
+        if (sensirion_i2c_hal_bus_probe(bus, addr, &no_channels, 1) != 0) continue;
+
+        mux_dev_init(&topology->muxes[topology->mux_count++], bus, addr);
+    }
+
+    int found = topology->mux_count;
+    if (found == 0) {
+        printf("No multiplexer answered, assuming one at 0x%02x\n", TCA_ADDR_70);
+        mux_dev_init(&topology->muxes[0], bus, TCA_ADDR_70);
+        topology->mux_count = 1;
+    }
+    return found;
+}
+
+int topology_site_count(const MuxTopology* topology) {
+    return topology->mux_count * MAX_PORTS;
+}
+
+int16_t topology_select(MuxTopology* topology, int mux_idx, uint8_t channel_mask) {
+    int active = topology->active_mux;
+
+    if (active == mux_idx && topology->active_mask == channel_mask && !topology->active_stale) return 0;
+
+    if (active >= 0 && active != mux_idx && (topology->active_mask || topology->active_stale)) {
+        int16_t error = mux_dev_channels_select(&topology->muxes[active], 0);
+        if (error) return error;
+        topology->active_mask = 0;
+    }
+
+    int16_t error = mux_dev_channels_select(&topology->muxes[mux_idx], channel_mask);
+    if (error) {
+        topology->active_stale = true;
+        return error;
+    }
+    topology->active_mux = mux_idx;
+    topology->active_mask = channel_mask;
+    topology->active_stale = false;
+    return 0;
+}
+
+int16_t topology_select_site(MuxTopology* topology, int site) {
+    return topology_select(topology, SITE_MUX(site), 1 << SITE_PORT(site));
+}
+
+void topology_invalidate(MuxTopology* topology) {
+    topology->active_stale = true;
+}
+
+int16_t topology_find_broadcast_channels(MuxTopology* topology, int mux_idx, uint8_t sht_addr,
+                                         uint8_t* broadcast_mask, uint8_t* conflict_mask) {
+    MuxDevice* mux = &topology->muxes[mux_idx];
+    uint8_t broadcast = 0, conflict = 0;
+    sht3x_dev sht;
+
+    sht3x_dev_init(&sht, mux->bus, sht_addr);
+    for (int port = 0; port < MAX_PORTS; port++) {
+        int16_t error = topology_select(topology, mux_idx, 1 << port);
+        if (error) return error;
+        if (mux_dev_probe(mux, sht_addr)) {
+            topology_invalidate(topology);
+            continue;
+        }
+
+        uint16_t status = 0;
+        if (sht3x_dev_read_status_register(&sht, &status) == NO_ERROR) {
+            broadcast |= 1 << port;
+        } else {
+            conflict |= 1 << port;
+            topology_invalidate(topology);
+        }
+    }
+
+    *broadcast_mask = broadcast;
+    if (conflict_mask) *conflict_mask = conflict;
+    return 0;
+}
+
+// Serial number of the SGP40 on the selected site, 0 if it cannot be read
+static uint64_t presence_read_sgp_serial(MuxDevice* mux) {
+    sgp40_dev sgp;
+    uint16_t words[3];
+
+    sgp40_dev_init(&sgp, mux->bus);
+    if (sgp40_dev_get_serial_number(&sgp, words, 3) != NO_ERROR) return 0;
+    return ((uint64_t)words[0] << 32) | ((uint64_t)words[1] << 16) | words[2];
+}
+
+// Serial number of the SHT3x at addr on the selected site, 0 if it cannot be read
+static uint32_t presence_read_sht_serial(MuxDevice* mux, uint8_t addr) {
+    sht3x_dev sht;
+    uint32_t serial;
+
+    sht3x_dev_init(&sht, mux->bus, addr);
+    if (sht3x_dev_read_serial_number(&sht, &serial) != NO_ERROR) return 0;
+    return serial;
+}
+
+static void presence_probe_site(PortPresence* presence, MuxTopology* topology, int site) {
+    MuxDevice* mux = &topology->muxes[SITE_MUX(site)];
+    uint8_t previous = presence->devices[site];
+    uint8_t devices = 0;
+    uint64_t sgp_serial = 0;
+    uint32_t sht_serial = 0;
+
+    if (topology_select_site(topology, site) == 0) {
+        if (!mux_dev_probe(mux, SHT31_I2C_ADDR_44)) devices |= PRESENCE_SHT3X_44;
+        if (!mux_dev_probe(mux, SHT31_I2C_ADDR_45)) devices |= PRESENCE_SHT3X_45;
+        if (!mux_dev_probe(mux, SGP40_I2C_ADDR_59)) devices |= PRESENCE_SGP40;
+        // Only a sensor that just appeared can be a different one, periodic re-probes keep the serials
+        uint8_t appeared = devices & ~previous;
+        if ((devices & PRESENCE_SGP40) && ((appeared & PRESENCE_SGP40) || !presence->sgp_serial[site])) {
+            sgp_serial = presence_read_sgp_serial(mux);
+        }
+        uint8_t sht = devices & (PRESENCE_SHT3X_44 | PRESENCE_SHT3X_45);
+        if (sht && ((appeared & sht) || !presence->sht_serial[site])) {
+            sht_serial = presence_read_sht_serial(mux, (devices & PRESENCE_SHT3X_44) ? SHT31_I2C_ADDR_44 :
+                                                                                      SHT31_I2C_ADDR_45);
+        }
+    }
+    // A missing sensor fails the transaction that carried the channel selection
+    if (!(devices & PRESENCE_SHT3X_44)) topology_invalidate(topology);
+    presence->devices[site] = devices;
+
+    // Serials stay known while a sensor is unplugged, so re-plugging the same one is no new sensor
+    if ((sgp_serial && sgp_serial != presence->sgp_serial[site]) ||
+        (sht_serial && sht_serial != presence->sht_serial[site])) {
+        presence->identity_mask |= (uint64_t)1 << site;
+    }
+    if (sgp_serial) presence->sgp_serial[site] = sgp_serial;
+    if (sht_serial) presence->sht_serial[site] = sht_serial;
+}
+
+void presence_discover(PortPresence* presence, MuxTopology* topology, int reprobe_interval) {
+    presence->site_count = topology_site_count(topology);
+    presence->reprobe_interval = reprobe_interval;
+    presence->sweeps_since_probe = 0;
+    presence->stale_mask = 0;
+    memset(presence->devices, 0, sizeof(presence->devices));
+    memset(presence->sgp_serial, 0, sizeof(presence->sgp_serial));
+    memset(presence->sht_serial, 0, sizeof(presence->sht_serial));
+    for (int site = 0; site < presence->site_count; site++) {
+        presence_probe_site(presence, topology, site);
+    }
+    presence->identity_mask = 0;
+}
+
+void presence_refresh(PortPresence* presence, MuxTopology* topology) {
+    if (presence->reprobe_interval > 0 && ++presence->sweeps_since_probe >= presence->reprobe_interval) {
+        presence->sweeps_since_probe = 0;
+        presence->stale_mask = ~(uint64_t)0;
+    }
+    if (!presence->stale_mask) return;
+
+    for (int site = 0; site < presence->site_count; site++) {
+        if (presence->stale_mask & ((uint64_t)1 << site)) {
+            presence_probe_site(presence, topology, site);
+        }
+    }
+    presence->stale_mask = 0;
+}
+
+void presence_mark_failed(PortPresence* presence, int site) {
+    presence->stale_mask |= (uint64_t)1 << site;
+}
+
+int presence_port_ready(const PortPresence* presence, int site) {
+    uint8_t devices = presence->devices[site];
+    return (devices & PRESENCE_SGP40) && (devices & (PRESENCE_SHT3X_44 | PRESENCE_SHT3X_45));
+}
+
+uint8_t presence_sht_addr(const PortPresence* presence, int site) {
+    return (presence->devices[site] & PRESENCE_SHT3X_44) ? SHT31_I2C_ADDR_44 : SHT31_I2C_ADDR_45;
+}
+
+void health_init(PortHealth* health, int threshold, int max_backoff) {
+    memset(health, 0, sizeof(*health));
+    health->threshold = threshold;
+    health->max_backoff = max_backoff > 0 ? max_backoff : 1;
+}
+
+uint64_t health_begin_sweep(PortHealth* health, PortPresence* presence) {
+    uint64_t trials = 0;
+
+    health->sweep++;
+    for (uint64_t open = health->open_mask; open; open &= open - 1) {
+        int site = __builtin_ctzll(open);
+        if ((int32_t)(health->sweep - health->retry_sweep[site]) < 0) continue;
+
+        health->state[site] = BREAKER_HALF_OPEN;
+        trials |= (uint64_t)1 << site;
+        presence_mark_failed(presence, site);
+    }
+    health->open_mask &= ~trials;
+    return trials;
+}
+
+int health_allows(const PortHealth* health, int site) {
+    return health->state[site] != BREAKER_OPEN;
+}
+
+int health_record_success(PortHealth* health, int site) {
+    health->failures[site] = 0;
+    if (health->state[site] != BREAKER_HALF_OPEN) return 0;
+
+    health->state[site] = BREAKER_CLOSED;
+    health->trips[site] = 0;
+    health->stats.recoveries++;
+    return 1;
+}
+
+int health_record_failure(PortHealth* health, int site) {
+    if (health->threshold <= 0) return 0;
+    if (health->state[site] == BREAKER_CLOSED && ++health->failures[site] < health->threshold) return 0;
+
+    // Backoff of 1, 2, 4, ... sweeps, capped at max_backoff
+    int backoff = health->max_backoff;
+    if (health->trips[site] < 31 && (1 << health->trips[site]) < backoff) backoff = 1 << health->trips[site];
+    if (health->trips[site] < UINT8_MAX) health->trips[site]++;
+
+    health->state[site] = BREAKER_OPEN;
+    health->failures[site] = 0;
+    health->retry_sweep[site] = health->sweep + backoff;
+    health->open_mask |= (uint64_t)1 << site;
+    health->stats.trips++;
+    return 1;
+}
+
+int health_open_count(const PortHealth* health) {
+    return __builtin_popcountll(health->open_mask);
+}
+
+void sensor_bus_init(SensorBus* sensors, sensirion_i2c_hal_bus* bus, int reprobe_interval, int breaker_threshold,
+                     int breaker_max_backoff) {
+    topology_discover(&sensors->topology, bus);
+    for (int site = 0; site < MAX_SITES; site++) {
+        sht3x_dev_init(&sensors->sht[site][0], bus, SHT31_I2C_ADDR_44);
+        sht3x_dev_init(&sensors->sht[site][1], bus, SHT31_I2C_ADDR_45);
+        sgp40_dev_init(&sensors->sgp[site], bus);
+    }
+    memset(sensors->broadcast_mask, 0, sizeof(sensors->broadcast_mask));
+    presence_discover(&sensors->presence, &sensors->topology, reprobe_interval);
+    health_init(&sensors->health, breaker_threshold, breaker_max_backoff);
+    sensor_bus_set_echo(sensors, 0);
+    sensor_bus_set_snapshot(sensors, NULL);
+    sensor_bus_set_gas_index(sensors, NULL);
+    sensor_bus_set_calibration(sensors, NULL, 0);
+    sensors->replaced_mask = 0;
+    sensors->site_offset = 0;
+}
+
+void sensor_bus_set_echo(SensorBus* sensors, int interval_s) {
+    sensors->echo_interval_usec = interval_s < 0 ? -1 : (int64_t)interval_s * 1000000;
+    sensors->next_echo_usec = 0;
+    sensors->echo_sweep = false;
+}
+
+void sensor_bus_set_snapshot(SensorBus* sensors, struct SnapshotSegment* snapshot) {
+    sensors->snapshot = snapshot;
+}
+
+void sensor_bus_set_gas_index(SensorBus* sensors, struct GasIndexEngine* engine) {
+    sensors->gas_index = engine;
+}
+
+// Offsets of a site in ticks, the humidity one truncated like the global humidity offset always was
+static void sensor_bus_resolve_calibration(SensorBus* sensors, int site) {
+    BinlogSensor sensor = {.sgp_serial = sensors->presence.sgp_serial[site],
+                           .sht_serial = sensors->presence.sht_serial[site]};
+    const SensorCalibration* calibration = calibration_find(sensors->calibration, &sensor);
+    float temperature_offset = calibration ? calibration->temperature_offset : 0.f;
+    float humidity_offset = sensors->humidity_offset + (calibration ? calibration->humidity_offset : 0.f);
+
+    sensors->temperature_offset_ticks[site] = (int32_t)roundf((temperature_offset * 65535.0f) / 175.0f);
+    sensors->humidity_offset_ticks[site] = (int32_t)((humidity_offset * 65535.0f) / 100.0f);
+}
+
+void sensor_bus_set_calibration(SensorBus* sensors, const struct CalibrationTable* calibration, float humidity_offset) {
+    sensors->calibration = calibration;
+    sensors->humidity_offset = humidity_offset;
+    for (int site = 0; site < MAX_SITES; site++) {
+        sensor_bus_resolve_calibration(sensors, site);
+    }
+}
+
+void sensor_bus_site_name(const SensorBus* sensors, int site, char* buffer, size_t size) {
+    snprintf(buffer, size, "%02x_%d", sensors->topology.muxes[SITE_MUX(site)].address, SITE_PORT(site));
+}
+
+_Static_assert(PRESENCE_SHT3X_44 == 1 << 0 && PRESENCE_SHT3X_45 == 1 << 1, "presence bits index SensorBus.sht");
+
+// SHT3x found on a site by the presence cache, bit i for sensors->sht[site][i]
+static uint8_t site_sht_mask(const SensorBus* sensors, int site) {
+    return sensors->presence.devices[site] & (PRESENCE_SHT3X_44 | PRESENCE_SHT3X_45);
+}
+
+// Average of the ticks of the SHT3x of a site, rounded to the nearest tick
+static uint16_t sht_average_ticks(uint32_t sum, int count) {
+    return (uint16_t)((sum + count / 2) / count);
+}
+
+static void site_log_breaker(const SensorBus* sensors, int site) {
+    const PortHealth* health = &sensors->health;
+    char name[16];
+
+    sensor_bus_site_name(sensors, site, name, sizeof(name));
+    if (health->state[site] == BREAKER_OPEN) {
+        printf("Site %s | Breaker open, retry in %u sweeps\n", name,
+               (unsigned)(health->retry_sweep[site] - health->sweep));
+    } else if (health->state[site] == BREAKER_HALF_OPEN) {
+        printf("Site %s | Breaker half-open, trial measurement\n", name);
+    } else {
+        printf("Site %s | Breaker closed\n", name);
+    }
+}
+
+static void site_failed(SensorBus* sensors, int site) {
+    presence_mark_failed(&sensors->presence, site);
+    topology_invalidate(&sensors->topology);
+    if (health_record_failure(&sensors->health, site)) site_log_breaker(sensors, site);
+}
+
+static void site_succeeded(SensorBus* sensors, int site) {
+    if (health_record_success(&sensors->health, site)) site_log_breaker(sensors, site);
+}
+
+// Sensors new to a site get their own calibration and restart the VOC index algorithm, whose state
+// belonged to the previous sensor, if any. The owner of the bus learns about them through replaced_mask.
+static void sweep_replace_sensors(SensorBus* sensors) {
+    PortPresence* presence = &sensors->presence;
+
+    for (uint64_t replaced = presence->identity_mask; replaced; replaced &= replaced - 1) {
+        int site = __builtin_ctzll(replaced);
+        char name[16];
+
+        sensor_bus_resolve_calibration(sensors, site);
+        if (sensors->gas_index) gas_index_reset_site(sensors->gas_index, sensors->site_offset + site);
+        sensor_bus_site_name(sensors, site, name, sizeof(name));
+        printf("Site %s | New sensors, SGP40 %012llx, SHT3x %08x\n", name,
+               (unsigned long long)presence->sgp_serial[site], (unsigned)presence->sht_serial[site]);
+    }
+    sensors->replaced_mask |= presence->identity_mask;
+    presence->identity_mask = 0;
+}
+
+// Starts a sweep of a bus: lets the breakers due for a trial through, then refreshes the presence cache
+static void sweep_begin(SensorBus* sensors) {
+    uint64_t now = sensirion_i2c_hal_get_time_usec();
+    sensors->echo_sweep = sensors->echo_interval_usec >= 0 && now >= sensors->next_echo_usec;
+    if (sensors->echo_sweep) sensors->next_echo_usec = now + sensors->echo_interval_usec;
+
+    uint64_t trials = health_begin_sweep(&sensors->health, &sensors->presence);
+    for (; trials; trials &= trials - 1) {
+        site_log_breaker(sensors, __builtin_ctzll(trials));
+    }
+    presence_refresh(&sensors->presence, &sensors->topology);
+    if (sensors->presence.identity_mask) sweep_replace_sensors(sensors);
+}
+
+// Whether a site is populated and not skipped by its breaker
+static int site_enabled(SensorBus* sensors, int site) {
+    if (!presence_port_ready(&sensors->presence, site)) return 0;
+    if (health_allows(&sensors->health, site)) return 1;
+    sensors->health.stats.skipped++;
+    return 0;
+}
+
 void get_timestamp(char* buffer, size_t size) {
-    time_t now = time(NULL);
-    strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    format_timestamp((time_t)(sensirion_i2c_hal_get_realtime_usec() / 1000000), buffer, size);
+}
+
+void format_timestamp(time_t time, char* buffer, size_t size) {
+    struct tm tm;
+    strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", localtime_r(&time, &tm));
 }
 
-int read_config(int* oversample_count, float* humidity_offset) {
+int read_config(VOCConfig* config) {
     FILE* config_file = fopen(CONFIG_FILE, "r");
     if (!config_file) {
         fprintf(stderr, "Config file not found. Using defaults.\n");
         return -1;
     }
 
-    char line[128];
+    char line[512];
     while (fgets(line, sizeof(line), config_file)) {
-        char key[64], value[64];
+        char key[64], value[384];
         if (line[0] == '\0' || line[0] == '#') continue;
-        if (sscanf(line, "%63s = %63s", key, value) == 2) {
+        if (sscanf(line, "%63s = %383s", key, value) == 2) {
             if (strcmp(key, "oversample_count") == 0) {
-                *oversample_count = atoi(value);
-                if (*oversample_count <= 0) *oversample_count = 5;
+                config->oversample_count = atoi(value);
+                if (config->oversample_count <= 0) config->oversample_count = 5;
             } else if (strcmp(key, "humidity_offset") == 0) {
-                *humidity_offset = atof(value);
-                if (*humidity_offset < 0) *humidity_offset = 0;
+                config->humidity_offset = atof(value);
+                if (config->humidity_offset < 0) config->humidity_offset = 0;
+            } else if (strcmp(key, "reprobe_interval") == 0) {
+                config->reprobe_interval = atoi(value);
+                if (config->reprobe_interval < 0) config->reprobe_interval = 0;
+            } else if (strcmp(key, "breaker_threshold") == 0) {
+                config->breaker_threshold = atoi(value);
+                if (config->breaker_threshold < 0) config->breaker_threshold = 0;
+            } else if (strcmp(key, "breaker_max_backoff") == 0) {
+                config->breaker_max_backoff = atoi(value);
+                if (config->breaker_max_backoff <= 0) config->breaker_max_backoff = DEFAULT_BREAKER_MAX_BACKOFF;
+            } else if (strcmp(key, "i2c_buses") == 0) {
+                int bus_count = 0;
+                for (char* path = strtok(value, ","); path && bus_count < MAX_BUSES; path = strtok(NULL, ",")) {
+                    snprintf(config->bus_paths[bus_count++], sizeof(config->bus_paths[0]), "%s", path);
+                }
+                if (bus_count > 0) config->bus_count = bus_count;
+            } else if (strcmp(key, "single_thread") == 0) {
+                config->single_thread = atoi(value) != 0;
+            } else if (strcmp(key, "log_format") == 0) {
+                if (strcmp(value, "binary") == 0) {
+                    config->log_format = LOG_FORMAT_BINARY;
+                } else if (strcmp(value, "compressed") == 0) {
+                    config->log_format = LOG_FORMAT_COMPRESSED;
+                } else if (strcmp(value, "csv") == 0) {
+                    config->log_format = LOG_FORMAT_CSV;
+                } else {
+                    fprintf(stderr, "Unknown log_format '%s', ignored.\n", value);
+                }
+            } else if (strcmp(key, "log_stats") == 0) {
+                config->log_stats = atoi(value) != 0;
+            } else if (strcmp(key, "log_block_records") == 0) {
+                config->log_block_records = atoi(value);
+                if (config->log_block_records <= 0) config->log_block_records = DEFAULT_LOG_BLOCK_RECORDS;
+                if (config->log_block_records > TSLOG_MAX_BLOCK_RECORDS) config->log_block_records = TSLOG_MAX_BLOCK_RECORDS;
+            } else if (strcmp(key, "log_queue") == 0) {
+                config->log_queue = atoi(value);
+                if (config->log_queue < 0) config->log_queue = 0;
+            } else if (strcmp(key, "log_sync_rows") == 0) {
+                config->log_sync_rows = atoi(value);
+                if (config->log_sync_rows < 0) config->log_sync_rows = 0;
+            } else if (strcmp(key, "log_sync_interval") == 0) {
+                config->log_sync_interval = atoi(value);
+                if (config->log_sync_interval < 0) config->log_sync_interval = 0;
+            } else if (strcmp(key, "snapshot_name") == 0) {
+                if (strcmp(value, "none") == 0) {
+                    config->snapshot_name[0] = '\0';
+                } else if (value[0] == '/' && strlen(value) < sizeof(config->snapshot_name)) {
+                    strcpy(config->snapshot_name, value);
+                } else {
+                    fprintf(stderr, "snapshot_name must start with '/' and be shorter than %zu characters, ignored.\n",
+                            sizeof(config->snapshot_name));
+                }
+            } else if (strcmp(key, "sample_echo") == 0) {
+                config->sample_echo = atoi(value) != 0;
+            } else if (strcmp(key, "voc_index") == 0) {
+                config->voc_index = atoi(value) != 0;
+            } else if (strcmp(key, "voc_state_file") == 0) {
+                if (strcmp(value, "none") == 0) {
+                    config->voc_state_file[0] = '\0';
+                } else if (strlen(value) < sizeof(config->voc_state_file)) {
+                    strcpy(config->voc_state_file, value);
+                } else {
+                    fprintf(stderr, "voc_state_file must be shorter than %zu characters, ignored.\n",
+                            sizeof(config->voc_state_file));
+                }
+            } else if (strcmp(key, "voc_state_interval") == 0) {
+                config->voc_state_interval = atoi(value);
+                if (config->voc_state_interval < 1) config->voc_state_interval = 1;
+            } else if (strcmp(key, "voc_state_max_age") == 0) {
+                config->voc_state_max_age = atoi(value);
+                if (config->voc_state_max_age < 0) config->voc_state_max_age = 0;
+            } else if (strcmp(key, "calibration_file") == 0) {
+                if (strcmp(value, "none") == 0) {
+                    config->calibration_file[0] = '\0';
+                } else if (strlen(value) < sizeof(config->calibration_file)) {
+                    strcpy(config->calibration_file, value);
+                } else {
+                    fprintf(stderr, "calibration_file must be shorter than %zu characters, ignored.\n",
+                            sizeof(config->calibration_file));
+                }
+            } else if (strcmp(key, "sensor_map_file") == 0) {
+                if (strcmp(value, "none") == 0) {
+                    config->sensor_map_file[0] = '\0';
+                } else if (strlen(value) < sizeof(config->sensor_map_file)) {
+                    strcpy(config->sensor_map_file, value);
+                } else {
+                    fprintf(stderr, "sensor_map_file must be shorter than %zu characters, ignored.\n",
+                            sizeof(config->sensor_map_file));
+                }
+            } else if (strcmp(key, "log_columns") == 0) {
+                config->serial_columns = strcmp(value, "port") != 0;
+            } else if (strcmp(key, "sample_echo_interval") == 0) {
+                config->sample_echo_interval = atoi(value);
+                if (config->sample_echo_interval < 0) config->sample_echo_interval = 0;
+            } else if (strcmp(key, "log_overflow") == 0) {
+                config->log_block = strcmp(value, "block") == 0;
+            } else if (strcmp(key, "i2c_faults") == 0) {
+                if (strlen(value) < sizeof(config->fault_options)) {
+                    strcpy(config->fault_options, value);
+                } else {
+                    fprintf(stderr, "i2c_faults too long, ignored.\n");
+                }
+            } else if (strcmp(key, "virtual_clock") == 0) {
+                config->virtual_clock = atoi(value) != 0;
+            } else if (strcmp(key, "run_duration") == 0) {
+                config->run_duration = atoi(value);
+                if (config->run_duration < 0) config->run_duration = 0;
+            } else if (strcmp(key, "window_filter") == 0) {
+                if (strcmp(value, "median") == 0) {
+                    config->window_filter = WINDOW_FILTER_MEDIAN;
+                } else if (strcmp(value, "hampel") == 0) {
+                    config->window_filter = WINDOW_FILTER_HAMPEL;
+                } else if (strcmp(value, "none") == 0) {
+                    config->window_filter = WINDOW_FILTER_NONE;
+                } else {
+                    fprintf(stderr, "Unknown window_filter '%s', ignored.\n", value);
+                }
+            } else if (strcmp(key, "window_filter_threshold") == 0) {
+                config->window_filter_threshold = atof(value);
+                if (config->window_filter_threshold < 1.0f) config->window_filter_threshold = 1.0f;
+            } else if (strcmp(key, "sweep_mode") == 0) {
+                if (strcmp(value, "pipelined") == 0) {
+                    config->sweep_mode = SWEEP_PIPELINED;
+                } else if (strcmp(value, "broadcast") == 0) {
+                    config->sweep_mode = SWEEP_BROADCAST;
+                } else if (strcmp(value, "sequential") == 0) {
+                    config->sweep_mode = SWEEP_SEQUENTIAL;
+                } else {
+                    fprintf(stderr, "Unknown sweep_mode '%s', ignored.\n", value);
+                }
             }
         }
     }
@@ -80,12 +612,68 @@ int16_t measure_oversampled(int oversample_count, float humidity_offset, float*
     return 0;
 }
 
+static uint16_t humidity_offset_ticks(float humidity_offset) {
+    return (uint16_t)((humidity_offset * 65535.0f) / 100.0f);
+}
+
+static uint16_t offset_ticks(uint16_t ticks, int32_t offset) {
+    int32_t value = (int32_t)ticks + offset;
+    return value < 0 ? 0 : (value > UINT16_MAX ? UINT16_MAX : (uint16_t)value);
+}
+
+// Applies the calibration of a site to its SHT3x ticks, before they compensate the SGP40
+static void site_calibrate(const SensorBus* sensors, int site, uint16_t* temperature_ticks, uint16_t* humidity_ticks) {
+    *temperature_ticks = offset_ticks(*temperature_ticks, sensors->temperature_offset_ticks[site]);
+    *humidity_ticks = offset_ticks(*humidity_ticks, sensors->humidity_offset_ticks[site]);
+}
+
+// Welford's update of the n-th sample of a site, O(1) whatever the window length
+static inline void channel_stats_add(ChannelStats* stats, int site, int n, float x) {
+    float delta = x - stats->mean[site];
+
+    stats->mean[site] += delta / n;
+    stats->m2[site] += delta * (x - stats->mean[site]);
+    stats->min[site] = (n == 1 || x < stats->min[site]) ? x : stats->min[site];
+    stats->max[site] = (n == 1 || x > stats->max[site]) ? x : stats->max[site];
+    stats->last[site] = x;
+}
+
+static inline void channel_stats_add_sorted(ChannelStats* stats, int site, int n, float x) {
+    if (n <= WINDOW_FILTER_MAX_SAMPLES) window_filter_insert(stats->sorted[site], n - 1, x);
+}
+
+static void accumulate_sample(SensorAccumulator* accum, const SensorBus* sensors, int site, float t, float h,
+                              uint16_t voc) {
+    int index = sensors->site_offset + site;
+    int n = ++accum->sample_count[index];
+    char name[16];
+
+    channel_stats_add(&accum->temperature, index, n, t);
+    channel_stats_add(&accum->humidity, index, n, h);
+    channel_stats_add(&accum->voc, index, n, voc);
+    if (accum->filter != WINDOW_FILTER_NONE) {
+        channel_stats_add_sorted(&accum->temperature, index, n, t);
+        channel_stats_add_sorted(&accum->humidity, index, n, h);
+        channel_stats_add_sorted(&accum->voc, index, n, voc);
+    }
+
+    if (sensors->gas_index) gas_index_set_sample(sensors->gas_index, sensors->site_offset + site, voc);
+    if (sensors->snapshot) {
+        snapshot_publish_sample(sensors->snapshot, sensors->site_offset + site, t, h, voc,
+                                sensirion_i2c_hal_get_realtime_usec());
+    }
+
+    if (!sensors->echo_sweep) return;
+    sensor_bus_site_name(sensors, site, name, sizeof(name));
+    printf("Site %s | Temp: %.2f °C | Humidity: %.2f %% | VOC: %u ticks\n", name, t, h, voc);
+}
+
 int16_t single_measure(float* humidity, float* temperature, uint16_t* raw_voc, float humidity_offset) {
     uint16_t h_ticks = 0, t_ticks = 0;
     int16_t error = sht3x_measure_single_shot(REPEATABILITY_HIGH, false, &t_ticks, &h_ticks);
     if (error != NO_ERROR) return error;
 
-    h_ticks += (uint16_t)((humidity_offset * 65535.0f) / 100.0f);
+    h_ticks += humidity_offset_ticks(humidity_offset);
 
     *humidity = signal_humidity(h_ticks);
     *temperature = signal_temperature(t_ticks);
@@ -94,48 +682,390 @@ int16_t single_measure(float* humidity, float* temperature, uint16_t* raw_voc, f
     return error;
 }
 
-void sample_all_ports(SensorAccumulator accum[], float humidity_offset) {
-    for (int port = 0; port < MAX_PORTS; port++) {
-        mux_port_select(port);
-
-        if (!mux_i2c_detect()) {
-            float t = 0, h = 0;
-            uint16_t voc = 0;
-            if (single_measure(&h, &t, &voc, humidity_offset) == 0) {
-                accum[port].temp_sum += t;
-                accum[port].hum_sum += h;
-                accum[port].voc_sum += voc;
-                accum[port].sample_count++;
-
-                printf("Port %d | Temp: %.2f °C | Humidity: %.2f %% | VOC: %u ticks\n", port, t, h, voc);
+int16_t single_measure_dev(sht3x_dev* sht, sgp40_dev* sgp, float* humidity, float* temperature, uint16_t* raw_voc,
+                           float humidity_offset) {
+    uint16_t h_ticks = 0, t_ticks = 0;
+    int16_t error = sht3x_dev_measure_single_shot(sht, REPEATABILITY_HIGH, false, &t_ticks, &h_ticks);
+    if (error != NO_ERROR) return error;
+
+    h_ticks += humidity_offset_ticks(humidity_offset);
+
+    *humidity = signal_humidity(h_ticks);
+    *temperature = signal_temperature(t_ticks);
+
+    error = sgp40_dev_measure_raw_signal(sgp, h_ticks, t_ticks, raw_voc);
+    return error;
+}
+
+static int16_t site_measure(SensorBus* sensors, int site, float* humidity, float* temperature, uint16_t* raw_voc) {
+    uint8_t mask = site_sht_mask(sensors, site);
+    uint32_t t_sum = 0, h_sum = 0;
+    int count = 0;
+
+    // The SHT3x at 0x44 and 0x45 convert at the same time
+    for (int i = 0; i < SITE_SHT_COUNT; i++) {
+        if (!(mask & (1 << i))) continue;
+        int16_t error = sht3x_dev_start_single_shot(&sensors->sht[site][i], REPEATABILITY_HIGH, false);
+        if (error != NO_ERROR) return error;
+    }
+    sensirion_i2c_hal_sleep_usec(sht3x_single_shot_duration_us(REPEATABILITY_HIGH));
+    for (int i = 0; i < SITE_SHT_COUNT; i++) {
+        if (!(mask & (1 << i))) continue;
+        uint16_t t = 0, h = 0;
+        int16_t error = sht3x_dev_read_single_shot(&sensors->sht[site][i], &t, &h);
+        if (error != NO_ERROR) return error;
+        t_sum += t;
+        h_sum += h;
+        count++;
+    }
+    uint16_t t_ticks = sht_average_ticks(t_sum, count);
+    uint16_t h_ticks = sht_average_ticks(h_sum, count);
+
+    site_calibrate(sensors, site, &t_ticks, &h_ticks);
+
+    *humidity = signal_humidity(h_ticks);
+    *temperature = signal_temperature(t_ticks);
+
+    return sgp40_dev_measure_raw_signal(&sensors->sgp[site], h_ticks, t_ticks, raw_voc);
+}
+
+void sample_all_ports(SensorAccumulator* accum, SensorBus* sensors) {
+    sweep_begin(sensors);
+
+    for (int site = 0; site < sensors->presence.site_count; site++) {
+        if (!site_enabled(sensors, site)) continue;
+        topology_select_site(&sensors->topology, site);
+
+        float t = 0, h = 0;
+        uint16_t voc = 0;
+        if (site_measure(sensors, site, &h, &t, &voc) == 0) {
+            site_succeeded(sensors, site);
+            accumulate_sample(accum, sensors, site, t, h, voc);
+        } else {
+            site_failed(sensors, site);
+        }
+    }
+}
+
+void event_loop_init(EventLoop* loop) {
+    loop->site_count = 0;
+    loop->pending = 0;
+}
+
+static SiteMeasurement* event_loop_add(EventLoop* loop, SensorBus* sensors, SensorAccumulator* accum, int site) {
+    if (loop->site_count >= EVENT_LOOP_MAX_SITES) return NULL;
+
+    SiteMeasurement* measurement = &loop->sites[loop->site_count++];
+    measurement->sensors = sensors;
+    measurement->accum = accum;
+    measurement->site = site;
+    measurement->state = SITE_IDLE;
+    measurement->sht_mask = site_sht_mask(sensors, site);
+    for (int i = 0; i < SITE_SHT_COUNT; i++) {
+        measurement->sht[i].state = SHT3X_MEASUREMENT_IDLE;
+    }
+    return measurement;
+}
+
+static void event_loop_fail(EventLoop* loop, SiteMeasurement* measurement) {
+    measurement->state = SITE_FAILED;
+    loop->pending--;
+    site_failed(measurement->sensors, measurement->site);
+}
+
+void event_loop_issue_bus(EventLoop* loop, SensorBus* sensors, SensorAccumulator* accum, bool broadcast) {
+    PortPresence* presence = &sensors->presence;
+    MuxTopology* topology = &sensors->topology;
+    int first = loop->site_count;
+
+    sweep_begin(sensors);
+    for (int site = 0; site < presence->site_count; site++) {
+        if (site_enabled(sensors, site)) event_loop_add(loop, sensors, accum, site);
+    }
+    int last = loop->site_count;
+
+    // One trigger of the SHT3x at 0x44 per broadcast group, the group members share its completion time
+    for (int mux_idx = 0; broadcast && mux_idx < topology->mux_count; mux_idx++) {
+        uint8_t group = 0;
+        for (int i = first; i < last; i++) {
+            if (SITE_MUX(loop->sites[i].site) == mux_idx) group |= 1 << SITE_PORT(loop->sites[i].site);
+        }
+        group &= sensors->broadcast_mask[mux_idx];
+        if (!group || topology_select(topology, mux_idx, group) != 0) continue;
+
+        sht3x_dev trigger;
+        sht3x_measurement triggered;
+        sht3x_dev_init(&trigger, topology->muxes[mux_idx].bus, SHT31_I2C_ADDR_44);
+        if (sht3x_dev_measurement_issue(&trigger, &triggered, REPEATABILITY_HIGH) != NO_ERROR) {
+            topology_invalidate(topology);
+            continue;
+        }
+        for (int i = first; i < last; i++) {
+            SiteMeasurement* measurement = &loop->sites[i];
+            if (SITE_MUX(measurement->site) != mux_idx || !(group & (1 << SITE_PORT(measurement->site)))) continue;
+            measurement->sht[0] = triggered;
+        }
+    }
+
+    // Every SHT3x the broadcast did not trigger, the one at 0x45 included
+    for (int i = first; i < last; i++) {
+        SiteMeasurement* measurement = &loop->sites[i];
+        bool selected = false;
+
+        loop->pending++;
+        measurement->state = SITE_SHT_CONVERTING;
+        for (int k = 0; k < SITE_SHT_COUNT; k++) {
+            if (!(measurement->sht_mask & (1 << k)) || measurement->sht[k].state != SHT3X_MEASUREMENT_IDLE) continue;
+            if (!selected) topology_select_site(topology, measurement->site);
+            selected = true;
+            if (sht3x_dev_measurement_issue(&sensors->sht[measurement->site][k], &measurement->sht[k],
+                                            REPEATABILITY_HIGH) != NO_ERROR) {
+                event_loop_fail(loop, measurement);
+                break;
             }
         }
     }
 }
 
-void finalize_averages(FILE* logfile, SensorAccumulator accum[], int oversample_count, const char* timestamp) {
-    char csv_row[1024] = "";
-    snprintf(csv_row, sizeof(csv_row), "%s", timestamp);
+// Time the last SHT3x conversion of a site ends
+static uint64_t site_sht_ready_usec(const SiteMeasurement* measurement) {
+    uint64_t ready = 0;
 
-    for (int port = 0; port < MAX_PORTS; port++) {
-        if (accum[port].sample_count == oversample_count) {
-            float avg_temp = accum[port].temp_sum / oversample_count;
-            float avg_hum = accum[port].hum_sum / oversample_count;
-            uint16_t avg_voc = accum[port].voc_sum / oversample_count;
+    for (int k = 0; k < SITE_SHT_COUNT; k++) {
+        if ((measurement->sht_mask & (1 << k)) && measurement->sht[k].ready_usec > ready) {
+            ready = measurement->sht[k].ready_usec;
+        }
+    }
+    return ready;
+}
+
+static void event_loop_advance(EventLoop* loop, SiteMeasurement* measurement, uint64_t now) {
+    SensorBus* sensors = measurement->sensors;
+    int site = measurement->site;
+
+    if (measurement->state == SITE_SHT_CONVERTING && now >= site_sht_ready_usec(measurement)) {
+        uint32_t t_sum = 0, h_sum = 0;
+        int count = 0;
+
+        topology_select_site(&sensors->topology, site);
+        for (int k = 0; k < SITE_SHT_COUNT; k++) {
+            if (!(measurement->sht_mask & (1 << k))) continue;
+            if (sht3x_dev_measurement_fetch(&sensors->sht[site][k], &measurement->sht[k]) != NO_ERROR) {
+                event_loop_fail(loop, measurement);
+                return;
+            }
+            t_sum += measurement->sht[k].temperature_ticks;
+            h_sum += measurement->sht[k].humidity_ticks;
+            count++;
+        }
+        measurement->temperature_ticks = sht_average_ticks(t_sum, count);
+        measurement->humidity_ticks = sht_average_ticks(h_sum, count);
+        site_calibrate(sensors, site, &measurement->temperature_ticks, &measurement->humidity_ticks);
+
+        if (sgp40_dev_measurement_issue(&sensors->sgp[site], &measurement->sgp, measurement->humidity_ticks,
+                                        measurement->temperature_ticks) != NO_ERROR) {
+            event_loop_fail(loop, measurement);
+            return;
+        }
+        measurement->state = SITE_SGP_CONVERTING;
+    } else if (measurement->state == SITE_SGP_CONVERTING && sgp40_measurement_is_due(&measurement->sgp, now)) {
+        topology_select_site(&sensors->topology, site);
+        if (sgp40_dev_measurement_fetch(&sensors->sgp[site], &measurement->sgp) != NO_ERROR) {
+            event_loop_fail(loop, measurement);
+            return;
+        }
+        measurement->state = SITE_DONE;
+        loop->pending--;
+        site_succeeded(sensors, site);
+        accumulate_sample(measurement->accum, sensors, site, signal_temperature(measurement->temperature_ticks),
+                          signal_humidity(measurement->humidity_ticks), measurement->sgp.sraw_voc);
+    }
+}
+
+int event_loop_step(EventLoop* loop, uint64_t* next_wake_usec) {
+    uint64_t now = sensirion_i2c_hal_get_time_usec();
+    uint64_t next_wake = UINT64_MAX;
+
+    for (int i = 0; i < loop->site_count; i++) {
+        SiteMeasurement* measurement = &loop->sites[i];
+        event_loop_advance(loop, measurement, now);
+
+        if (measurement->state == SITE_SHT_CONVERTING && site_sht_ready_usec(measurement) < next_wake) {
+            next_wake = site_sht_ready_usec(measurement);
+        } else if (measurement->state == SITE_SGP_CONVERTING && measurement->sgp.ready_usec < next_wake) {
+            next_wake = measurement->sgp.ready_usec;
+        }
+    }
+
+    if (next_wake_usec) *next_wake_usec = next_wake;
+    return loop->pending;
+}
+
+void event_loop_run(EventLoop* loop) {
+    uint64_t next_wake;
+
+    while (event_loop_step(loop, &next_wake) > 0) {
+        sensirion_i2c_hal_sleep_until_usec(next_wake);
+    }
+}
+
+static void sample_ports_pipelined(SensorAccumulator* accum, SensorBus* sensors, bool broadcast) {
+    EventLoop loop;
 
-            snprintf(csv_row + strlen(csv_row), sizeof(csv_row) - strlen(csv_row),
-                     ",%.2f,%.2f,%u", avg_temp, avg_hum, avg_voc);
+    event_loop_init(&loop);
+    event_loop_issue_bus(&loop, sensors, accum, broadcast);
+    event_loop_run(&loop);
+}
+
+void sample_all_ports_pipelined(SensorAccumulator* accum, SensorBus* sensors) {
+    sample_ports_pipelined(accum, sensors, false);
+}
+
+void sample_all_ports_broadcast(SensorAccumulator* accum, SensorBus* sensors) {
+    sample_ports_pipelined(accum, sensors, true);
+}
+
+const char* sweep_mode_name(SweepMode mode) {
+    switch (mode) {
+        case SWEEP_PIPELINED: return "pipelined";
+        case SWEEP_BROADCAST: return "broadcast";
+        default: return "sequential";
+    }
+}
+
+// Appends the ",std,min,max,last" columns of one channel of a site
+static void record_csv_stats(const LogChannelStats* stats, int site, int decimals, CsvRow* row) {
+    csv_put_char(row, ',');
+    csv_put_fixed(row, stats->std[site], decimals + 1);
+    csv_put_char(row, ',');
+    csv_put_fixed(row, stats->min[site], decimals);
+    csv_put_char(row, ',');
+    csv_put_fixed(row, stats->max[site], decimals);
+    csv_put_char(row, ',');
+    csv_put_fixed(row, stats->last[site], decimals);
+}
+
+// Appends the ",T,H,VOC" columns of every site of a record, followed by ",VOCI" if it has indices and by
+// the statistics of the three channels if it has them
+static void record_csv_columns(const LogRecord* record, CsvRow* row) {
+    for (int site = 0; site < record->site_count; site++) {
+        if (record->valid[site / 64] & ((uint64_t)1 << (site % 64))) {
+            csv_put_char(row, ',');
+            csv_put_fixed(row, record->temperature[site], 2);
+            csv_put_char(row, ',');
+            csv_put_fixed(row, record->humidity[site], 2);
+            csv_put_char(row, ',');
+            csv_put_uint(row, record->voc[site]);
+            if (record->has_voc_index) {
+                csv_put_char(row, ',');
+                csv_put_uint(row, record->voc_index[site]);
+            }
+            if (record->has_stats) {
+                record_csv_stats(&record->temperature_stats, site, 2, row);
+                record_csv_stats(&record->humidity_stats, site, 2, row);
+                record_csv_stats(&record->voc_stats, site, 0, row);
+            }
+        } else {
+            csv_put_text(row, record->has_voc_index ? ",NaN,NaN,NaN,NaN" : ",NaN,NaN,NaN");
+            if (record->has_stats) csv_put_text(row, ",NaN,NaN,NaN,NaN,NaN,NaN,NaN,NaN,NaN,NaN,NaN,NaN");
+        }
+    }
+}
+
+static void finalize_channel_stats(LogChannelStats* out, const ChannelStats* stats, const uint16_t count[],
+                                   int port_count) {
+    for (int port = 0; port < port_count; port++) {
+        out->std[port] = count[port] > 1 ? sqrtf(stats->m2[port] / (count[port] - 1)) : 0.f;
+        out->min[port] = stats->min[port];
+        out->max[port] = stats->max[port];
+        out->last[port] = stats->last[port];
+    }
+}
+
+// Robust average of one channel of a site, adding its outliers to those of the site
+static float finalize_channel_filtered(const SensorAccumulator* accum, const ChannelStats* stats, int port,
+                                       float resolution, uint16_t* outliers) {
+    WindowFilterResult result;
+
+    window_filter_apply(stats->sorted[port], accum->sample_count[port], accum->filter_threshold, resolution,
+                        &result);
+    *outliers += result.outliers;
+    return accum->filter == WINDOW_FILTER_MEDIAN ? result.median : result.mean;
+}
+
+void finalize_record(LogRecord* record, const SensorAccumulator* accum, int port_count, int oversample_count,
+                     time_t timestamp, bool voc_index, bool stats) {
+    if (port_count > LOG_RECORD_MAX_SITES) port_count = LOG_RECORD_MAX_SITES;
+
+    record->timestamp = timestamp;
+    record->site_count = port_count;
+    record->has_voc_index = voc_index;
+    record->has_stats = stats;
+    record->outlier_count = 0;
+    memset(record->valid, 0, sizeof(record->valid));
+    for (int port = 0; port < port_count; port++) {
+        record->outliers[port] = 0;
+        if (accum->sample_count[port] != oversample_count) continue;
+
+        float voc;
+        record->valid[port / 64] |= (uint64_t)1 << (port % 64);
+        if (accum->filter != WINDOW_FILTER_NONE && oversample_count <= WINDOW_FILTER_MAX_SAMPLES) {
+            uint16_t* outliers = &record->outliers[port];
+            record->temperature[port] = finalize_channel_filtered(accum, &accum->temperature, port,
+                                                                  175.0f / 65535.0f, outliers);
+            record->humidity[port] = finalize_channel_filtered(accum, &accum->humidity, port, 100.0f / 65535.0f,
+                                                               outliers);
+            voc = finalize_channel_filtered(accum, &accum->voc, port, 1.0f, outliers);
+            record->outlier_count += *outliers;
         } else {
-            snprintf(csv_row + strlen(csv_row), sizeof(csv_row) - strlen(csv_row), ",NaN,NaN,NaN");
+            record->temperature[port] = accum->temperature.mean[port];
+            record->humidity[port] = accum->humidity.mean[port];
+            voc = accum->voc.mean[port];
         }
+        record->voc[port] = (uint16_t)(voc + 0.5f);
+        record->voc_index[port] = (accum->voc_index_sum[port] + oversample_count / 2) / oversample_count;
     }
+    if (stats) {
+        finalize_channel_stats(&record->temperature_stats, &accum->temperature, accum->sample_count, port_count);
+        finalize_channel_stats(&record->humidity_stats, &accum->humidity, accum->sample_count, port_count);
+        finalize_channel_stats(&record->voc_stats, &accum->voc, accum->sample_count, port_count);
+    }
+}
+
+size_t format_record_csv(const LogRecord* record, char* buffer, size_t size) {
+    CsvRow row;
+
+    csv_row_init(&row, buffer, size);
+    csv_put_timestamp(&row, record->timestamp);
+    record_csv_columns(record, &row);
+    csv_put_char(&row, '\n');
+    return csv_row_finish(&row);
+}
+
+uint32_t finalize_averages(FILE* logfile, const SensorAccumulator* accum, int port_count, int oversample_count,
+                           const char* timestamp, bool stats) {
+    LogRecord record;
+    char columns[LOG_RECORD_CSV_MAX];
+    CsvRow row;
 
-    fprintf(logfile, "%s\n", csv_row);
+    finalize_record(&record, accum, port_count, oversample_count, 0, false, stats);
+    csv_row_init(&row, columns, sizeof(columns));
+    record_csv_columns(&record, &row);
+    csv_put_char(&row, '\n');
+    csv_row_finish(&row);
+    fputs(timestamp, logfile);
+    fputs(columns, logfile);
     fflush(logfile);
+    return record.outlier_count;
 }
 
-void reset_accumulators(SensorAccumulator accum[]) {
-    for (int i = 0; i < MAX_PORTS; i++) {
-        accum[i] = (SensorAccumulator){0};
+void reset_accumulators(SensorAccumulator* accum, int port_count) {
+    // The first sample of a window sets min, max and last, only the running sums need clearing
+    for (int i = 0; i < port_count; i++) {
+        accum->sample_count[i] = 0;
+        accum->voc_index_sum[i] = 0;
+        accum->temperature.mean[i] = accum->temperature.m2[i] = 0.f;
+        accum->humidity.mean[i] = accum->humidity.m2[i] = 0.f;
+        accum->voc.mean[i] = accum->voc.m2[i] = 0.f;
     }
 }
@@ -11,10 +11,7 @@
 #include "sensirion_i2c_hal.h"
 #include "sgp40_i2c.h"
 #include "sht3x_i2c.h"
-
-
-#endif //VOC_ESSENTIALS_H
-
+#include "VOC_window_filter.h"
 
 #include "stdlib.h"
 #include "stdio.h"
@@ -25,6 +22,19 @@
 
 #define MAX_PORTS 8
 
+#define MAX_MUXES 8
+#define MAX_SITES (MAX_MUXES * MAX_PORTS)
+
+#define SITE_MUX(site) ((site) / MAX_PORTS)
+#define SITE_PORT(site) ((site) % MAX_PORTS)
+
+#define MAX_BUSES SENSIRION_I2C_HAL_MAX_BUSES
+#ifdef VOC_SIMULATED_I2C
+#define DEFAULT_I2C_BUS "sim:"
+#else
+#define DEFAULT_I2C_BUS "/dev/i2c-1"
+#endif
+
 
 #define TCA_ADDR_70 0x70
 #define TCA_ADDR_71 0x71
@@ -35,20 +45,312 @@
 #define TCA_ADDR_76 0x76
 #define TCA_ADDR_77 0x77
 
+#define SGP40_I2C_ADDR_59 0x59
+
+#define PRESENCE_SHT3X_44 0x01
+#define PRESENCE_SHT3X_45 0x02
+#define PRESENCE_SGP40 0x04
+#define SITE_SHT_COUNT 2   /**< SHT3x a site can carry, at 0x44 and 0x45, flagged by the first presence bits. */
+
+#define DEFAULT_REPROBE_INTERVAL 60
+#define DEFAULT_BREAKER_THRESHOLD 3
+#define DEFAULT_BREAKER_MAX_BACKOFF 256
+
 /**
- * @struct SensorAccumulator
- * @brief A structure to accumulate sensor readings over multiple samples for averaging.
+ * @struct MuxDevice
+ * @brief TCA9548A multiplexer on one i2c bus.
+ */
+typedef struct {
+    sensirion_i2c_hal_bus* bus;  /**< Bus of the multiplexer, NULL for the calling thread's selected bus. */
+    uint8_t address;             /**< Multiplexer address (TCA_ADDR_70 to TCA_ADDR_77). */
+} MuxDevice;
+
+/**
+ * @struct MuxTopology
+ * @brief Multiplexers found on one i2c bus and the channels they currently enable.
+ *
+ * Up to MAX_MUXES multiplexers share the bus, giving MAX_PORTS sensor sites each. Site n is port
+ * SITE_PORT(n) of the multiplexer SITE_MUX(n). Sensors behind different multiplexers share the same
+ * addresses, so only one multiplexer has channels enabled at a time. The enabled channels are
+ * tracked so that topology_select() only writes to the multiplexers whose state must change.
+ */
+typedef struct {
+    MuxDevice muxes[MAX_MUXES];  /**< Multiplexers found on the bus, by increasing address. */
+    int mux_count;               /**< Number of entries in muxes. */
+    int active_mux;              /**< Multiplexer whose channels are enabled, -1 if none. */
+    uint8_t active_mask;         /**< Channels enabled on active_mux. */
+    bool active_stale;           /**< The state of active_mux is unknown and must be rewritten. */
+} MuxTopology;
+
+/**
+ * @struct PortPresence
+ * @brief Cache of the sensors found on each sensor site.
+ *
+ * The cache is filled once by presence_discover() and then kept up to date by presence_refresh(),
+ * which only re-probes the sensor addresses of sites that failed or whose re-probe interval expired.
+ * Sweeps read it instead of scanning the bus. The serial numbers of the sensors are read when they
+ * appear on a site, so that data, calibration and learned state follow a sensor rather than its port.
+ */
+typedef struct {
+    uint8_t devices[MAX_SITES];  /**< PRESENCE_* flags of the sensors found on each site. */
+    uint64_t sgp_serial[MAX_SITES]; /**< 48-bit serial number of the SGP40 last found on each site, 0 if unknown. */
+    uint32_t sht_serial[MAX_SITES]; /**< Serial number of the SHT3x last found on each site, 0 if unknown. */
+    uint64_t identity_mask;      /**< Sites with a sensor not found there before since discovery, until cleared. */
+    uint64_t stale_mask;         /**< Sites to re-probe before the next sweep (bit n = site n). */
+    int site_count;              /**< Number of sites of the topology. */
+    int reprobe_interval;        /**< Sweeps between two re-probes of every site, 0 disables them. */
+    int sweeps_since_probe;      /**< Sweeps since the last re-probe of every site. */
+} PortPresence;
+
+/**
+ * @enum BreakerState
+ * @brief State of the circuit breaker of a sensor site.
+ */
+typedef enum {
+    BREAKER_CLOSED = 0,    /**< The site is measured on every sweep. */
+    BREAKER_OPEN = 1,      /**< The site failed repeatedly and is skipped until its retry sweep. */
+    BREAKER_HALF_OPEN = 2, /**< One trial measurement decides whether the site closes or opens again. */
+} BreakerState;
+
+/**
+ * @struct PortHealthStats
+ * @brief Circuit breaker counters of one bus, see PortHealth.
+ */
+typedef struct {
+    uint64_t trips;        /**< Transitions to BREAKER_OPEN, including failed trials. */
+    uint64_t recoveries;   /**< Transitions from BREAKER_HALF_OPEN to BREAKER_CLOSED. */
+    uint64_t skipped;      /**< Measurements of populated sites skipped by an open breaker. */
+} PortHealthStats;
+
+/**
+ * @struct PortHealth
+ * @brief Circuit breaker of every sensor site of one bus.
+ *
+ * After threshold consecutive failures a site is opened and skipped by the sweeps, so a broken sensor
+ * no longer costs its conversion time on every sweep. It is retried after a backoff that doubles with
+ * every failed trial, from one sweep up to max_backoff sweeps. The per-site arrays are indexed by site.
+ */
+typedef struct {
+    uint8_t state[MAX_SITES];        /**< BreakerState of each site. */
+    uint8_t failures[MAX_SITES];     /**< Consecutive failures of each site, up to threshold. */
+    uint8_t trips[MAX_SITES];        /**< Consecutive trips of each site, the backoff exponent. */
+    uint32_t retry_sweep[MAX_SITES]; /**< Sweep at which an open site gets its trial. */
+    uint64_t open_mask;              /**< Sites in BREAKER_OPEN (bit n = site n). */
+    uint32_t sweep;                  /**< Sweeps started since health_init(). */
+    int threshold;                   /**< Consecutive failures opening a site, 0 disables the breaker. */
+    int max_backoff;                 /**< Longest backoff in sweeps. */
+    PortHealthStats stats;           /**< Counters, reset by the caller. */
+} PortHealth;
+
+struct SnapshotSegment;
+struct GasIndexEngine;
+struct CalibrationTable;
+
+/**
+ * @struct SensorBus
+ * @brief Multiplexer and sensors of one i2c bus.
+ *
+ * Every sensor has its own driver context, so sensors sharing an address on different sites, or an
+ * SHT3x at 0x44 and another at 0x45, never overwrite each other's state. A site carrying both SHT3x
+ * measures both, and its temperature and humidity are their average. A SensorBus can be swept
+ * from any thread, as long as a single thread uses it at a time.
+ */
+typedef struct {
+    MuxTopology topology;        /**< Multiplexers in front of the sensors. */
+    PortPresence presence;       /**< Sensors found on each site. */
+    PortHealth health;           /**< Circuit breaker of each site. */
+    sht3x_dev sht[MAX_SITES][SITE_SHT_COUNT]; /**< SHT3x at 0x44 and 0x45 of each site. */
+    sgp40_dev sgp[MAX_SITES];    /**< SGP40 of each site. */
+    uint8_t broadcast_mask[MAX_MUXES]; /**< Ports of each multiplexer sharing the broadcast SHT3x trigger. */
+    int64_t echo_interval_usec;  /**< Shortest time between two sweeps echoed on the console, -1 for none. */
+    uint64_t next_echo_usec;     /**< HAL time from which the next sweep is echoed. */
+    bool echo_sweep;             /**< Whether the samples of the current sweep are echoed. */
+    struct SnapshotSegment* snapshot; /**< Shared memory the samples are published to, NULL for none. */
+    struct GasIndexEngine* gas_index; /**< VOC index algorithm fed with the samples, NULL for none. */
+    int site_offset;             /**< Index of the first site of this bus in the accumulators, snapshot and gas index, 0 until
+                                      the bus pool lays out its sites after discovery. */
+    const struct CalibrationTable* calibration; /**< Calibration of the known sensors, NULL for none. */
+    float humidity_offset;       /**< Offset in %RH applied to the humidity of every site. */
+    int32_t temperature_offset_ticks[MAX_SITES]; /**< Calibration of the sensor of each site, in SHT3x ticks. */
+    int32_t humidity_offset_ticks[MAX_SITES];    /**< Calibration and humidity_offset of each site, in SHT3x ticks. */
+    uint64_t replaced_mask;      /**< Sites whose sensors were replaced during the run, until their owner clears it. */
+} SensorBus;
+
+/**
+ * @enum SweepMode
+ * @brief Strategy used by the acquisition loop to measure all ports once.
+ */
+typedef enum {
+    SWEEP_SEQUENTIAL = 0,  /**< Measure one port at a time, waiting for each conversion. */
+    SWEEP_PIPELINED = 1,   /**< Start conversions on every port, then collect the results. */
+    SWEEP_BROADCAST = 2,   /**< Like SWEEP_PIPELINED, with one SHT3x trigger sent to all channels at once. */
+} SweepMode;
+
+/**
+ * @enum LogFormat
+ * @brief Format of the log file.
+ */
+typedef enum {
+    LOG_FORMAT_CSV = 0,     /**< One text line per log window. */
+    LOG_FORMAT_BINARY = 1,  /**< Fixed-width records, see VOC_binlog.h. */
+    LOG_FORMAT_COMPRESSED = 2, /**< Delta encoded blocks of records, see VOC_tslog.h. */
+} LogFormat;
+
+/**
+ * @struct VOCConfig
+ * @brief Runtime configuration read from CONFIG_FILE.
+ */
+typedef struct {
+    int oversample_count;   /**< Number of samples averaged per logged row. */
+    float humidity_offset;  /**< Offset in %RH applied to humidity readings. */
+    SweepMode sweep_mode;   /**< Strategy used to sample all ports. */
+    int reprobe_interval;   /**< Sweeps between two presence re-probes of every port, 0 disables them. */
+    int breaker_threshold;  /**< Consecutive failures skipping a port, 0 disables the circuit breaker. */
+    int breaker_max_backoff; /**< Longest wait in sweeps before retrying a skipped port. */
+    int bus_count;          /**< Number of i2c buses in bus_paths. */
+    bool single_thread;     /**< Sweep all buses from one thread instead of one thread per bus. */
+    bool virtual_clock;     /**< Run on the virtual clock of the HAL instead of real time. */
+    int run_duration;       /**< Seconds of acquisition before exiting, 0 to run forever. */
+    char bus_paths[MAX_BUSES][64]; /**< Device path of each i2c bus, each one gets its own acquisition thread. */
+    char fault_options[128];       /**< Faults injected on every bus, see sensirion_i2c_fault_create(), empty for none. */
+    LogFormat log_format;   /**< Format of the log file. */
+    bool log_stats;         /**< Log the spread of every channel next to its average, CSV format only. */
+    WindowFilter window_filter; /**< Average of the samples of a window logged for each channel. */
+    float window_filter_threshold; /**< Median absolute deviations beyond which a sample is an outlier. */
+    int log_queue;          /**< Records queued to the log writer thread, 0 to write from the acquisition thread. */
+    bool log_block;         /**< Wait for the log writer when its queue is full instead of dropping the record. */
+    int log_sync_rows;      /**< Rows per fdatasync() of the log file, 0 for no row budget. */
+    int log_sync_interval;  /**< Longest time in seconds a row waits for its fdatasync(), 0 for no time budget. */
+    int log_block_records;  /**< Records per block of a compressed log. */
+    char snapshot_name[64]; /**< Shared memory name of the snapshot of the latest values, empty for none. */
+    bool sample_echo;       /**< Print the samples on the console. */
+    bool voc_index;         /**< Run the VOC index algorithm on every site and log the index. */
+    int sample_echo_interval; /**< Shortest time in seconds between two sweeps of a bus printed on the console. */
+    char voc_state_file[128]; /**< File the VOC index algorithm state is checkpointed to, empty for none. */
+    int voc_state_interval; /**< Seconds between two checkpoints of the VOC index algorithm state. */
+    int voc_state_max_age;  /**< Age in seconds up to which a checkpoint is restored whole. */
+    char calibration_file[128]; /**< Calibration of the sensors by serial number, empty for none. */
+    char sensor_map_file[128]; /**< Serial-to-port map of the previous run, empty for none. */
+    bool serial_columns;    /**< Name the CSV columns after the SGP40 serial numbers instead of the ports. */
+} VOCConfig;
+
+#define LOG_RECORD_MAX_SITES (MAX_BUSES * MAX_SITES)
+#define LOG_RECORD_CSV_MAX (64 + LOG_RECORD_MAX_SITES * 144)
+
+/**
+ * @struct ChannelStats
+ * @brief Streaming statistics of one channel of every site over the current window, one array per statistic.
  *
- * This structure is used during oversampling to store the running sum of sensor readings
- * and the number of valid samples collected for a given multiplexer port.
+ * The mean and the sum of squared deviations are updated with Welford's algorithm, which stays exact to
+ * float precision however long the window, where a plain sum of readings loses the low digits.
  */
 typedef struct {
-    float temp_sum;        /**< Sum of temperature readings (°C). */
-    float hum_sum;         /**< Sum of humidity readings (%RH). */
-    uint32_t voc_sum;      /**< Sum of raw VOC signal readings (ticks). */
-    int sample_count;      /**< Number of valid samples accumulated. */
+    float mean[LOG_RECORD_MAX_SITES];  /**< Mean of the samples. */
+    float m2[LOG_RECORD_MAX_SITES];    /**< Sum of the squared deviations from the mean. */
+    float min[LOG_RECORD_MAX_SITES];   /**< Lowest sample. */
+    float max[LOG_RECORD_MAX_SITES];   /**< Highest sample. */
+    float last[LOG_RECORD_MAX_SITES];  /**< Latest sample. */
+    float sorted[LOG_RECORD_MAX_SITES][WINDOW_FILTER_MAX_SAMPLES]; /**< Samples in ascending order, with a filter. */
+} ChannelStats;
+
+/**
+ * @struct SensorAccumulator
+ * @brief Readings of every site over one oversampling window, for averaging.
+ *
+ * Each statistic of each channel is an array indexed by site, so a sample touches a handful of
+ * floats at the same offset and the window is finalized by loops over all sites. Buses own disjoint
+ * ranges of sites starting at SensorBus.site_offset, so they accumulate concurrently without locks.
+ * With a window filter, the samples of each site are also kept sorted in a fixed buffer, for the
+ * median and the outliers of the window.
+ */
+typedef struct SensorAccumulator {
+    WindowFilter filter;                          /**< Average of the samples logged, see VOCConfig.window_filter. */
+    float filter_threshold;                       /**< See VOCConfig.window_filter_threshold. */
+    uint16_t sample_count[LOG_RECORD_MAX_SITES];  /**< Number of valid samples of each site. */
+    uint32_t voc_index_sum[LOG_RECORD_MAX_SITES]; /**< Sum of the VOC indices of each site. */
+    ChannelStats temperature;                     /**< Temperature readings (°C). */
+    ChannelStats humidity;                        /**< Humidity readings (%RH). */
+    ChannelStats voc;                             /**< Raw VOC signal readings (ticks). */
 } SensorAccumulator;
 
+/**
+ * @struct LogChannelStats
+ * @brief Spread of one channel of every site over a log window, next to its average in LogRecord.
+ */
+typedef struct {
+    float std[LOG_RECORD_MAX_SITES];   /**< Sample standard deviation. */
+    float min[LOG_RECORD_MAX_SITES];   /**< Lowest sample. */
+    float max[LOG_RECORD_MAX_SITES];   /**< Highest sample. */
+    float last[LOG_RECORD_MAX_SITES];  /**< Latest sample. */
+} LogChannelStats;
+
+/**
+ * @struct LogRecord
+ * @brief Averages of one log window for every site, in a fixed-size binary form.
+ *
+ * Records are filled by finalize_record() on the acquisition thread and turned into text later, so
+ * they can be queued to a writer thread without any allocation.
+ */
+typedef struct {
+    time_t timestamp;                                  /**< Wall-clock time of the window start. */
+    int site_count;                                    /**< Number of sites in the arrays below. */
+    uint64_t valid[LOG_RECORD_MAX_SITES / 64];         /**< Sites with a complete window (bit n = site n). */
+    float temperature[LOG_RECORD_MAX_SITES];           /**< Average temperature of each site (°C). */
+    float humidity[LOG_RECORD_MAX_SITES];              /**< Average humidity of each site (%RH). */
+    uint16_t voc[LOG_RECORD_MAX_SITES];                /**< Average raw VOC signal of each site (ticks). */
+    bool has_voc_index;                                /**< Whether voc_index is filled and logged. */
+    uint16_t voc_index[LOG_RECORD_MAX_SITES];          /**< Average VOC index of each site. */
+    bool has_stats;                                    /**< Whether the statistics below are filled and logged. */
+    LogChannelStats temperature_stats;                 /**< Spread of the temperature of each site (°C). */
+    LogChannelStats humidity_stats;                    /**< Spread of the humidity of each site (%RH). */
+    LogChannelStats voc_stats;                         /**< Spread of the raw VOC signal of each site (ticks). */
+    uint16_t outliers[LOG_RECORD_MAX_SITES];           /**< Samples of each site the window filter rejected. */
+    uint32_t outlier_count;                            /**< Sum of outliers over all sites. */
+} LogRecord;
+
+/**
+ * @enum SiteState
+ * @brief Step of a SiteMeasurement.
+ */
+typedef enum {
+    SITE_IDLE = 0,          /**< Not issued yet. */
+    SITE_SHT_CONVERTING,    /**< Waiting for the SHT3x conversion. */
+    SITE_SGP_CONVERTING,    /**< Waiting for the compensated SGP40 conversion. */
+    SITE_DONE,              /**< Result added to the accumulator of the site. */
+    SITE_FAILED,            /**< A transfer failed, the site is marked for a re-probe. */
+} SiteState;
+
+/**
+ * @struct SiteMeasurement
+ * @brief Measurement of one sensor site as a state machine: issue, wait until due, fetch.
+ */
+typedef struct {
+    SensorBus* sensors;          /**< Bus of the site. */
+    SensorAccumulator* accum;    /**< Accumulators of the site, at SensorBus.site_offset + site. */
+    int site;                    /**< Sensor site on the bus. */
+    SiteState state;             /**< Current step. */
+    uint8_t sht_mask;            /**< SHT3x measured, bit i for sht[i]. */
+    sht3x_measurement sht[SITE_SHT_COUNT]; /**< Measurement of the SHT3x at 0x44 and 0x45. */
+    uint16_t temperature_ticks;  /**< Average temperature of the SHT3x measured, calibrated once fetched. */
+    uint16_t humidity_ticks;     /**< Average humidity of the SHT3x measured, offsets included once fetched. */
+    sgp40_measurement sgp;       /**< SGP40 measurement. */
+} SiteMeasurement;
+
+#define EVENT_LOOP_MAX_SITES (MAX_BUSES * MAX_SITES)
+
+/**
+ * @struct EventLoop
+ * @brief Measurements in flight, on any number of buses, driven by a single thread.
+ *
+ * No call blocks during a conversion: event_loop_step() only talks to the sensors whose result is
+ * due and reports when the next one will be, so the thread sleeps once for all sensors in flight.
+ */
+typedef struct {
+    SiteMeasurement sites[EVENT_LOOP_MAX_SITES]; /**< Measurements issued since event_loop_init(). */
+    int site_count;                              /**< Number of entries in sites. */
+    int pending;                                 /**< Measurements neither done nor failed. */
+} EventLoop;
+
 /**
  *  mux_init_address() - This function select the  of the multiplexer to use in following functions
  *
@@ -74,28 +376,392 @@ int16_t mux_port_select(uint8_t mux_port);
  */
 int16_t mux_i2c_detect ();
 
+/**
+ * mux_dev_init() - Initializes a multiplexer context
+ *
+ * @param mux Multiplexer context
+ * @param bus Bus handle from sensirion_i2c_hal_get_bus(), NULL for the calling thread's selected bus
+ * @param mux_addr Multiplexer address in the format 0xXX
+ */
+void mux_dev_init(MuxDevice* mux, sensirion_i2c_hal_bus* bus, uint8_t mux_addr);
+
+/**
+ * mux_dev_port_select() - Same as mux_port_select(), on the given multiplexer
+ *
+ * @param mux Multiplexer context
+ * @param mux_port Port of the multiplexer to select (from 0 to 7)
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t mux_dev_port_select(MuxDevice* mux, uint8_t mux_port);
+
+/**
+ * mux_dev_channels_select() - This command enables any combination of the eight ports of the multiplexer
+ *
+ * All enabled channels are connected to the upstream bus at the same time, so a write to an address
+ * is received by every device at that address on the enabled channels. The selection is deferred to
+ * the next transaction on the bus, which then also reports a failed selection.
+ *
+ * @param mux Multiplexer context
+ * @param channel_mask Bit mask of the ports to enable (bit n enables port n)
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t mux_dev_channels_select(MuxDevice* mux, uint8_t channel_mask);
+
+/**
+ * mux_dev_probe() - This command checks whether a device acknowledges the given address on the
+ * currently selected ports
+ *
+ * @param mux Multiplexer context
+ * @param addr 7-bit I2C address to probe
+ *
+ * @return 0 if the address is acknowledged, 1 otherwise
+ */
+int16_t mux_dev_probe(MuxDevice* mux, uint8_t addr);
+
+/**
+ * topology_discover() - This command finds the multiplexers of a bus and disables all their channels
+ *
+ * The multiplexer addresses TCA_ADDR_70 to TCA_ADDR_77 are probed. If none answers, a single
+ * multiplexer at TCA_ADDR_70 is assumed so that its sites are still logged and re-probed.
+ *
+ * @param topology Topology to fill
+ * @param bus Bus handle from sensirion_i2c_hal_get_bus(), NULL for the calling thread's selected bus
+ *
+ * @return Number of multiplexers that answered
+ */
+int topology_discover(MuxTopology* topology, sensirion_i2c_hal_bus* bus);
+
+/**
+ * topology_site_count() - Returns the number of sensor sites of a topology
+ *
+ * @param topology Discovered topology
+ *
+ * @return MAX_PORTS sites per multiplexer
+ */
+int topology_site_count(const MuxTopology* topology);
+
+/**
+ * topology_select() - This command enables a set of channels of one multiplexer
+ *
+ * The previously active multiplexer is disabled first if it differs, and nothing is written if the
+ * channels are already enabled. Like mux_dev_channels_select(), the writes are deferred to the next
+ * transaction on the bus.
+ *
+ * @param topology Discovered topology
+ * @param mux_idx Index of the multiplexer in topology->muxes
+ * @param channel_mask Bit mask of the ports to enable (bit n enables port n)
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t topology_select(MuxTopology* topology, int mux_idx, uint8_t channel_mask);
+
+/**
+ * topology_select_site() - This command enables the single channel of a sensor site
+ *
+ * @param topology Discovered topology
+ * @param site Sensor site (from 0 to topology_site_count() - 1)
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t topology_select_site(MuxTopology* topology, int site);
+
+/**
+ * topology_invalidate() - This command forgets the state of the active multiplexer
+ *
+ * Call it after a failed transaction, since the deferred channel selection may not have been applied.
+ * The next topology_select() then rewrites it.
+ *
+ * @param topology Discovered topology
+ */
+void topology_invalidate(MuxTopology* topology);
+
+/**
+ * topology_find_broadcast_channels() - This command finds the ports of a multiplexer whose device at
+ * sht_addr can safely receive a broadcast SHT3x command
+ *
+ * Every port is selected alone and probed at sht_addr. A port joins the broadcast group only if the
+ * device there answers an SHT3x status register read with a valid CRC. A port where something else
+ * acknowledges sht_addr would clash with a broadcast command, so it is reported in conflict_mask and
+ * left to per-port triggering.
+ *
+ * @param topology Discovered topology
+ * @param mux_idx Index of the multiplexer in topology->muxes
+ * @param sht_addr SHT3x address the broadcast command is sent to
+ * @param broadcast_mask Bit mask of the ports that can share a broadcast trigger
+ * @param conflict_mask Bit mask of the ports with a clashing device at sht_addr, may be NULL
+ *
+ * @return 0 on success, an error code if the multiplexer could not be switched
+ */
+int16_t topology_find_broadcast_channels(MuxTopology* topology, int mux_idx, uint8_t sht_addr,
+                                         uint8_t* broadcast_mask, uint8_t* conflict_mask);
+
+/**
+ * presence_discover() - This command probes every sensor site of a topology for the supported sensors
+ *
+ * Only the SHT3x (0x44, 0x45) and SGP40 (0x59) addresses are probed, so discovering a site costs at
+ * most two mux writes and three address probes instead of a scan of the whole address range, plus
+ * the serial number read of a new SGP40.
+ *
+ * @param presence Presence cache to fill
+ * @param topology Multiplexers in front of the sites
+ * @param reprobe_interval Sweeps between two re-probes of every site, 0 disables them
+ */
+void presence_discover(PortPresence* presence, MuxTopology* topology, int reprobe_interval);
+
+/**
+ * presence_refresh() - This command re-probes the sites whose cached presence may be outdated
+ *
+ * Sites marked with presence_mark_failed() are re-probed before the next sweep, and every site is
+ * re-probed once reprobe_interval sweeps have elapsed. Otherwise no bus traffic is generated. Call
+ * it once at the start of each sweep.
+ *
+ * @param presence Presence cache to update
+ * @param topology Multiplexers in front of the sites
+ */
+void presence_refresh(PortPresence* presence, MuxTopology* topology);
+
+/**
+ * presence_mark_failed() - This command schedules a re-probe of a site after a failed measurement
+ *
+ * @param presence Presence cache to update
+ * @param site Sensor site
+ */
+void presence_mark_failed(PortPresence* presence, int site);
+
+/**
+ * presence_port_ready() - This command tells whether a site holds both an SHT3x and an SGP40
+ *
+ * @param presence Presence cache
+ * @param site Sensor site
+ *
+ * @return 1 if the site can be measured, 0 otherwise
+ */
+int presence_port_ready(const PortPresence* presence, int site);
+
+/**
+ * presence_sht_addr() - This command returns the address of the SHT3x found on a site
+ *
+ * @param presence Presence cache
+ * @param site Sensor site
+ *
+ * @return SHT3x address, 0x44 being preferred when both addresses are populated
+ */
+uint8_t presence_sht_addr(const PortPresence* presence, int site);
+
+/**
+ * health_init() - This command closes the circuit breakers of all sites
+ *
+ * @param health Breakers to initialize
+ * @param threshold Consecutive failures opening a site, 0 disables the breakers
+ * @param max_backoff Longest backoff in sweeps
+ */
+void health_init(PortHealth* health, int threshold, int max_backoff);
+
+/**
+ * health_begin_sweep() - This command starts a sweep and lets the open sites whose backoff expired through
+ *
+ * The sites moving to BREAKER_HALF_OPEN are marked for a presence re-probe, so their trial starts
+ * from a fresh presence cache. Call it before presence_refresh().
+ *
+ * @param health Breakers of the bus
+ * @param presence Presence cache of the same bus
+ *
+ * @return Mask of the sites that moved to BREAKER_HALF_OPEN
+ */
+uint64_t health_begin_sweep(PortHealth* health, PortPresence* presence);
+
+/**
+ * health_allows() - This command tells whether the breaker of a site lets a measurement through
+ *
+ * @param health Breakers of the bus
+ * @param site Sensor site
+ *
+ * @return 1 if the site may be measured, 0 if its breaker is open
+ */
+int health_allows(const PortHealth* health, int site);
+
+/**
+ * health_record_success() - This command records a successful measurement of a site
+ *
+ * @param health Breakers of the bus
+ * @param site Sensor site
+ *
+ * @return 1 if the breaker of the site changed state, 0 otherwise
+ */
+int health_record_success(PortHealth* health, int site);
+
+/**
+ * health_record_failure() - This command records a failed measurement of a site
+ *
+ * A failed trial opens the site again with twice the previous backoff.
+ *
+ * @param health Breakers of the bus
+ * @param site Sensor site
+ *
+ * @return 1 if the breaker of the site changed state, 0 otherwise
+ */
+int health_record_failure(PortHealth* health, int site);
+
+/**
+ * health_open_count() - This command counts the sites whose breaker is open
+ *
+ * @param health Breakers of the bus
+ *
+ * @return Number of sites in BREAKER_OPEN
+ */
+int health_open_count(const PortHealth* health);
+
+/**
+ * sensor_bus_init() - Initializes the contexts of a bus and discovers its multiplexers and sensors
+ *
+ * @param sensors Bus context to initialize
+ * @param bus Bus handle from sensirion_i2c_hal_get_bus(), NULL for the calling thread's selected bus
+ * @param reprobe_interval Sweeps between two re-probes of every site, 0 disables them
+ * @param breaker_threshold Consecutive failures skipping a site, 0 disables the circuit breakers
+ * @param breaker_max_backoff Longest wait in sweeps before retrying a skipped site
+ */
+void sensor_bus_init(SensorBus* sensors, sensirion_i2c_hal_bus* bus, int reprobe_interval, int breaker_threshold,
+                     int breaker_max_backoff);
+
+/**
+ * sensor_bus_set_echo() - Limits how often the samples of a bus are printed on the console
+ *
+ * A sweep is echoed at most once every interval_s seconds, with one line per sample. Every sweep is
+ * echoed after sensor_bus_init().
+ *
+ * @param sensors Initialized bus context
+ * @param interval_s Shortest time in seconds between two echoed sweeps, 0 for every sweep, negative for none
+ */
+void sensor_bus_set_echo(SensorBus* sensors, int interval_s);
+
+/**
+ * sensor_bus_set_snapshot() - Publishes every sample of a bus to a shared memory snapshot
+ *
+ * The sites of the bus are published from SensorBus.site_offset on.
+ *
+ * @param sensors Initialized bus context
+ * @param snapshot Segment from snapshot_create(), NULL to stop publishing
+ */
+void sensor_bus_set_snapshot(SensorBus* sensors, struct SnapshotSegment* snapshot);
+
+/**
+ * sensor_bus_set_gas_index() - Feeds every VOC sample of a bus to a VOC index engine
+ *
+ * The samples are only stored, at SensorBus.site_offset + site; the owner of the bus runs gas_index_process()
+ * on its sites after each sweep.
+ *
+ * @param sensors Initialized bus context
+ * @param engine Engine from gas_index_init(), NULL to stop feeding it
+ */
+void sensor_bus_set_gas_index(SensorBus* sensors, struct GasIndexEngine* engine);
+
+/**
+ * sensor_bus_set_calibration() - Resolves the calibration of the sensors of every site of a bus
+ *
+ * Each site keeps the offsets of its sensors in ticks, so the sweeps apply them without a lookup. Sites
+ * whose sensors are replaced later resolve theirs again when the new sensors are found.
+ *
+ * @param sensors Initialized bus context
+ * @param calibration Calibration table, NULL for none. Must outlive its use by the bus
+ * @param humidity_offset Offset in %RH applied to the humidity of every site, on top of its calibration
+ */
+void sensor_bus_set_calibration(SensorBus* sensors, const struct CalibrationTable* calibration, float humidity_offset);
+
+/**
+ * sensor_bus_site_name() - Formats the name of a sensor site as "<mux address>_<port>", e.g. "70_3"
+ *
+ * @param sensors Initialized bus context
+ * @param site Sensor site
+ * @param buffer String buffer where to save the name
+ * @param size Size of buffer
+ */
+void sensor_bus_site_name(const SensorBus* sensors, int site, char* buffer, size_t size);
+
 /**
  * get_timestamp() - This command saves the current time in a string buffer
  *
+ * The time comes from sensirion_i2c_hal_get_realtime_usec(), so it follows the virtual clock when enabled.
+ *
  * @param buffer String buffer where to save the time stamp
  *
  * @param size Size of buffer
  */
 void get_timestamp(char* buffer, size_t size);
 
+/**
+ * format_timestamp() - This command saves the given time in a string buffer, in the format of get_timestamp()
+ *
+ * @param time Time to format
+ * @param buffer String buffer where to save the time stamp
+ * @param size Size of buffer
+ */
+void format_timestamp(time_t time, char* buffer, size_t size);
+
 /**
  * read_config() - Reads configuration values from a file.
  *
- * This function reads two parameters from a configuration file:
- *  - The oversampling count, which determines how many individual measurements are averaged.
- *  - The humidity offset, which is used to correct sensor readings.
+ * This function reads the following parameters from a configuration file:
+ *  - oversample_count: how many individual measurements are averaged.
+ *  - humidity_offset: offset in %RH used to correct sensor readings.
+ *  - sweep_mode: "sequential", "pipelined" or "broadcast", see SweepMode.
+ *  - reprobe_interval: sweeps between two presence re-probes of every port.
+ *  - breaker_threshold: consecutive failures after which a port is skipped, 0 to never skip.
+ *  - breaker_max_backoff: longest wait in sweeps before a skipped port is retried.
+ *  - i2c_buses: comma separated list of i2c device paths, e.g. "/dev/i2c-1,/dev/i2c-3". Paths
+ *    starting with "sim:" are simulated, e.g. "sim:muxes=8:khz=400", see sensirion_i2c_hal_sim.h.
+ *  - single_thread: 1 to sweep all buses from one thread, 0 for one thread per bus.
+ *  - virtual_clock: 1 to run on a virtual clock, see sensirion_i2c_hal_use_virtual_clock(). Only
+ *    meaningful with simulated buses, where hours of acquisition then take seconds.
+ *  - run_duration: seconds of acquisition before exiting, 0 to run forever.
+ *  - log_format: "csv", "binary" or "compressed", see VOC_binlog.h and VOC_tslog.h for the binary
+ *    and compressed formats, which VOC_binlog_to_csv converts back to CSV.
+ *  - log_stats: 1 to add the standard deviation, minimum, maximum and last sample of every channel of
+ *    each site to the CSV log, see finalize_record(). The binary and compressed formats only hold
+ *    the averages.
+ *  - window_filter: "none" to log the mean of the samples of each window, "median" for their median,
+ *    "hampel" for the mean of the samples within window_filter_threshold of the median, see
+ *    window_filter_apply(). Outliers are counted in every window; a filter needs oversample_count of
+ *    at most WINDOW_FILTER_MAX_SAMPLES.
+ *  - window_filter_threshold: scaled median absolute deviations from the median beyond which a
+ *    sample is an outlier, at least 1.
+ *  - log_block_records: records per block of a compressed log, the most a crash may lose. Each block
+ *    is a single row for log_sync_rows.
+ *  - log_queue: records queued to the log writer thread, 0 to write rows from the acquisition thread.
+ *  - log_overflow: "drop" to drop rows when the log queue is full, "block" to wait for the writer.
+ *  - log_sync_rows, log_sync_interval: the log file is synced every log_sync_rows rows or
+ *    log_sync_interval seconds, whichever comes first; both 0 to write every row unsynced.
+ *  - snapshot_name: POSIX shared memory name where the latest samples and window averages are
+ *    published for other processes, see VOC_snapshot.h, "none" to publish nothing.
+ *  - sample_echo: 1 to print every sample on the console, 0 for none.
+ *  - sample_echo_interval: seconds between two sweeps of a bus printed when sample_echo is set, 0
+ *    for every sweep. Formatting and printing a line per sample shows in the sweep time on large rigs.
+ *  - voc_index: 1 to run the Sensirion VOC index algorithm on every site and log the average index
+ *    next to the raw signal, 0 to log the raw signal only. See VOC_gas_index.h.
+ *  - voc_state_file: file the VOC index algorithm state of every sensor is checkpointed to and
+ *    restored from at startup, keyed by SGP40 serial number, "none" to always start from scratch. See
+ *    VOC_index_store.h.
+ *  - voc_state_interval: seconds between two checkpoints, one is also written at exit.
+ *  - voc_state_max_age: age in seconds up to which a checkpoint is restored whole, so indices resume
+ *    from the first sample; an older one only restores the learned baselines.
+ *  - calibration_file: temperature and humidity offsets of each sensor by serial number, see
+ *    calibration_load(), "none" for none. Added to humidity_offset.
+ *  - sensor_map_file: file keeping the serial-to-port map of the previous run, so that sensors moved
+ *    to other ports are reported at startup, see sensor_map_update(), "none" to keep no map.
+ *  - log_columns: "serial" to name the CSV columns of each site after the serial number of its SGP40,
+ *    so they follow the sensor across re-cabling, "port" to name them after the port.
+ *  - i2c_faults: faults injected on every bus for testing, e.g. "nack=1:crc=0.5:blackhole=0x59",
+ *    see sensirion_i2c_hal_fault.h.
  *
- * @param oversample_count Pointer to an integer where the read oversampling count will be stored.
- * @param humidity_offset Pointer to a float where the read humidity offset (in %) will be stored.
+ * Keys missing from the file leave the corresponding field untouched, so the caller
+ * should fill config with defaults first.
+ *
+ * @param config Pointer to the configuration to update.
  *
  * @return 0 on success, -1 if the configuration file is not found or cannot be read.
  */
-int read_config(int* oversample_count, float* humidity_offset);
+int read_config(VOCConfig* config);
 
 
 /**
@@ -124,41 +790,174 @@ int16_t measure_oversampled(int oversample_count, float sht31_humidity_offset, f
  */
 int16_t single_measure(float* humidity, float* temperature, uint16_t* raw_voc, float humidity_offset);
 
+/**
+ * single_measure_dev() - Same as single_measure(), with the given sensor contexts.
+ *
+ * @param sht SHT3x context.
+ * @param sgp SGP40 context.
+ * @param humidity Pointer to float where the corrected humidity (%RH) will be stored.
+ * @param temperature Pointer to float where the measured temperature (°C) will be stored.
+ * @param raw_voc Pointer to uint16_t where the measured raw VOC signal (ticks) will be stored.
+ * @param humidity_offset Offset in %RH applied to humidity for VOC compensation.
+ *
+ * @return 0 on success, error code if measurement fails.
+ */
+int16_t single_measure_dev(sht3x_dev* sht, sgp40_dev* sgp, float* humidity, float* temperature, uint16_t* raw_voc,
+                           float humidity_offset);
+
 
 /**
  * sample_all_ports() - Performs one measurement per active sensor port and stores results in accumulators.
  *
- * This function loops over all multiplexer ports, selects each sensor, performs a single measurement,
- * and accumulates the results (temperature, humidity, VOC) for later averaging.
+ * This function loops over the sites that the presence cache reports as populated, selects each sensor,
+ * performs a single measurement, and accumulates the results (temperature, humidity, VOC) for later
+ * averaging. Sites whose measurement fails are marked for a re-probe and counted by their circuit
+ * breaker, sites with an open breaker are skipped.
+ *
+ * @param accum Accumulators the measurements of each site are added to, at sensors->site_offset + site.
+ * @param sensors Bus to sweep, its presence cache is refreshed at the start of the sweep. The calibration
+ * of each site from sensor_bus_set_calibration() is applied to its readings.
+ */
+void sample_all_ports(SensorAccumulator* accum, SensorBus* sensors);
+
+/**
+ * sample_all_ports_pipelined() - Same as sample_all_ports(), but overlaps the conversion times of all ports.
+ *
+ * The SHT3x conversion is started on every populated site, then an EventLoop fetches each result
+ * as soon as it is due, starts the compensated SGP40 conversion and later fetches the raw VOC
+ * signal. A full sweep takes roughly one SHT3x plus one SGP40 conversion regardless of the number
+ * of sites.
  *
- * @param accum Array of SensorAccumulator structures used to collect and sum measurements for each port.
- * @param humidity_offset Offset in %RH applied to humidity readings.
+ * @param accum Accumulators the measurements of each site are added to, at sensors->site_offset + site.
+ * @param sensors Bus to sweep, its presence cache is refreshed at the start of the sweep. The calibration
+ * of each site from sensor_bus_set_calibration() is applied to its readings.
  */
-void sample_all_ports(SensorAccumulator accum[], float humidity_offset);
+void sample_all_ports_pipelined(SensorAccumulator* accum, SensorBus* sensors);
+
+/**
+ * sample_all_ports_broadcast() - Same as sample_all_ports_pipelined(), but starts the SHT3x conversions
+ * behind each multiplexer with a single command.
+ *
+ * Each multiplexer enables every port of its sensors->broadcast_mask entry at once and one single shot
+ * trigger is sent, which all sensors acknowledge together. Other sites (or all sites of a multiplexer,
+ * if its broadcast trigger fails) are triggered one by one as in the pipelined sweep. Results are read
+ * per site.
+ *
+ * @param accum Accumulators the measurements of each site are added to, at sensors->site_offset + site.
+ * @param sensors Bus to sweep, its presence cache is refreshed at the start of the sweep. The calibration
+ * of each site from sensor_bus_set_calibration() is applied to its readings.
+ */
+void sample_all_ports_broadcast(SensorAccumulator* accum, SensorBus* sensors);
+
+/**
+ * event_loop_init() - Empties an event loop.
+ *
+ * @param loop Event loop to initialize.
+ */
+void event_loop_init(EventLoop* loop);
+
+/**
+ * event_loop_issue_bus() - Starts a measurement on every populated site of a bus.
+ *
+ * The presence cache of the bus is refreshed first. With broadcast set, the sites of each
+ * multiplexer's broadcast group share one SHT3x trigger.
+ *
+ * @param loop Event loop the measurements are added to.
+ * @param sensors Bus to measure.
+ * @param accum Accumulators of all sites, those of the bus start at sensors->site_offset.
+ * @param broadcast Use the broadcast groups of the bus.
+ */
+void event_loop_issue_bus(EventLoop* loop, SensorBus* sensors, SensorAccumulator* accum, bool broadcast);
+
+/**
+ * event_loop_step() - Advances every measurement whose conversion is due, without waiting.
+ *
+ * @param loop Event loop.
+ * @param next_wake_usec Set to the sensirion_i2c_hal_get_time_usec() time at which the next
+ * measurement becomes due, may be NULL.
+ *
+ * @return Number of measurements still in flight.
+ */
+int event_loop_step(EventLoop* loop, uint64_t* next_wake_usec);
+
+/**
+ * event_loop_run() - Steps an event loop until all its measurements are done or failed,
+ * sleeping until the next due measurement in between.
+ *
+ * @param loop Event loop.
+ */
+void event_loop_run(EventLoop* loop);
+
+/**
+ * sweep_mode_name() - Returns the configuration name of a sweep mode.
+ *
+ * @param mode Sweep mode
+ *
+ * @return Name as accepted by read_config()
+ */
+const char* sweep_mode_name(SweepMode mode);
 
 
 /**
  * finalize_averages() - Computes final averages and writes them to the logfile.
  *
  * This function calculates the average temperature, humidity, and VOC values for each port
- * using the accumulated sums and writes a formatted CSV line to the logfile.
+ * using the accumulated statistics and writes a formatted CSV line to the logfile.
  *
  * @param logfile File pointer to the CSV log file.
- * @param accum Array of SensorAccumulator structures containing summed data.
+ * @param accum Accumulators of the window.
+ * @param port_count Number of sites in accum.
  * @param oversample_count Number of measurements accumulated (used for averaging).
  * @param timestamp Current timestamp string to prefix the CSV line.
+ * @param stats Whether to add the standard deviation, minimum, maximum and last sample of every channel
+ * after the averages of each site, see finalize_record().
+ *
+ * @return Number of samples rejected by the window filter of accum, over all sites and channels.
  */
-void finalize_averages(FILE* logfile, SensorAccumulator accum[], int oversample_count, const char* timestamp);
+uint32_t finalize_averages(FILE* logfile, const SensorAccumulator* accum, int port_count, int oversample_count,
+                           const char* timestamp, bool stats);
 
+/**
+ * finalize_record() - Computes the averages of a log window into a record.
+ *
+ * Sites without oversample_count samples are left out of record->valid and logged as NaN. With a
+ * window filter in accum, the temperature, humidity and VOC signal of each site are the median or the
+ * Hampel-filtered mean of its samples, and the samples beyond the threshold are counted in
+ * record->outliers whichever average is logged. The VOC index stays the mean of the window.
+ *
+ * @param record Record to fill.
+ * @param accum Accumulators of the window.
+ * @param port_count Number of sites in accum, at most LOG_RECORD_MAX_SITES.
+ * @param oversample_count Number of measurements accumulated (used for averaging).
+ * @param timestamp Wall-clock time of the window start.
+ * @param voc_index Whether accum holds VOC indices to average into the record.
+ * @param stats Whether to fill the statistics of the record. The CSV format then logs the standard
+ * deviation, minimum, maximum and last sample of the temperature, humidity and VOC signal of each site
+ * after its averages, as Tsd, Tmin, Tmax, Tlast, then H and VOC likewise.
+ */
+void finalize_record(LogRecord* record, const SensorAccumulator* accum, int port_count, int oversample_count,
+                     time_t timestamp, bool voc_index, bool stats);
 
 /**
- * reset_accumulators() - Resets the measurement accumulators for all ports.
+ * format_record_csv() - Formats a record as one CSV line, in the format of finalize_averages().
  *
- * This function sets the sum and count fields of each SensorAccumulator to zero,
- * preparing them for a new round of oversampling.
+ * @param record Record to format.
+ * @param buffer String buffer receiving the line, including its line feed.
+ * @param size Size of buffer, LOG_RECORD_CSV_MAX is always enough.
  *
- * @param accum Array of SensorAccumulator structures to reset.
+ * @return Length of the line.
  */
-void reset_accumulators(SensorAccumulator accum[]);
+size_t format_record_csv(const LogRecord* record, char* buffer, size_t size);
 
+/**
+ * reset_accumulators() - Resets the measurement accumulators for all ports.
+ *
+ * This function sets the statistics and count of each site to zero, preparing them for a new round
+ * of oversampling.
+ *
+ * @param accum Accumulators to reset.
+ * @param port_count Number of sites in accum.
+ */
+void reset_accumulators(SensorAccumulator* accum, int port_count);
 
+#endif //VOC_ESSENTIALS_H
@@ -0,0 +1,280 @@
+#include "VOC_gas_index.h"
+#include <math.h>
+
+// Parameters of the VOC flavour of the Sensirion gas index algorithm
+#define GAS_INDEX_INITIAL_BLACKOUT 45.f
+#define GAS_INDEX_GAIN 230.f
+#define GAS_INDEX_SRAW_STD_INITIAL 50.f
+#define GAS_INDEX_SRAW_STD_BONUS 220.f
+#define GAS_INDEX_TAU_MEAN_HOURS 12.f
+#define GAS_INDEX_TAU_VARIANCE_HOURS 12.f
+#define GAS_INDEX_TAU_INITIAL_MEAN 20.f
+#define GAS_INDEX_INIT_DURATION_MEAN (3600.f * 0.75f)
+#define GAS_INDEX_INIT_TRANSITION_MEAN 0.01f
+#define GAS_INDEX_TAU_INITIAL_VARIANCE 2500.f
+#define GAS_INDEX_INIT_DURATION_VARIANCE (3600.f * 1.45f)
+#define GAS_INDEX_INIT_TRANSITION_VARIANCE 0.01f
+#define GAS_INDEX_GATING_THRESHOLD 340.f
+#define GAS_INDEX_GATING_THRESHOLD_INITIAL 510.f
+#define GAS_INDEX_GATING_THRESHOLD_TRANSITION 0.09f
+#define GAS_INDEX_GATING_MAX_DURATION_MINUTES (60.f * 3.f)
+#define GAS_INDEX_GATING_MAX_RATIO 0.3f
+#define GAS_INDEX_SIGMOID_L 500.f
+#define GAS_INDEX_SIGMOID_K -0.0065f
+#define GAS_INDEX_SIGMOID_X0 213.f
+#define GAS_INDEX_OFFSET 100.f
+#define GAS_INDEX_LP_TAU_FAST 20.f
+#define GAS_INDEX_LP_TAU_SLOW 500.f
+#define GAS_INDEX_LP_ALPHA -0.2f
+#define GAS_INDEX_SRAW_MINIMUM 20000.f
+#define GAS_INDEX_GAMMA_SCALING 64.f
+#define GAS_INDEX_ADDITIONAL_GAMMA_MEAN_SCALING 8.f
+#define GAS_INDEX_FIX16_MAX 32767.f
+#define GAS_INDEX_PERSISTENCE_UPTIME_GAMMA (3.f * 3600.f)
+
+// Logistic function of the estimator, from 1 well below x0 to 0 well above it
+static inline float gas_index_sigmoid(float sample, float x0, float k) {
+    float x = k * (sample - x0);
+    float e = expf(fminf(fmaxf(x, -50.f), 50.f));
+    return x < -50.f ? 1.f : (x > 50.f ? 0.f : 1.f / (1.f + e));
+}
+
+// Maps the output of the MOX model to the index range, 100 being the average of the site
+static inline float gas_index_sigmoid_scaled(float sample) {
+    float x = GAS_INDEX_SIGMOID_K * (sample - GAS_INDEX_SIGMOID_X0);
+    float e = expf(fminf(fmaxf(x, -50.f), 50.f));
+    float shift = (GAS_INDEX_SIGMOID_L - 5.f * GAS_INDEX_OFFSET) / 4.f;
+    float above = (GAS_INDEX_SIGMOID_L + shift) / (1.f + e) - shift;
+    float below = GAS_INDEX_SIGMOID_L / (1.f + e);
+    return x < -50.f ? GAS_INDEX_SIGMOID_L : (x > 50.f ? 0.f : (sample >= 0.f ? above : below));
+}
+
+void gas_index_init(GasIndexEngine* engine, int site_count, float sampling_interval) {
+    float dt = sampling_interval;
+
+    memset(engine, 0, sizeof(*engine));
+    engine->site_count = site_count < GAS_INDEX_MAX_SITES ? site_count : GAS_INDEX_MAX_SITES;
+    engine->sampling_interval = dt;
+    engine->gamma_mean = (GAS_INDEX_ADDITIONAL_GAMMA_MEAN_SCALING * GAS_INDEX_GAMMA_SCALING * (dt / 3600.f)) /
+                         (GAS_INDEX_TAU_MEAN_HOURS + dt / 3600.f);
+    engine->gamma_variance = (GAS_INDEX_GAMMA_SCALING * (dt / 3600.f)) / (GAS_INDEX_TAU_VARIANCE_HOURS + dt / 3600.f);
+    engine->gamma_initial_mean = (GAS_INDEX_ADDITIONAL_GAMMA_MEAN_SCALING * GAS_INDEX_GAMMA_SCALING * dt) /
+                                 (GAS_INDEX_TAU_INITIAL_MEAN + dt);
+    engine->gamma_initial_variance = (GAS_INDEX_GAMMA_SCALING * dt) / (GAS_INDEX_TAU_INITIAL_VARIANCE + dt);
+    engine->lowpass_a1 = dt / (GAS_INDEX_LP_TAU_FAST + dt);
+    engine->lowpass_a2 = dt / (GAS_INDEX_LP_TAU_SLOW + dt);
+    for (int site = 0; site < GAS_INDEX_MAX_SITES; site++) {
+        engine->std[site] = GAS_INDEX_SRAW_STD_INITIAL;
+    }
+}
+
+void gas_index_set_sample(GasIndexEngine* engine, int site, uint16_t sraw) {
+    engine->sraw_input[site] = sraw;
+    engine->fresh[site] = 1;
+}
+
+// Picks a where mask is all ones and b where it is zero. GCC turns a run of ternaries on one condition
+// back into a branch, which stops the vectorizer, while this bitwise form always stays a blend.
+static inline float gas_index_select(int32_t mask, float a, float b) {
+    int32_t bits_a, bits_b;
+    memcpy(&bits_a, &a, sizeof(bits_a));
+    memcpy(&bits_b, &b, sizeof(bits_b));
+    bits_a = (bits_a & mask) | (bits_b & ~mask);
+    memcpy(&a, &bits_a, sizeof(a));
+    return a;
+}
+
+// Every stage below is one loop over the range, with the per-site conditions of the reference
+// implementation turned into masks, so that each loop vectorizes across sites
+void gas_index_process(GasIndexEngine* engine, SensorAccumulator* accum, int first, int count) {
+    GasIndexEngine* e = engine;
+    const float dt = e->sampling_interval;
+    const float a1 = e->lowpass_a1;
+    const float a2 = e->lowpass_a2;
+    const float gamma_mean_trained = e->gamma_mean;
+    const float gamma_mean_initial = e->gamma_initial_mean;
+    const float gamma_variance_trained = e->gamma_variance;
+    const float gamma_variance_initial = e->gamma_initial_variance;
+    int32_t run[GAS_INDEX_MAX_SITES];
+    int32_t learn[GAS_INDEX_MAX_SITES];
+    float gamma_mean[GAS_INDEX_MAX_SITES];
+    float gamma_variance[GAS_INDEX_MAX_SITES];
+
+    if (first + count > e->site_count) count = e->site_count - first;
+    float* restrict uptime = e->uptime + first;
+    float* restrict sraw = e->sraw + first;
+    float* restrict gas_index = e->gas_index + first;
+    float* restrict mean = e->mean + first;
+    float* restrict offset = e->sraw_offset + first;
+    float* restrict std = e->std + first;
+    const uint16_t* restrict input = e->sraw_input + first;
+    const uint8_t* restrict fresh = e->fresh + first;
+
+    // The first samples of a site only count down the initial blackout
+    for (int i = 0; i < count; i++) {
+        int32_t is_fresh = -(int32_t)(fresh[i] != 0);
+        int32_t blackout = -(int32_t)(uptime[i] <= GAS_INDEX_INITIAL_BLACKOUT);
+        uptime[i] = gas_index_select(is_fresh & blackout, uptime[i] + dt, uptime[i]);
+        run[i] = is_fresh & ~blackout;
+    }
+
+    // Raw signal above its minimum, an out of range sample keeps the previous one
+    for (int i = 0; i < count; i++) {
+        float value = input[i];
+        float clamped = fminf(fmaxf(value, GAS_INDEX_SRAW_MINIMUM + 1.f), GAS_INDEX_SRAW_MINIMUM + 32767.f);
+        int32_t valid = run[i] & -(int32_t)(value > 0.f) & -(int32_t)(value < 65000.f);
+        sraw[i] = gas_index_select(valid, clamped - GAS_INDEX_SRAW_MINIMUM, sraw[i]);
+    }
+
+    // MOX model, sigmoid and adaptive lowpass
+    float* restrict x1 = e->x1 + first;
+    float* restrict x2 = e->x2 + first;
+    float* restrict x3 = e->x3 + first;
+    float* restrict lowpass_ready = e->lowpass_ready + first;
+    for (int i = 0; i < count; i++) {
+        float mox = (sraw[i] - (mean[i] + offset[i])) / -(std[i] + GAS_INDEX_SRAW_STD_BONUS) * GAS_INDEX_GAIN;
+        float sample = gas_index_sigmoid_scaled(mox);
+
+        int32_t started = -(int32_t)(lowpass_ready[i] > 0.f);
+        float f1 = gas_index_select(started, x1[i], sample);
+        float f2 = gas_index_select(started, x2[i], sample);
+        float f3 = gas_index_select(started, x3[i], sample);
+        f1 = (1.f - a1) * f1 + a1 * sample;
+        f2 = (1.f - a2) * f2 + a2 * sample;
+        float tau = (GAS_INDEX_LP_TAU_SLOW - GAS_INDEX_LP_TAU_FAST) * expf(GAS_INDEX_LP_ALPHA * fabsf(f1 - f2)) +
+                    GAS_INDEX_LP_TAU_FAST;
+        float a3 = dt / (dt + tau);
+        f3 = (1.f - a3) * f3 + a3 * sample;
+
+        x1[i] = gas_index_select(run[i], f1, x1[i]);
+        x2[i] = gas_index_select(run[i], f2, x2[i]);
+        x3[i] = gas_index_select(run[i], f3, x3[i]);
+        lowpass_ready[i] = gas_index_select(run[i], 1.f, lowpass_ready[i]);
+        gas_index[i] = gas_index_select(run[i], fmaxf(f3, 0.5f), gas_index[i]);
+    }
+
+    // Learning rates of the estimator, fast at start and gated while the index is high
+    float* restrict estimator_ready = e->estimator_ready + first;
+    float* restrict uptime_gamma = e->uptime_gamma + first;
+    float* restrict uptime_gating = e->uptime_gating + first;
+    float* restrict gating_duration = e->gating_duration + first;
+    const float uptime_limit = GAS_INDEX_FIX16_MAX - dt;
+    const float threshold_span = GAS_INDEX_GATING_THRESHOLD_INITIAL - GAS_INDEX_GATING_THRESHOLD;
+    for (int i = 0; i < count; i++) {
+        learn[i] = run[i] & -(int32_t)(sraw[i] > 0.f) & -(int32_t)(estimator_ready[i] > 0.f);
+
+        float ug = uptime_gamma[i] < uptime_limit ? uptime_gamma[i] + dt : uptime_gamma[i];
+        float ut = uptime_gating[i] < uptime_limit ? uptime_gating[i] + dt : uptime_gating[i];
+
+        float initial_mean = gas_index_sigmoid(ug, GAS_INDEX_INIT_DURATION_MEAN, GAS_INDEX_INIT_TRANSITION_MEAN);
+        float threshold_mean = GAS_INDEX_GATING_THRESHOLD +
+                               threshold_span * gas_index_sigmoid(ut, GAS_INDEX_INIT_DURATION_MEAN,
+                                                                  GAS_INDEX_INIT_TRANSITION_MEAN);
+        float gating_mean = gas_index_sigmoid(gas_index[i], threshold_mean, GAS_INDEX_GATING_THRESHOLD_TRANSITION);
+        gamma_mean[i] = gating_mean * (gamma_mean_trained + initial_mean * (gamma_mean_initial - gamma_mean_trained));
+
+        float initial_variance = gas_index_sigmoid(ug, GAS_INDEX_INIT_DURATION_VARIANCE,
+                                                   GAS_INDEX_INIT_TRANSITION_VARIANCE);
+        float threshold_variance = GAS_INDEX_GATING_THRESHOLD +
+                                   threshold_span * gas_index_sigmoid(ut, GAS_INDEX_INIT_DURATION_VARIANCE,
+                                                                      GAS_INDEX_INIT_TRANSITION_VARIANCE);
+        float gating_variance = gas_index_sigmoid(gas_index[i], threshold_variance,
+                                                  GAS_INDEX_GATING_THRESHOLD_TRANSITION);
+        gamma_variance[i] = gating_variance * (gamma_variance_trained +
+                                               initial_variance * (gamma_variance_initial - gamma_variance_trained));
+
+        float gd = gating_duration[i] + (dt / 60.f) * ((1.f - gating_mean) * (1.f + GAS_INDEX_GATING_MAX_RATIO) -
+                                                       GAS_INDEX_GATING_MAX_RATIO);
+        gd = fmaxf(gd, 0.f);
+        ut = gd > GAS_INDEX_GATING_MAX_DURATION_MINUTES ? 0.f : ut;
+
+        uptime_gamma[i] = gas_index_select(learn[i], ug, uptime_gamma[i]);
+        uptime_gating[i] = gas_index_select(learn[i], ut, uptime_gating[i]);
+        gating_duration[i] = gas_index_select(learn[i], gd, gating_duration[i]);
+    }
+
+    // Mean and variance of the raw signal, the baseline of the MOX model. The first sample of a site
+    // only sets the offset.
+    for (int i = 0; i < count; i++) {
+        int32_t starting = run[i] & -(int32_t)(sraw[i] > 0.f) & -(int32_t)(estimator_ready[i] == 0.f);
+        int32_t rebase = -(int32_t)(fabsf(mean[i]) >= 100.f);
+        float base = gas_index_select(rebase, offset[i] + mean[i], offset[i]);
+        float m = gas_index_select(rebase, 0.f, mean[i]);
+
+        float delta = ((sraw[i] - base) - m) / GAS_INDEX_GAMMA_SCALING;
+        float c = std[i] + fabsf(delta);
+        float scaling = c > 1440.f ? (c / 1440.f) * (c / 1440.f) : 1.f;
+        float s = sqrtf(scaling * (GAS_INDEX_GAMMA_SCALING - gamma_variance[i])) *
+                  sqrtf(std[i] * (std[i] / (GAS_INDEX_GAMMA_SCALING * scaling)) +
+                        ((gamma_variance[i] * delta) / scaling) * delta);
+        m = m + (gamma_mean[i] * delta) / GAS_INDEX_ADDITIONAL_GAMMA_MEAN_SCALING;
+
+        std[i] = gas_index_select(learn[i], s, std[i]);
+        mean[i] = gas_index_select(learn[i], m, gas_index_select(starting, 0.f, mean[i]));
+        offset[i] = gas_index_select(learn[i], base, gas_index_select(starting, sraw[i], offset[i]));
+        estimator_ready[i] = gas_index_select(starting, 1.f, estimator_ready[i]);
+    }
+
+    // Rounded index of the sites with a new sample, added to their window
+    for (int i = 0; i < count; i++) {
+        if (!fresh[i]) continue;
+        e->index[first + i] = (uint16_t)(gas_index[i] + 0.5f);
+        accum->voc_index_sum[first + i] += e->index[first + i];
+    }
+    memset(e->fresh + first, 0, count);
+}
+
+void gas_index_get_state(const GasIndexEngine* engine, int site, GasIndexState* state) {
+    *state = (GasIndexState){
+        .uptime = engine->uptime[site],
+        .sraw = engine->sraw[site],
+        .gas_index = engine->gas_index[site],
+        .mean = engine->mean[site],
+        .sraw_offset = engine->sraw_offset[site],
+        .std = engine->std[site],
+        .uptime_gamma = engine->uptime_gamma[site],
+        .uptime_gating = engine->uptime_gating[site],
+        .gating_duration = engine->gating_duration[site],
+        .estimator_ready = engine->estimator_ready[site],
+        .lowpass_ready = engine->lowpass_ready[site],
+        .x1 = engine->x1[site],
+        .x2 = engine->x2[site],
+        .x3 = engine->x3[site],
+    };
+}
+
+void gas_index_set_state(GasIndexEngine* engine, int site, const GasIndexState* state) {
+    engine->uptime[site] = state->uptime;
+    engine->sraw[site] = state->sraw;
+    engine->gas_index[site] = state->gas_index;
+    engine->mean[site] = state->mean;
+    engine->sraw_offset[site] = state->sraw_offset;
+    engine->std[site] = state->std;
+    engine->uptime_gamma[site] = state->uptime_gamma;
+    engine->uptime_gating[site] = state->uptime_gating;
+    engine->gating_duration[site] = state->gating_duration;
+    engine->estimator_ready[site] = state->estimator_ready;
+    engine->lowpass_ready[site] = state->lowpass_ready;
+    engine->x1[site] = state->x1;
+    engine->x2[site] = state->x2;
+    engine->x3[site] = state->x3;
+    engine->index[site] = (uint16_t)(state->gas_index + 0.5f);
+}
+
+void gas_index_reset_site(GasIndexEngine* engine, int site) {
+    GasIndexState state = {.std = GAS_INDEX_SRAW_STD_INITIAL};
+
+    gas_index_set_state(engine, site, &state);
+    engine->fresh[site] = 0;
+}
+
+void gas_index_set_baseline(GasIndexEngine* engine, int site, const GasIndexState* state) {
+    if (state->estimator_ready == 0.f) return;
+
+    engine->sraw_offset[site] = state->sraw_offset + state->mean;
+    engine->mean[site] = 0.f;
+    engine->std[site] = state->std;
+    engine->uptime_gamma[site] = GAS_INDEX_PERSISTENCE_UPTIME_GAMMA;
+    engine->estimator_ready[site] = 1.f;
+    engine->sraw[site] = state->sraw_offset + state->mean;
+}
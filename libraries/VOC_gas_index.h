@@ -0,0 +1,155 @@
+//
+// Sensirion VOC index algorithm, run on every site in structure-of-arrays form.
+//
+
+#ifndef VOC_GAS_INDEX_H
+#define VOC_GAS_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "VOC_essentials.h"
+
+#define GAS_INDEX_MAX_SITES LOG_RECORD_MAX_SITES
+
+/**
+ * @struct GasIndexEngine
+ * @brief State of the VOC index algorithm of every site, one array per variable.
+ *
+ * This is the float implementation of the Sensirion gas index algorithm for VOC: a mean and variance
+ * estimator learns the baseline of the raw signal, the deviation from it is mapped to an index of 1 to
+ * 500 (100 being the average) by a sigmoid, then smoothed by an adaptive lowpass. Each site keeps the
+ * state the reference keeps per sensor, but laid out as arrays indexed by site, so one sweep is
+ * processed by a few branch-free loops over all sites that the compiler can vectorize.
+ *
+ * During a sweep, the acquisition thread of a bus stores each new raw sample with gas_index_set_sample();
+ * gas_index_process() then updates the sites of that bus at once. Buses own disjoint ranges of sites,
+ * so they update the engine concurrently without locks.
+ */
+typedef struct GasIndexEngine {
+    int site_count;                                    /**< Number of sites in the arrays. */
+    float sampling_interval;                           /**< Seconds between two samples of a site. */
+    float gamma_mean;                                  /**< Learning rate of the mean, once trained. */
+    float gamma_variance;                              /**< Learning rate of the variance, once trained. */
+    float gamma_initial_mean;                          /**< Learning rate of the mean, at start. */
+    float gamma_initial_variance;                      /**< Learning rate of the variance, at start. */
+    float lowpass_a1;                                  /**< Coefficient of the fast lowpass. */
+    float lowpass_a2;                                  /**< Coefficient of the slow lowpass. */
+    uint16_t sraw_input[GAS_INDEX_MAX_SITES];          /**< Raw signal of the current sweep. */
+    uint8_t fresh[GAS_INDEX_MAX_SITES];                /**< 1 if sraw_input holds a sample not processed yet. */
+    uint16_t index[GAS_INDEX_MAX_SITES];               /**< Latest VOC index of each site, 0 during the blackout. */
+    float uptime[GAS_INDEX_MAX_SITES];                 /**< Seconds processed, up to the initial blackout. */
+    float sraw[GAS_INDEX_MAX_SITES];                   /**< Last valid raw signal, minus the signal minimum. */
+    float gas_index[GAS_INDEX_MAX_SITES];              /**< Unrounded output of the lowpass. */
+    float mean[GAS_INDEX_MAX_SITES];                   /**< Estimated mean, relative to sraw_offset. */
+    float sraw_offset[GAS_INDEX_MAX_SITES];            /**< Offset of the estimated mean. */
+    float std[GAS_INDEX_MAX_SITES];                    /**< Estimated standard deviation. */
+    float uptime_gamma[GAS_INDEX_MAX_SITES];           /**< Seconds of learning, drives the learning rates. */
+    float uptime_gating[GAS_INDEX_MAX_SITES];          /**< Seconds since the gating was last reset. */
+    float gating_duration[GAS_INDEX_MAX_SITES];        /**< Minutes the learning was gated by high indices. */
+    float estimator_ready[GAS_INDEX_MAX_SITES];        /**< 1 once the estimator saw its first sample. */
+    float lowpass_ready[GAS_INDEX_MAX_SITES];          /**< 1 once the lowpass saw its first sample. */
+    float x1[GAS_INDEX_MAX_SITES];                     /**< Fast lowpass. */
+    float x2[GAS_INDEX_MAX_SITES];                     /**< Slow lowpass. */
+    float x3[GAS_INDEX_MAX_SITES];                     /**< Adaptive lowpass, the output. */
+} GasIndexEngine;
+
+/**
+ * @struct GasIndexState
+ * @brief Algorithm state of one site, everything the engine keeps about it between two samples.
+ */
+typedef struct {
+    float uptime;           /**< Seconds processed, up to the initial blackout. */
+    float sraw;             /**< Last valid raw signal, minus the signal minimum. */
+    float gas_index;        /**< Unrounded output of the lowpass. */
+    float mean;             /**< Estimated mean, relative to sraw_offset. */
+    float sraw_offset;      /**< Offset of the estimated mean. */
+    float std;              /**< Estimated standard deviation. */
+    float uptime_gamma;     /**< Seconds of learning. */
+    float uptime_gating;    /**< Seconds since the gating was last reset. */
+    float gating_duration;  /**< Minutes the learning was gated by high indices. */
+    float estimator_ready;  /**< 1 once the estimator saw its first sample. */
+    float lowpass_ready;    /**< 1 once the lowpass saw its first sample. */
+    float x1;               /**< Fast lowpass. */
+    float x2;               /**< Slow lowpass. */
+    float x3;               /**< Adaptive lowpass, the output. */
+} GasIndexState;
+
+/**
+ * gas_index_init() - Resets the algorithm of every site.
+ *
+ * @param engine Engine to initialize.
+ * @param site_count Number of sites, at most GAS_INDEX_MAX_SITES.
+ * @param sampling_interval Seconds between two samples of a site, 1 for the nominal algorithm.
+ */
+void gas_index_init(GasIndexEngine* engine, int site_count, float sampling_interval);
+
+/**
+ * gas_index_set_sample() - Stores the raw signal of a site for the next gas_index_process().
+ *
+ * @param engine Initialized engine.
+ * @param site Site index.
+ * @param sraw Raw VOC signal in ticks.
+ */
+void gas_index_set_sample(GasIndexEngine* engine, int site, uint16_t sraw);
+
+/**
+ * gas_index_process() - Runs the algorithm on the sites of a range that received a sample.
+ *
+ * The new index of each of those sites is stored in engine->index and added to its voc_index_sum in
+ * the accumulators.
+ *
+ * @param engine Initialized engine.
+ * @param accum Accumulators of all sites, indexed like the engine.
+ * @param first First site of the range.
+ * @param count Number of sites in the range.
+ */
+void gas_index_process(GasIndexEngine* engine, SensorAccumulator* accum, int first, int count);
+
+/**
+ * gas_index_get_state() - Copies the algorithm state of a site.
+ *
+ * Must not run concurrently with gas_index_process() on the range of the site.
+ *
+ * @param engine Initialized engine.
+ * @param site Site index.
+ * @param state Set to the state of the site.
+ */
+void gas_index_get_state(const GasIndexEngine* engine, int site, GasIndexState* state);
+
+/**
+ * gas_index_set_state() - Restores the whole algorithm state of a site from gas_index_get_state().
+ *
+ * The site carries on where the state was taken: no blackout, and its next index continues from the
+ * saved one. Meant for a state saved shortly before, while the air seen by the sensor is still alike.
+ *
+ * @param engine Initialized engine.
+ * @param site Site index.
+ * @param state State to restore.
+ */
+void gas_index_set_state(GasIndexEngine* engine, int site, const GasIndexState* state);
+
+/**
+ * gas_index_reset_site() - Restarts the algorithm of a site, as gas_index_init() left it.
+ *
+ * For a site whose sensor was replaced: the state learned from the previous sensor does not apply to
+ * the new one, which goes through the blackout again.
+ *
+ * @param engine Initialized engine.
+ * @param site Site index.
+ */
+void gas_index_reset_site(GasIndexEngine* engine, int site);
+
+/**
+ * gas_index_set_baseline() - Restores only the learned baseline of a site from gas_index_get_state().
+ *
+ * Like the set_states() of the Sensirion reference, only the mean and the standard deviation are kept
+ * and the learning restarts at the slow trained rates; the blackout and the lowpass start over. Meant
+ * for an older state, from which the sensor may have drifted.
+ *
+ * @param engine Initialized engine.
+ * @param site Site index.
+ * @param state State to take the baseline from, ignored if its estimator never started.
+ */
+void gas_index_set_baseline(GasIndexEngine* engine, int site, const GasIndexState* state);
+
+#endif //VOC_GAS_INDEX_H
@@ -0,0 +1,156 @@
+#include "VOC_index_store.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(IndexStoreHeader) == 16, "IndexStoreHeader must stay 16 bytes");
+_Static_assert(sizeof(IndexStoreEntry) % 8 == 0, "IndexStoreEntry must keep its serial aligned");
+
+static IndexStoreEntry* index_store_find(IndexStore* store, uint64_t serial) {
+    for (int i = 0; i < store->entry_count; i++) {
+        if (store->entries[i].serial == serial) return &store->entries[i];
+    }
+    return NULL;
+}
+
+// Entry of a sensor, a new one or the oldest one when the store is full
+static IndexStoreEntry* index_store_claim(IndexStore* store, uint64_t serial) {
+    IndexStoreEntry* entry = index_store_find(store, serial);
+    if (entry) return entry;
+    if (store->entry_count < INDEX_STORE_MAX_ENTRIES) return &store->entries[store->entry_count++];
+
+    entry = &store->entries[0];
+    for (int i = 1; i < store->entry_count; i++) {
+        if (store->entries[i].saved_usec < entry->saved_usec) entry = &store->entries[i];
+    }
+    return entry;
+}
+
+static int index_store_write_all(int fd, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// The rename is only durable once the directory holding the file is synced too
+static void index_store_sync_dir(const char* path) {
+    char dir[sizeof(((IndexStore*)0)->path)];
+    const char* slash = strrchr(path, '/');
+
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+int index_store_open(IndexStore* store, const char* path) {
+    IndexStoreHeader header;
+
+    memset(store, 0, sizeof(*store));
+    snprintf(store->path, sizeof(store->path), "%s", path);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+
+    int ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, INDEX_STORE_MAGIC, 4) == 0 &&
+             header.version == INDEX_STORE_VERSION && header.entry_size == sizeof(IndexStoreEntry) &&
+             header.entry_count <= INDEX_STORE_MAX_ENTRIES &&
+             fread(store->entries, sizeof(IndexStoreEntry), header.entry_count, file) == header.entry_count;
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Invalid VOC state file %s, ignored.\n", path);
+        return -1;
+    }
+    store->entry_count = header.entry_count;
+    return 0;
+}
+
+bool index_store_restore_site(IndexStore* store, GasIndexEngine* engine, int site, uint64_t serial,
+                              uint64_t now_usec, int max_age) {
+    const IndexStoreEntry* entry = serial ? index_store_find(store, serial) : NULL;
+    if (!entry) return false;
+
+    // A checkpoint from the future, after a clock step, is as good as a fresh one
+    uint64_t age_usec = now_usec > entry->saved_usec ? now_usec - entry->saved_usec : 0;
+    if (max_age > 0 && age_usec <= (uint64_t)max_age * 1000000) {
+        gas_index_set_state(engine, site, &entry->state);
+    } else {
+        gas_index_set_baseline(engine, site, &entry->state);
+    }
+    return true;
+}
+
+int index_store_restore(IndexStore* store, GasIndexEngine* engine, const BinlogSensor sensors[], uint64_t now_usec,
+                        int max_age) {
+    int restored = 0;
+
+    for (int site = 0; site < engine->site_count; site++) {
+        if (index_store_restore_site(store, engine, site, sensors[site].sgp_serial, now_usec, max_age)) restored++;
+    }
+    return restored;
+}
+
+int index_store_save(IndexStore* store, const GasIndexEngine* engine, const BinlogSensor sensors[],
+                     uint64_t now_usec) {
+    char temp_path[sizeof(store->path) + 4];
+
+    for (int site = 0; site < engine->site_count; site++) {
+        uint64_t serial = sensors[site].sgp_serial;
+        if (!serial) continue;
+
+        GasIndexState state;
+        gas_index_get_state(engine, site, &state);
+        if (state.estimator_ready == 0.f) continue;
+
+        IndexStoreEntry* entry = index_store_claim(store, serial);
+        *entry = (IndexStoreEntry){.serial = serial, .saved_usec = now_usec, .state = state};
+    }
+
+    IndexStoreHeader header = {
+        .version = INDEX_STORE_VERSION,
+        .entry_size = sizeof(IndexStoreEntry),
+        .entry_count = store->entry_count,
+    };
+    memcpy(header.magic, INDEX_STORE_MAGIC, 4);
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", store->path);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create VOC state file");
+        return -1;
+    }
+    if (index_store_write_all(fd, &header, sizeof(header)) != 0 ||
+        index_store_write_all(fd, store->entries, store->entry_count * sizeof(IndexStoreEntry)) != 0 ||
+        fsync(fd) != 0) {
+        perror("Failed to write VOC state file");
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    close(fd);
+    if (rename(temp_path, store->path) != 0) {
+        perror("Failed to replace VOC state file");
+        unlink(temp_path);
+        return -1;
+    }
+    index_store_sync_dir(store->path);
+    return 0;
+}
@@ -0,0 +1,124 @@
+//
+// Checkpoints of the VOC index algorithm state of every sensor, keyed by SGP40 serial number.
+//
+
+#ifndef VOC_INDEX_STORE_H
+#define VOC_INDEX_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "VOC_binlog.h"
+#include "VOC_gas_index.h"
+
+#define INDEX_STORE_MAGIC "VOCG"
+#define INDEX_STORE_VERSION 1
+#define INDEX_STORE_MAX_ENTRIES (2 * GAS_INDEX_MAX_SITES)
+#define DEFAULT_VOC_STATE_FILE "../voc_state.bin"
+#define DEFAULT_VOC_STATE_INTERVAL 600
+#define DEFAULT_VOC_STATE_MAX_AGE 3600
+
+/**
+ * @struct IndexStoreHeader
+ * @brief Start of a state file, followed by entry_count IndexStoreEntry.
+ *
+ * All fields are little-endian. A file with another version or entry size is ignored and replaced by
+ * the next checkpoint.
+ */
+typedef struct {
+    char magic[4];               /**< INDEX_STORE_MAGIC. */
+    uint16_t version;            /**< INDEX_STORE_VERSION. */
+    uint16_t entry_size;         /**< sizeof(IndexStoreEntry). */
+    uint32_t entry_count;        /**< Number of entries following the header. */
+    uint32_t reserved;           /**< Zero. */
+} IndexStoreHeader;
+
+/**
+ * @struct IndexStoreEntry
+ * @brief Algorithm state of one sensor at its last checkpoint.
+ */
+typedef struct {
+    uint64_t serial;             /**< Serial number of the SGP40. */
+    uint64_t saved_usec;         /**< Wall-clock time of the checkpoint, microseconds since the epoch. */
+    GasIndexState state;         /**< Algorithm state of the sensor. */
+} IndexStoreEntry;
+
+/**
+ * @struct IndexStore
+ * @brief Latest algorithm state of every sensor seen, in memory and in its file.
+ *
+ * Entries are keyed by serial number rather than site, so a sensor moved to another port keeps its
+ * state, and the entries of sensors absent from a run are kept for a later one. The file is rewritten
+ * whole at every checkpoint through a temporary file and a rename, so a crash leaves either the
+ * previous checkpoint or the new one, never a mix.
+ */
+typedef struct {
+    char path[128];                                  /**< State file. */
+    int entry_count;                                 /**< Number of entries in entries. */
+    IndexStoreEntry entries[INDEX_STORE_MAX_ENTRIES]; /**< State of every sensor seen, in no order. */
+} IndexStore;
+
+/**
+ * index_store_open() - Loads the state file of a store.
+ *
+ * A missing file gives an empty store, created by the first checkpoint.
+ *
+ * @param store Store to initialize.
+ * @param path State file, shorter than sizeof(store->path).
+ *
+ * @return 0 on success, -1 if the file exists but is not a valid state file. The store is then empty.
+ */
+int index_store_open(IndexStore* store, const char* path);
+
+/**
+ * index_store_restore_site() - Restores the saved state of one sensor into a site of an engine.
+ *
+ * A state at most max_age seconds old is restored whole with gas_index_set_state(), so the site gives
+ * its index from its first sample on. An older one only restores the learned baseline with
+ * gas_index_set_baseline().
+ *
+ * @param store Opened store.
+ * @param engine Engine whose site was just initialized or reset.
+ * @param site Site index.
+ * @param serial SGP40 serial number of the site, 0 if unknown.
+ * @param now_usec Wall-clock time, microseconds since the epoch.
+ * @param max_age Age in seconds up to which a state is restored whole, 0 to only restore baselines.
+ *
+ * @return true if the store held a state of the sensor.
+ */
+bool index_store_restore_site(IndexStore* store, GasIndexEngine* engine, int site, uint64_t serial,
+                              uint64_t now_usec, int max_age);
+
+/**
+ * index_store_restore() - Restores the saved state of the sensors of every site into an engine.
+ *
+ * See index_store_restore_site().
+ *
+ * @param store Opened store.
+ * @param engine Engine right after gas_index_init().
+ * @param sensors Sensors of every engine site.
+ * @param now_usec Wall-clock time, microseconds since the epoch.
+ * @param max_age Age in seconds up to which a state is restored whole, 0 to only restore baselines.
+ *
+ * @return Number of sites restored.
+ */
+int index_store_restore(IndexStore* store, GasIndexEngine* engine, const BinlogSensor sensors[], uint64_t now_usec,
+                        int max_age);
+
+/**
+ * index_store_save() - Checkpoints the state of the sensors of every site to the state file.
+ *
+ * Sites whose estimator has not started yet are skipped. The engine state of a site always belongs to
+ * the sensor last found there, as the sweeps restart the algorithm of a site whose sensor is replaced.
+ * When the store is full, the oldest entries make room for the new sensors.
+ *
+ * @param store Opened store.
+ * @param engine Engine, not processing concurrently.
+ * @param sensors Sensors of every engine site.
+ * @param now_usec Wall-clock time, microseconds since the epoch.
+ *
+ * @return 0 on success, -1 if the file could not be written. The previous checkpoint is then kept.
+ */
+int index_store_save(IndexStore* store, const GasIndexEngine* engine, const BinlogSensor sensors[],
+                     uint64_t now_usec);
+
+#endif //VOC_INDEX_STORE_H
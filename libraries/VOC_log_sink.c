@@ -0,0 +1,140 @@
+#include "VOC_log_sink.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_SINK_PAGE_SIZE 4096
+
+static int64_t log_sink_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Durability is about the real storage, so the sink stays on the system clock under a virtual HAL clock
+static int64_t log_sink_now_ms(void) {
+    return log_sink_now_us() / 1000;
+}
+
+static void log_sink_write_data(LogSink* sink, const char* data, size_t size) {
+    size_t done = 0;
+    uint64_t writes = 0;
+
+    while (done < size) {
+        ssize_t n = write(sink->fd, data + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Failed to write log file");
+            break;
+        }
+        done += n;
+        writes++;
+    }
+    sink->offset += done;
+
+    pthread_mutex_lock(&sink->stats_lock);
+    sink->stats.writes += writes;
+    pthread_mutex_unlock(&sink->stats_lock);
+}
+
+static void log_sink_write(LogSink* sink) {
+    log_sink_write_data(sink, sink->buffer, sink->used);
+    sink->used = 0;
+}
+
+int log_sink_open(LogSink* sink, FILE* logfile, int sync_rows, int sync_interval_s) {
+    fflush(logfile);
+    sink->buffer = malloc(LOG_SINK_BUFFER_SIZE);
+    if (!sink->buffer) {
+        perror("Failed to allocate log buffer");
+        return -1;
+    }
+    sink->fd = fileno(logfile);
+    sink->used = 0;
+    sink->sync_rows = sync_rows;
+    sink->sync_interval_ms = (int64_t)sync_interval_s * 1000;
+    sink->rows_unsynced = 0;
+    sink->first_unsynced_ms = 0;
+    sink->offset = lseek(sink->fd, 0, SEEK_END);
+    if (sink->offset < 0) sink->offset = 0;
+    sink->synced_offset = sink->offset;
+    memset(&sink->stats, 0, sizeof(sink->stats));
+    pthread_mutex_init(&sink->stats_lock, NULL);
+    return 0;
+}
+
+void log_sink_sync(LogSink* sink) {
+    if (sink->used) log_sink_write(sink);
+    if (sink->offset == sink->synced_offset) {
+        sink->rows_unsynced = 0;
+        return;
+    }
+
+    int64_t start = log_sink_now_us();
+    if (fdatasync(sink->fd) != 0) perror("Failed to sync log file");
+    uint64_t elapsed = log_sink_now_us() - start;
+
+    // Every data page touched since the last sync is rewritten, including the partial one it ended in
+    uint64_t first_page = sink->synced_offset / LOG_SINK_PAGE_SIZE;
+    uint64_t end_page = (sink->offset + LOG_SINK_PAGE_SIZE - 1) / LOG_SINK_PAGE_SIZE;
+
+    pthread_mutex_lock(&sink->stats_lock);
+    sink->stats.syncs++;
+    sink->stats.device_bytes += (end_page - first_page) * LOG_SINK_PAGE_SIZE;
+    sink->stats.sync_usec_total += elapsed;
+    if (elapsed > sink->stats.sync_usec_max) sink->stats.sync_usec_max = elapsed;
+    pthread_mutex_unlock(&sink->stats_lock);
+
+    sink->synced_offset = sink->offset;
+    sink->rows_unsynced = 0;
+}
+
+void log_sink_append(LogSink* sink, const char* row, size_t len) {
+    if (sink->used + len > LOG_SINK_BUFFER_SIZE) log_sink_write(sink);
+    if (len > LOG_SINK_BUFFER_SIZE) {
+        // Too large to buffer, it follows the rows already written and goes out in one piece
+        log_sink_write_data(sink, row, len);
+    } else {
+        memcpy(sink->buffer + sink->used, row, len);
+        sink->used += len;
+    }
+
+    if (sink->rows_unsynced++ == 0) sink->first_unsynced_ms = log_sink_now_ms();
+    pthread_mutex_lock(&sink->stats_lock);
+    sink->stats.rows++;
+    sink->stats.payload_bytes += len;
+    pthread_mutex_unlock(&sink->stats_lock);
+
+    if (sink->sync_rows > 0 && sink->rows_unsynced >= sink->sync_rows) {
+        log_sink_sync(sink);
+    } else if (sink->sync_rows <= 0 && sink->sync_interval_ms <= 0) {
+        // No durability policy: every row reaches the page cache at once, like a flushed FILE
+        log_sink_write(sink);
+    } else {
+        log_sink_poll(sink);
+    }
+}
+
+int64_t log_sink_poll(LogSink* sink) {
+    if (!sink->rows_unsynced || sink->sync_interval_ms <= 0) return -1;
+
+    int64_t remaining = sink->first_unsynced_ms + sink->sync_interval_ms - log_sink_now_ms();
+    if (remaining > 0) return remaining;
+    log_sink_sync(sink);
+    return -1;
+}
+
+void log_sink_get_stats(LogSink* sink, LogSinkStats* stats) {
+    pthread_mutex_lock(&sink->stats_lock);
+    *stats = sink->stats;
+    pthread_mutex_unlock(&sink->stats_lock);
+}
+
+void log_sink_close(LogSink* sink) {
+    log_sink_sync(sink);
+    pthread_mutex_destroy(&sink->stats_lock);
+    free(sink->buffer);
+    sink->buffer = NULL;
+}
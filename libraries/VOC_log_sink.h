@@ -0,0 +1,114 @@
+//
+// Buffered log file with a group-commit durability policy.
+//
+
+#ifndef VOC_LOG_SINK_H
+#define VOC_LOG_SINK_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define DEFAULT_LOG_SYNC_ROWS 100
+#define DEFAULT_LOG_SYNC_INTERVAL 10
+#define LOG_SINK_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @struct LogSinkStats
+ * @brief Counters of a LogSink.
+ */
+typedef struct {
+    uint64_t rows;             /**< Rows appended. */
+    uint64_t payload_bytes;    /**< Bytes appended. */
+    uint64_t writes;           /**< write() calls. */
+    uint64_t syncs;            /**< fdatasync() calls. */
+    uint64_t device_bytes;     /**< Data pages the syncs made the storage write, in bytes. */
+    uint64_t sync_usec_total;  /**< Time spent in fdatasync(). */
+    uint64_t sync_usec_max;    /**< Longest fdatasync(). */
+} LogSinkStats;
+
+/**
+ * @struct LogSink
+ * @brief Log file written in large chunks and made durable in groups of rows.
+ *
+ * Rows are collected in a user-space buffer, written with one write() when the buffer is full or a
+ * sync is due, and made durable with fdatasync() once sync_rows rows or sync_interval_ms milliseconds
+ * have accumulated since the last sync, whichever comes first. A crash loses at most the rows of one
+ * group. On SD cards every sync rewrites the partly filled last page of the file, so larger groups
+ * reduce wear: device_bytes / payload_bytes estimates that write amplification. Without any budget,
+ * every row is written at once and never synced, like a flushed FILE.
+ *
+ * The sink is used by a single thread; log_sink_get_stats() may be called from any thread.
+ */
+typedef struct {
+    int fd;                          /**< File descriptor of the log file. */
+    char* buffer;                    /**< Rows not yet written. */
+    size_t used;                     /**< Bytes in buffer. */
+    int sync_rows;                   /**< Rows per group, 0 for no row budget. */
+    int64_t sync_interval_ms;        /**< Longest time a row waits for its sync, 0 for no time budget. */
+    int rows_unsynced;               /**< Rows appended since the last sync. */
+    int64_t first_unsynced_ms;       /**< CLOCK_MONOTONIC time of the oldest row not yet synced. */
+    off_t offset;                    /**< Bytes written to the file. */
+    off_t synced_offset;             /**< File size at the last sync. */
+    LogSinkStats stats;              /**< Counters, guarded by stats_lock. */
+    pthread_mutex_t stats_lock;      /**< Lets log_sink_get_stats() run on another thread. */
+} LogSink;
+
+/**
+ * log_sink_open() - Takes over a log file opened for appending.
+ *
+ * The FILE is flushed and must not be written through anymore until log_sink_close().
+ *
+ * @param sink Sink to initialize.
+ * @param logfile Log file, opened in append mode.
+ * @param sync_rows Rows per durable group, 0 for no row budget.
+ * @param sync_interval_s Longest time in seconds a row waits to be durable, 0 for no time budget.
+ *
+ * @return 0 on success, -1 if the buffer could not be allocated.
+ */
+int log_sink_open(LogSink* sink, FILE* logfile, int sync_rows, int sync_interval_s);
+
+/**
+ * log_sink_append() - Appends one row, writing and syncing if a budget is exhausted.
+ *
+ * A row larger than LOG_SINK_BUFFER_SIZE is written straight to the file, after the buffered rows.
+ *
+ * @param sink Open sink.
+ * @param row Row text, including its line feed.
+ * @param len Length of row.
+ */
+void log_sink_append(LogSink* sink, const char* row, size_t len);
+
+/**
+ * log_sink_poll() - Syncs the pending rows if the oldest one waited for sync_interval_s.
+ *
+ * @param sink Open sink.
+ *
+ * @return Milliseconds until the next time budget expires, -1 if no row is pending or there is no time budget.
+ */
+int64_t log_sink_poll(LogSink* sink);
+
+/**
+ * log_sink_sync() - Writes the buffered rows and makes them durable.
+ *
+ * @param sink Open sink.
+ */
+void log_sink_sync(LogSink* sink);
+
+/**
+ * log_sink_get_stats() - Copies the counters of a sink.
+ *
+ * @param sink Open sink.
+ * @param stats Counters.
+ */
+void log_sink_get_stats(LogSink* sink, LogSinkStats* stats);
+
+/**
+ * log_sink_close() - Syncs the pending rows and releases the buffer, the FILE stays open.
+ *
+ * @param sink Open sink.
+ */
+void log_sink_close(LogSink* sink);
+
+#endif //VOC_LOG_SINK_H
@@ -0,0 +1,167 @@
+#include "VOC_log_writer.h"
+#include "VOC_binlog.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert(BINLOG_RECORD_MAX_SIZE <= LOG_ROW_MAX, "binary records must fit a row buffer");
+_Static_assert(TSLOG_MAX_BLOCK_SIZE <= LOG_SINK_BUFFER_SIZE, "compressed blocks must fit the sink buffer");
+
+int log_encoder_init(LogEncoder* encoder, LogFormat format, int site_count, int block_records) {
+    encoder->format = format;
+    if (format != LOG_FORMAT_COMPRESSED) return 0;
+    return tslog_encoder_init(&encoder->tslog, site_count, block_records);
+}
+
+void log_encoder_append(LogEncoder* encoder, const LogRecord* record, LogSink* sink) {
+    _Alignas(8) char row[LOG_ROW_MAX];
+
+    switch (encoder->format) {
+        case LOG_FORMAT_COMPRESSED: {
+            size_t len = tslog_encoder_append(&encoder->tslog, record);
+            if (len) log_sink_append(sink, (const char*)encoder->tslog.block, len);
+            break;
+        }
+        case LOG_FORMAT_BINARY:
+            log_sink_append(sink, row, binlog_encode_record(record, (uint8_t*)row, sizeof(row)));
+            break;
+        default:
+            log_sink_append(sink, row, format_record_csv(record, row, sizeof(row)));
+            break;
+    }
+}
+
+void log_encoder_finish(LogEncoder* encoder, LogSink* sink) {
+    if (encoder->format != LOG_FORMAT_COMPRESSED) return;
+    size_t len = tslog_encoder_flush(&encoder->tslog);
+    if (len) log_sink_append(sink, (const char*)encoder->tslog.block, len);
+    tslog_encoder_free(&encoder->tslog);
+}
+
+// Drains every published record into the sink as one batch
+static void log_writer_drain(LogWriter* writer) {
+    uint64_t tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&writer->head, memory_order_acquire);
+    if (tail == head) return;
+
+    for (uint64_t i = tail; i != head; i++) {
+        log_encoder_append(writer->encoder, &writer->slots[i & (writer->capacity - 1)], writer->sink);
+    }
+
+    atomic_fetch_add_explicit(&writer->written, head - tail, memory_order_relaxed);
+    atomic_fetch_add_explicit(&writer->batches, 1, memory_order_relaxed);
+    atomic_store_explicit(&writer->tail, head, memory_order_release);
+}
+
+// Waits for a record, or until the time budget of the rows pending in the sink expires
+static void log_writer_wait(LogWriter* writer) {
+    int64_t timeout_ms = log_sink_poll(writer->sink);
+
+    if (timeout_ms < 0) {
+        while (sem_wait(&writer->available) != 0 && errno == EINTR) {
+        }
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (sem_timedwait(&writer->available, &deadline) != 0 && errno == EINTR) {
+    }
+}
+
+static void* log_writer_main(void* arg) {
+    LogWriter* writer = arg;
+
+    while (atomic_load(&writer->running)) {
+        log_writer_wait(writer);
+        // Records committed while the previous batch was written are all drained at once
+        while (sem_trywait(&writer->available) == 0) {
+        }
+        log_writer_drain(writer);
+    }
+    log_writer_drain(writer);
+    return NULL;
+}
+
+int log_writer_start(LogWriter* writer, LogSink* sink, LogEncoder* encoder, uint32_t capacity, LogOverflow overflow) {
+    uint32_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    writer->slots = malloc(size * sizeof(LogRecord));
+    if (!writer->slots) {
+        perror("Failed to allocate log queue");
+        return -1;
+    }
+    writer->capacity = size;
+    writer->overflow = overflow;
+    writer->sink = sink;
+    writer->encoder = encoder;
+    atomic_init(&writer->head, 0);
+    atomic_init(&writer->tail, 0);
+    atomic_init(&writer->dropped, 0);
+    atomic_init(&writer->written, 0);
+    atomic_init(&writer->batches, 0);
+    writer->pushed = 0;
+    writer->max_depth = 0;
+    atomic_init(&writer->running, 1);
+    sem_init(&writer->available, 0, 0);
+
+    if (pthread_create(&writer->thread, NULL, log_writer_main, writer) != 0) {
+        perror("Failed to start log writer thread");
+        sem_destroy(&writer->available);
+        free(writer->slots);
+        writer->slots = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+LogRecord* log_writer_reserve(LogWriter* writer) {
+    uint64_t head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+
+    while (head - atomic_load_explicit(&writer->tail, memory_order_acquire) >= writer->capacity) {
+        if (writer->overflow == LOG_OVERFLOW_DROP) {
+            atomic_fetch_add_explicit(&writer->dropped, 1, memory_order_relaxed);
+            return NULL;
+        }
+        // The writer thread is behind on a slow file system, real time on purpose
+        usleep(1000);
+    }
+    return &writer->slots[head & (writer->capacity - 1)];
+}
+
+void log_writer_commit(LogWriter* writer) {
+    uint64_t head = atomic_load_explicit(&writer->head, memory_order_relaxed) + 1;
+    uint64_t depth = head - atomic_load_explicit(&writer->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&writer->head, head, memory_order_release);
+    sem_post(&writer->available);
+    writer->pushed++;
+    if (depth > writer->max_depth) writer->max_depth = depth;
+}
+
+void log_writer_get_stats(LogWriter* writer, LogWriterStats* stats) {
+    uint64_t head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+
+    stats->pushed = writer->pushed;
+    stats->dropped = atomic_load_explicit(&writer->dropped, memory_order_relaxed);
+    stats->written = atomic_load_explicit(&writer->written, memory_order_relaxed);
+    stats->batches = atomic_load_explicit(&writer->batches, memory_order_relaxed);
+    stats->depth = head - atomic_load_explicit(&writer->tail, memory_order_acquire);
+    stats->max_depth = writer->max_depth;
+}
+
+void log_writer_stop(LogWriter* writer) {
+    atomic_store(&writer->running, 0);
+    sem_post(&writer->available);
+    pthread_join(writer->thread, NULL);
+    sem_destroy(&writer->available);
+    free(writer->slots);
+    writer->slots = NULL;
+}
@@ -0,0 +1,158 @@
+//
+// Log writer thread fed by a lock-free ring of records.
+//
+
+#ifndef VOC_LOG_WRITER_H
+#define VOC_LOG_WRITER_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "VOC_essentials.h"
+#include "VOC_log_sink.h"
+#include "VOC_tslog.h"
+
+#define DEFAULT_LOG_QUEUE 64
+#define LOG_ROW_MAX LOG_RECORD_CSV_MAX
+
+/**
+ * @enum LogOverflow
+ * @brief What log_writer_reserve() does when the ring is full.
+ */
+typedef enum {
+    LOG_OVERFLOW_DROP = 0,   /**< The new record is dropped and counted, acquisition never waits. */
+    LOG_OVERFLOW_BLOCK = 1,  /**< The producer waits for the writer to free a slot, no record is lost. */
+} LogOverflow;
+
+/**
+ * @struct LogWriterStats
+ * @brief Counters of a LogWriter.
+ */
+typedef struct {
+    uint64_t pushed;         /**< Records queued by the producer. */
+    uint64_t dropped;        /**< Records dropped because the ring was full. */
+    uint64_t written;        /**< Records appended to the sink. */
+    uint64_t batches;        /**< Batches of records drained together by the writer thread. */
+    uint32_t depth;          /**< Records queued when the counters were read. */
+    uint32_t max_depth;      /**< Highest queue depth seen by the producer. */
+} LogWriterStats;
+
+/**
+ * @struct LogEncoder
+ * @brief Encodes records in the format of the log file and appends them to a LogSink.
+ *
+ * CSV and binary records are appended one by one. Compressed records are collected in blocks, so the
+ * sink receives a whole block every block_records records and a crash loses the current block.
+ */
+typedef struct {
+    LogFormat format;        /**< Format of the log file. */
+    TslogEncoder tslog;      /**< Block being filled, LOG_FORMAT_COMPRESSED only. */
+} LogEncoder;
+
+/**
+ * @struct LogWriter
+ * @brief Single-producer single-consumer ring of LogRecord, drained by a writer thread.
+ *
+ * The acquisition thread fills a slot in place with log_writer_reserve() and publishes it with
+ * log_writer_commit(); the writer thread encodes every published record and appends it to a LogSink,
+ * which decides when the rows are written and synced. The indices are free-running and only written by
+ * their owner, so neither side takes a lock, and the memory used is fixed at capacity records.
+ */
+typedef struct {
+    LogRecord* slots;                /**< Ring storage, capacity records. */
+    uint32_t capacity;               /**< Number of slots, a power of two. */
+    LogOverflow overflow;            /**< Policy when the ring is full. */
+    LogSink* sink;                   /**< Destination of the records, owned by the caller. */
+    LogEncoder* encoder;             /**< Encoding of the records in the sink, owned by the caller. */
+    _Atomic uint64_t head;           /**< Next slot written by the producer. */
+    _Atomic uint64_t tail;           /**< Next slot read by the writer thread. */
+    _Atomic uint64_t dropped;        /**< Records dropped by the producer. */
+    _Atomic uint64_t written;        /**< Records appended to the sink by the writer thread. */
+    _Atomic uint64_t batches;        /**< Batches drained by the writer thread. */
+    uint64_t pushed;                 /**< Records committed, producer only. */
+    uint32_t max_depth;              /**< Highest depth seen at commit, producer only. */
+    sem_t available;                 /**< Posted once per committed record. */
+    _Atomic int running;             /**< Cleared by log_writer_stop(). */
+    pthread_t thread;                /**< Writer thread. */
+} LogWriter;
+
+/**
+ * log_encoder_init() - Prepares the encoding of the records of a log file.
+ *
+ * @param encoder Encoder to initialize.
+ * @param format Format of the log file.
+ * @param site_count Number of sites in every record.
+ * @param block_records Records per block of a compressed log, at most TSLOG_MAX_BLOCK_RECORDS.
+ *
+ * @return 0 on success, -1 if the block of a compressed log could not be allocated.
+ */
+int log_encoder_init(LogEncoder* encoder, LogFormat format, int site_count, int block_records);
+
+/**
+ * log_encoder_append() - Encodes a record and appends it to a sink, or to the current block.
+ *
+ * @param encoder Initialized encoder.
+ * @param record Record to append.
+ * @param sink Open sink.
+ */
+void log_encoder_append(LogEncoder* encoder, const LogRecord* record, LogSink* sink);
+
+/**
+ * log_encoder_finish() - Appends the current block to the sink and releases the encoder.
+ *
+ * @param encoder Initialized encoder.
+ * @param sink Open sink.
+ */
+void log_encoder_finish(LogEncoder* encoder, LogSink* sink);
+
+/**
+ * log_writer_start() - Allocates the ring and starts the writer thread.
+ *
+ * @param writer Writer to start.
+ * @param sink Open sink the records are appended to, only used by the writer thread until log_writer_stop().
+ * @param encoder Initialized encoder, only used by the writer thread until log_writer_stop().
+ * @param capacity Ring size in records, rounded up to a power of two.
+ * @param overflow Policy when the ring is full.
+ *
+ * @return 0 on success, -1 if the ring could not be allocated or the thread could not be created.
+ */
+int log_writer_start(LogWriter* writer, LogSink* sink, LogEncoder* encoder, uint32_t capacity, LogOverflow overflow);
+
+/**
+ * log_writer_reserve() - Returns the next free slot of the ring, to be filled by the producer.
+ *
+ * With LOG_OVERFLOW_BLOCK the call waits until the writer frees a slot. With LOG_OVERFLOW_DROP a full
+ * ring drops the record: the drop is counted and NULL is returned.
+ *
+ * @param writer Started writer.
+ *
+ * @return Slot to fill and pass to log_writer_commit(), NULL if the record is dropped.
+ */
+LogRecord* log_writer_reserve(LogWriter* writer);
+
+/**
+ * log_writer_commit() - Publishes the slot returned by the last log_writer_reserve() to the writer thread.
+ *
+ * @param writer Started writer.
+ */
+void log_writer_commit(LogWriter* writer);
+
+/**
+ * log_writer_get_stats() - Reads the counters of a writer, from the producer thread.
+ *
+ * @param writer Started writer.
+ * @param stats Counters.
+ */
+void log_writer_get_stats(LogWriter* writer, LogWriterStats* stats);
+
+/**
+ * log_writer_stop() - Appends the queued records to the sink, stops the writer thread and frees the ring.
+ *
+ * The sink is left open, with the rows of its current group not yet synced, and so is the current block
+ * of the encoder.
+ *
+ * @param writer Started writer.
+ */
+void log_writer_stop(LogWriter* writer);
+
+#endif //VOC_LOG_WRITER_H
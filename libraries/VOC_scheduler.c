@@ -0,0 +1,41 @@
+#include "VOC_scheduler.h"
+#include "sensirion_i2c_hal.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_USEC 1000LL
+
+void scheduler_init(SampleScheduler* sched, int64_t period_ns, int64_t align_ns) {
+    // Both clocks come from the HAL so that a virtual clock drives the schedule too
+    int64_t mono = (int64_t)sensirion_i2c_hal_get_time_usec() * NSEC_PER_USEC;
+    int64_t wall = (int64_t)sensirion_i2c_hal_get_realtime_usec() * NSEC_PER_USEC;
+
+    if (align_ns <= 0) align_ns = period_ns;
+    int64_t wall_start = (wall / align_ns + 1) * align_ns;
+
+    sched->epoch_wall_ns = wall_start;
+    sched->epoch_mono_ns = mono + (wall_start - wall);
+    sched->period_ns = period_ns;
+    sched->next_tick = 0;
+    sched->overruns = 0;
+    sched->missed = 0;
+}
+
+uint64_t scheduler_wait(SampleScheduler* sched) {
+    int64_t deadline = sched->epoch_mono_ns + (int64_t)sched->next_tick * sched->period_ns;
+    int64_t now = (int64_t)sensirion_i2c_hal_get_time_usec() * NSEC_PER_USEC;
+
+    if (now >= deadline) {
+        uint64_t late = (now - deadline) / sched->period_ns;
+        sched->overruns++;
+        sched->missed += late;
+        sched->next_tick += late;
+        return sched->next_tick++;
+    }
+
+    sensirion_i2c_hal_sleep_until_usec((deadline + NSEC_PER_USEC - 1) / NSEC_PER_USEC);
+    return sched->next_tick++;
+}
+
+time_t scheduler_tick_time(const SampleScheduler* sched, uint64_t tick) {
+    return (time_t)((sched->epoch_wall_ns + (int64_t)tick * sched->period_ns) / NSEC_PER_SEC);
+}
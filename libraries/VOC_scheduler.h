@@ -0,0 +1,64 @@
+//
+// Deadline scheduler for the sampling loop.
+//
+
+#ifndef VOC_SCHEDULER_H
+#define VOC_SCHEDULER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define SAMPLE_PERIOD_NS 1000000000LL
+
+/**
+ * @struct SampleScheduler
+ * @brief Absolute deadlines for the sweeps, one every period.
+ *
+ * Deadline n is epoch + n * period on the monotonic clock of the HAL, so the time spent in a sweep never shifts the
+ * following ones. The epoch is chosen on a wall-clock multiple of the alignment, so log windows made
+ * of a fixed number of ticks start on wall-clock boundaries (e.g. every 5 s at :00, :05, ...). Later
+ * wall-clock adjustments are not followed, the schedule stays on the monotonic clock.
+ */
+typedef struct {
+    int64_t epoch_mono_ns;    /**< Monotonic time of tick 0, see sensirion_i2c_hal_get_time_usec(). */
+    int64_t epoch_wall_ns;    /**< Wall-clock time of tick 0, see sensirion_i2c_hal_get_realtime_usec(). */
+    int64_t period_ns;        /**< Time between two ticks. */
+    uint64_t next_tick;       /**< Tick returned by the next scheduler_wait(). */
+    uint64_t overruns;        /**< Ticks whose deadline had already passed when waited for. */
+    uint64_t missed;          /**< Ticks skipped because their whole period had already elapsed. */
+} SampleScheduler;
+
+/**
+ * scheduler_init() - Starts a schedule whose first tick falls on the next wall-clock multiple of align_ns.
+ *
+ * @param sched Scheduler to initialize.
+ * @param period_ns Time between two ticks.
+ * @param align_ns Wall-clock alignment of tick 0, typically the length of a log window.
+ */
+void scheduler_init(SampleScheduler* sched, int64_t period_ns, int64_t align_ns);
+
+/**
+ * scheduler_wait() - Sleeps until the deadline of the next tick.
+ *
+ * The sleep uses sensirion_i2c_hal_sleep_until_usec(), so it follows the virtual clock when enabled.
+ * If the deadline has already passed, the tick is counted as an overrun and returned at once. Ticks
+ * whose whole period has elapsed are counted as missed and skipped, so the caller sees a gap in the
+ * tick numbers instead of a burst of late sweeps.
+ *
+ * @param sched Initialized scheduler.
+ *
+ * @return The tick to serve.
+ */
+uint64_t scheduler_wait(SampleScheduler* sched);
+
+/**
+ * scheduler_tick_time() - Returns the wall-clock time of a tick, in seconds.
+ *
+ * @param sched Initialized scheduler.
+ * @param tick Tick number.
+ *
+ * @return Wall-clock time of the tick deadline.
+ */
+time_t scheduler_tick_time(const SampleScheduler* sched, uint64_t tick);
+
+#endif //VOC_SCHEDULER_H
@@ -0,0 +1,141 @@
+#include "VOC_sensor_map.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @struct SensorMapEntry
+ * @brief One line of a sensor map file.
+ */
+typedef struct {
+    uint64_t sgp_serial;
+    uint32_t sht_serial;
+    BinlogSite site;
+} SensorMapEntry;
+
+int calibration_load(CalibrationTable* table, const char* path) {
+    table->count = 0;
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long serial;
+        float temperature_offset, humidity_offset;
+        char first[2];
+
+        line_number++;
+        if (sscanf(line, " %1s", first) != 1 || first[0] == '#') continue;
+        if (sscanf(line, "%llx %f %f", &serial, &temperature_offset, &humidity_offset) != 3 || serial == 0) {
+            fprintf(stderr, "%s:%d: expected \"<serial> <temperature offset> <humidity offset>\", ignored.\n", path,
+                    line_number);
+            continue;
+        }
+        if (table->count == CALIBRATION_MAX_ENTRIES) {
+            fprintf(stderr, "%s: more than %d calibrations, the rest is ignored.\n", path, CALIBRATION_MAX_ENTRIES);
+            break;
+        }
+        table->entries[table->count++] = (SensorCalibration){
+            .serial = serial,
+            .temperature_offset = temperature_offset,
+            .humidity_offset = humidity_offset,
+        };
+    }
+    fclose(file);
+    return table->count;
+}
+
+static const SensorCalibration* calibration_find_serial(const CalibrationTable* table, uint64_t serial) {
+    for (int i = 0; serial && i < table->count; i++) {
+        if (table->entries[i].serial == serial) return &table->entries[i];
+    }
+    return NULL;
+}
+
+const SensorCalibration* calibration_find(const CalibrationTable* table, const BinlogSensor* sensor) {
+    if (!table) return NULL;
+
+    const SensorCalibration* calibration = calibration_find_serial(table, sensor->sht_serial);
+    return calibration ? calibration : calibration_find_serial(table, sensor->sgp_serial);
+}
+
+static int sensor_map_load(const char* path, SensorMapEntry entries[], int max_entries) {
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+
+    char line[128];
+    int count = 0;
+    while (count < max_entries && fgets(line, sizeof(line), file)) {
+        unsigned long long sgp_serial;
+        unsigned int sht_serial, bus, mux_address, port;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%llx %x %u %x %u", &sgp_serial, &sht_serial, &bus, &mux_address, &port) != 5) continue;
+        entries[count++] = (SensorMapEntry){
+            .sgp_serial = sgp_serial,
+            .sht_serial = sht_serial,
+            .site = {.bus = bus, .mux_address = mux_address, .port = port},
+        };
+    }
+    fclose(file);
+    return count;
+}
+
+static bool sensor_map_same_site(const BinlogSite* a, const BinlogSite* b) {
+    return a->bus == b->bus && a->mux_address == b->mux_address && a->port == b->port;
+}
+
+int sensor_map_update(const char* path, const BinlogSite sites[], const BinlogSensor sensors[], int site_count) {
+    SensorMapEntry previous[LOG_RECORD_MAX_SITES];
+    int previous_count = sensor_map_load(path, previous, LOG_RECORD_MAX_SITES);
+    int differences = 0;
+
+    for (int site = 0; site < site_count; site++) {
+        uint64_t serial = sensors[site].sgp_serial;
+        const BinlogSite* s = &sites[site];
+        if (!serial) continue;
+
+        int found = -1;
+        for (int i = 0; i < previous_count && found < 0; i++) {
+            if (previous[i].sgp_serial == serial) found = i;
+        }
+        if (found < 0) {
+            printf("Sensor %012llx | new on %d_%02x_%d\n", (unsigned long long)serial, s->bus, s->mux_address,
+                   s->port);
+            differences++;
+        } else if (!sensor_map_same_site(&previous[found].site, s)) {
+            const BinlogSite* p = &previous[found].site;
+            printf("Sensor %012llx | moved from %d_%02x_%d to %d_%02x_%d\n", (unsigned long long)serial, p->bus,
+                   p->mux_address, p->port, s->bus, s->mux_address, s->port);
+            differences++;
+        }
+        if (found >= 0) previous[found].sgp_serial = 0;
+    }
+    for (int i = 0; i < previous_count; i++) {
+        const BinlogSite* p = &previous[i].site;
+        if (!previous[i].sgp_serial) continue;
+        printf("Sensor %012llx | missing, last seen on %d_%02x_%d\n", (unsigned long long)previous[i].sgp_serial,
+               p->bus, p->mux_address, p->port);
+        differences++;
+    }
+
+    // The map only feeds these reports, so it is renamed into place without a sync
+    char temp_path[256];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "w");
+    if (!file) {
+        perror("Failed to create sensor map");
+        return -1;
+    }
+    fprintf(file, "# sgp40_serial sht3x_serial bus mux port\n");
+    for (int site = 0; site < site_count; site++) {
+        if (!sensors[site].sgp_serial) continue;
+        fprintf(file, "%012llx %08x %d %02x %d\n", (unsigned long long)sensors[site].sgp_serial,
+                (unsigned)sensors[site].sht_serial, sites[site].bus, sites[site].mux_address, sites[site].port);
+    }
+    if (fclose(file) != 0 || rename(temp_path, path) != 0) {
+        perror("Failed to write sensor map");
+        remove(temp_path);
+        return -1;
+    }
+    return differences;
+}
@@ -0,0 +1,79 @@
+//
+// Identity of the sensors of every site: per-sensor calibration and the serial-to-port map kept across runs.
+//
+
+#ifndef VOC_SENSOR_MAP_H
+#define VOC_SENSOR_MAP_H
+
+#include <stdint.h>
+#include "VOC_binlog.h"
+
+#define CALIBRATION_MAX_ENTRIES (2 * LOG_RECORD_MAX_SITES)
+#define DEFAULT_CALIBRATION_FILE "../calibration.txt"
+#define DEFAULT_SENSOR_MAP_FILE "../sensor_map.txt"
+
+/**
+ * @struct SensorCalibration
+ * @brief Corrections of one sensor, applied to its raw ticks before the VOC compensation.
+ */
+typedef struct {
+    uint64_t serial;             /**< Serial number of the SHT3x, or of the SGP40 next to it. */
+    float temperature_offset;    /**< Offset in °C added to the temperature. */
+    float humidity_offset;       /**< Offset in %RH added to the humidity. */
+} SensorCalibration;
+
+/**
+ * @struct CalibrationTable
+ * @brief Calibration of every known sensor, keyed by serial number so it follows the sensor to any port.
+ *
+ * Sites look their entry up once, when their sensors are found, and keep the result as offsets in ticks,
+ * so the sweeps never search the table.
+ */
+typedef struct CalibrationTable {
+    int count;                                         /**< Number of entries. */
+    SensorCalibration entries[CALIBRATION_MAX_ENTRIES]; /**< Calibrations, in file order. */
+} CalibrationTable;
+
+/**
+ * calibration_load() - Reads a calibration file.
+ *
+ * Each line holds a serial number in hexadecimal, a temperature offset in °C and a humidity offset in
+ * %RH, separated by spaces, e.g. "0a1b2c3d -0.35 1.5". The serial number is the one of the SHT3x, or
+ * the one of the SGP40 on the same site. Empty lines and lines starting with '#' are skipped.
+ *
+ * @param table Table to fill.
+ * @param path Calibration file.
+ *
+ * @return Number of entries read, -1 if the file cannot be opened. The table is then empty.
+ */
+int calibration_load(CalibrationTable* table, const char* path);
+
+/**
+ * calibration_find() - Looks up the calibration of the sensors of a site.
+ *
+ * @param table Calibration table, may be NULL.
+ * @param sensor Serial numbers of the sensors of the site.
+ *
+ * @return Entry of the SHT3x, else of the SGP40, NULL if the table has neither.
+ */
+const SensorCalibration* calibration_find(const CalibrationTable* table, const BinlogSensor* sensor);
+
+/**
+ * sensor_map_update() - Compares the sensors found on every site with the map of the previous run,
+ * reports the differences and saves the current map.
+ *
+ * The map is a text file with one line per site holding an SGP40, "<SGP40 serial> <SHT3x serial> <bus>
+ * <mux address> <port>" in hexadecimal for the serials and the address. Every sensor that moved to
+ * another port, appeared or disappeared since the previous map is printed, so re-cabling a rig never
+ * goes unnoticed. The file is replaced through a rename, so an interrupted update keeps the old map.
+ *
+ * @param path Map file.
+ * @param sites Position of every site.
+ * @param sensors Sensors of every site.
+ * @param site_count Number of sites.
+ *
+ * @return Number of differences reported, -1 if the new map could not be written.
+ */
+int sensor_map_update(const char* path, const BinlogSite sites[], const BinlogSensor sensors[], int site_count);
+
+#endif //VOC_SENSOR_MAP_H
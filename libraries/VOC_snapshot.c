@@ -0,0 +1,156 @@
+#include "VOC_snapshot.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(SnapshotSample) == 32, "SnapshotSample must stay 32 bytes");
+_Static_assert(offsetof(SnapshotSegment, samples) % 8 == 0, "samples must be aligned");
+
+// Writers make the sequence odd, update the entry and make it even again; readers copy the entry and
+// keep the copy only if the sequence was even and unchanged around it
+static void snapshot_write_begin(_Atomic uint32_t* sequence) {
+    atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void snapshot_write_end(_Atomic uint32_t* sequence) {
+    atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static void snapshot_read(const _Atomic uint32_t* sequence, void* copy, size_t size) {
+    _Atomic uint32_t* entry = (_Atomic uint32_t*)sequence;
+
+    while (1) {
+        uint32_t begin = atomic_load_explicit(entry, memory_order_acquire);
+        if (begin & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, (const void*)sequence, size);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(entry, memory_order_relaxed) == begin) return;
+    }
+}
+
+int snapshot_create(Snapshot* snapshot, const char* name, const BinlogSite sites[], const BinlogSensor sensors[],
+                    int site_count, int oversample_count) {
+    if (site_count > SNAPSHOT_MAX_SITES) site_count = SNAPSHOT_MAX_SITES;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("Failed to create snapshot segment");
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(SnapshotSegment)) != 0) {
+        perror("Failed to size snapshot segment");
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, sizeof(SnapshotSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map snapshot segment");
+        return -1;
+    }
+
+    SnapshotSegment* segment = map;
+    memset(segment, 0, sizeof(SnapshotSegment));
+    segment->version = SNAPSHOT_VERSION;
+    segment->site_count = site_count;
+    segment->size = sizeof(SnapshotSegment);
+    segment->pid = getpid();
+    segment->oversample_count = oversample_count;
+    memcpy(segment->sites, sites, site_count * sizeof(BinlogSite));
+    memcpy(segment->sensors, sensors, site_count * sizeof(BinlogSensor));
+    segment->window.site_count = site_count;
+    atomic_thread_fence(memory_order_release);
+    memcpy(segment->magic, SNAPSHOT_MAGIC, 4);
+
+    snapshot->segment = segment;
+    snprintf(snapshot->name, sizeof(snapshot->name), "%s", name);
+    return 0;
+}
+
+void snapshot_publish_sample(SnapshotSegment* segment, int site, float temperature, float humidity, uint16_t voc,
+                             uint64_t time_usec) {
+    SnapshotSample* sample = &segment->samples[site];
+
+    snapshot_write_begin(&sample->sequence);
+    sample->count++;
+    sample->time_usec = time_usec;
+    sample->temperature = temperature;
+    sample->humidity = humidity;
+    sample->voc = voc;
+    snapshot_write_end(&sample->sequence);
+}
+
+void snapshot_publish_voc_index(SnapshotSegment* segment, int site, uint16_t voc_index) {
+    SnapshotSample* sample = &segment->samples[site];
+
+    snapshot_write_begin(&sample->sequence);
+    sample->voc_index = voc_index;
+    snapshot_write_end(&sample->sequence);
+}
+
+void snapshot_publish_window(SnapshotSegment* segment, const LogRecord* record, uint64_t time_usec) {
+    SnapshotWindow* window = &segment->window;
+    int n = record->site_count;
+    if (n > (int)window->site_count) n = window->site_count;
+
+    snapshot_write_begin(&window->sequence);
+    window->count++;
+    window->timestamp = record->timestamp;
+    window->published_usec = time_usec;
+    window->flags = record->has_voc_index ? BINLOG_FLAG_VOC_INDEX : 0;
+    memcpy(window->valid, record->valid, sizeof(window->valid));
+    memcpy(window->temperature, record->temperature, n * sizeof(float));
+    memcpy(window->humidity, record->humidity, n * sizeof(float));
+    memcpy(window->voc, record->voc, n * sizeof(uint16_t));
+    if (record->has_voc_index) memcpy(window->voc_index, record->voc_index, n * sizeof(uint16_t));
+    snapshot_write_end(&window->sequence);
+}
+
+void snapshot_destroy(Snapshot* snapshot) {
+    munmap(snapshot->segment, sizeof(SnapshotSegment));
+    shm_unlink(snapshot->name);
+    snapshot->segment = NULL;
+}
+
+const SnapshotSegment* snapshot_open(const char* name) {
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotSegment)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, sizeof(SnapshotSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const SnapshotSegment* segment = map;
+    if (memcmp(segment->magic, SNAPSHOT_MAGIC, 4) != 0 || segment->version != SNAPSHOT_VERSION ||
+        segment->size != sizeof(SnapshotSegment)) {
+        munmap(map, sizeof(SnapshotSegment));
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return segment;
+}
+
+void snapshot_close(const SnapshotSegment* segment) {
+    munmap((void*)segment, sizeof(SnapshotSegment));
+}
+
+bool snapshot_read_sample(const SnapshotSegment* segment, int site, SnapshotSample* sample) {
+    snapshot_read(&segment->samples[site].sequence, sample, sizeof(SnapshotSample));
+    return sample->count > 0;
+}
+
+bool snapshot_read_window(const SnapshotSegment* segment, SnapshotWindow* window) {
+    snapshot_read(&segment->window.sequence, window, sizeof(SnapshotWindow));
+    return window->count > 0;
+}
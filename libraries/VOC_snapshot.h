@@ -0,0 +1,179 @@
+//
+// Latest samples and window averages published in shared memory under seqlocks.
+//
+
+#ifndef VOC_SNAPSHOT_H
+#define VOC_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "VOC_binlog.h"
+#include "VOC_essentials.h"
+
+#define SNAPSHOT_MAGIC "VOCS"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_MAX_SITES LOG_RECORD_MAX_SITES
+#define DEFAULT_SNAPSHOT_NAME "/VOC_multiplexer"
+
+/**
+ * @struct SnapshotSample
+ * @brief Latest sample of one site, under its own seqlock.
+ *
+ * Each entry is written by the acquisition thread of its bus only, so entries of different buses are
+ * updated without contention and a reader retries only when it races with the update of that site.
+ */
+typedef struct {
+    _Atomic uint32_t sequence;   /**< Odd while the entry is being written. */
+    uint32_t count;              /**< Samples published for the site since the segment was created. */
+    uint64_t time_usec;          /**< Wall-clock time of the sample in microseconds since the epoch. */
+    float temperature;           /**< Temperature in °C. */
+    float humidity;              /**< Humidity in %RH, humidity offset included. */
+    uint16_t voc;                /**< Raw VOC signal in ticks. */
+    uint16_t voc_index;          /**< Latest VOC index, 0 if the algorithm is disabled or in its blackout. */
+    uint32_t reserved2;          /**< Zero. */
+} SnapshotSample;
+
+/**
+ * @struct SnapshotWindow
+ * @brief Averages of the last complete log window, under one seqlock.
+ */
+typedef struct {
+    _Atomic uint32_t sequence;                     /**< Odd while the window is being written. */
+    uint32_t site_count;                           /**< Number of sites in the arrays below. */
+    uint64_t count;                                /**< Windows published since the segment was created. */
+    int64_t timestamp;                             /**< Wall-clock time of the window start, in seconds. */
+    uint64_t published_usec;                       /**< Wall-clock time the window was published. */
+    uint32_t flags;                                /**< BINLOG_FLAG_VOC_INDEX if voc_index is filled. */
+    uint32_t reserved;                             /**< Zero. */
+    uint64_t valid[SNAPSHOT_MAX_SITES / 64];       /**< Sites with a complete window (bit n = site n). */
+    float temperature[SNAPSHOT_MAX_SITES];         /**< Average temperature of each site (°C). */
+    float humidity[SNAPSHOT_MAX_SITES];            /**< Average humidity of each site (%RH). */
+    uint16_t voc[SNAPSHOT_MAX_SITES];              /**< Average raw VOC signal of each site (ticks). */
+    uint16_t voc_index[SNAPSHOT_MAX_SITES];        /**< Average VOC index of each site. */
+} SnapshotWindow;
+
+/**
+ * @struct SnapshotSegment
+ * @brief Layout of the shared memory segment, identical in every process.
+ *
+ * The header, site and sensor tables are written once before magic, and never change afterwards. Readers map
+ * the segment read-only and use snapshot_read_sample() and snapshot_read_window(), which never block
+ * the acquisition: a reader that races with a write copies the entry again.
+ */
+typedef struct SnapshotSegment {
+    char magic[4];                                 /**< SNAPSHOT_MAGIC, written last. */
+    uint16_t version;                              /**< SNAPSHOT_VERSION. */
+    uint16_t site_count;                           /**< Number of sites in the tables below. */
+    uint32_t size;                                 /**< Size of the segment. */
+    int32_t pid;                                   /**< Process publishing the segment. */
+    uint16_t oversample_count;                     /**< Samples averaged per window. */
+    uint16_t reserved[3];                          /**< Zero. */
+    BinlogSite sites[SNAPSHOT_MAX_SITES];          /**< Position of each site, in log column order. */
+    BinlogSensor sensors[SNAPSHOT_MAX_SITES];      /**< Sensors found on each site at startup. */
+    SnapshotSample samples[SNAPSHOT_MAX_SITES];    /**< Latest sample of each site. */
+    SnapshotWindow window;                         /**< Last complete window. */
+} SnapshotSegment;
+
+/**
+ * @struct Snapshot
+ * @brief Segment created by the acquisition process.
+ */
+typedef struct {
+    SnapshotSegment* segment;    /**< Mapped segment. */
+    char name[64];               /**< POSIX shared memory name of the segment. */
+} Snapshot;
+
+/**
+ * snapshot_create() - Creates, or takes over, the shared memory segment and publishes the site table.
+ *
+ * @param snapshot Snapshot to initialize.
+ * @param name POSIX shared memory name, starting with '/'.
+ * @param sites Site table, in log column order.
+ * @param sensors Sensors of each site.
+ * @param site_count Number of entries in sites, at most SNAPSHOT_MAX_SITES.
+ * @param oversample_count Samples averaged per window.
+ *
+ * @return 0 on success, -1 if the segment could not be created or mapped.
+ */
+int snapshot_create(Snapshot* snapshot, const char* name, const BinlogSite sites[], const BinlogSensor sensors[],
+                    int site_count, int oversample_count);
+
+/**
+ * snapshot_publish_sample() - Publishes the latest sample of a site.
+ *
+ * @param segment Segment of a created snapshot.
+ * @param site Site index in the site table.
+ * @param temperature Temperature in °C.
+ * @param humidity Humidity in %RH.
+ * @param voc Raw VOC signal in ticks.
+ * @param time_usec Wall-clock time of the sample in microseconds.
+ */
+void snapshot_publish_sample(SnapshotSegment* segment, int site, float temperature, float humidity, uint16_t voc,
+                             uint64_t time_usec);
+
+/**
+ * snapshot_publish_voc_index() - Publishes the VOC index computed from the latest sample of a site.
+ *
+ * @param segment Segment of a created snapshot.
+ * @param site Site index in the site table.
+ * @param voc_index VOC index.
+ */
+void snapshot_publish_voc_index(SnapshotSegment* segment, int site, uint16_t voc_index);
+
+/**
+ * snapshot_publish_window() - Publishes the averages of a complete log window.
+ *
+ * @param segment Segment of a created snapshot.
+ * @param record Averages from finalize_record().
+ * @param time_usec Wall-clock time of the publication in microseconds.
+ */
+void snapshot_publish_window(SnapshotSegment* segment, const LogRecord* record, uint64_t time_usec);
+
+/**
+ * snapshot_destroy() - Unmaps and removes the shared memory segment.
+ *
+ * Readers keep their mapping, with the last values published.
+ *
+ * @param snapshot Created snapshot.
+ */
+void snapshot_destroy(Snapshot* snapshot);
+
+/**
+ * snapshot_open() - Maps the segment of a running acquisition for reading.
+ *
+ * @param name POSIX shared memory name of the segment.
+ *
+ * @return Read-only mapping of the segment, NULL if it does not exist or is not a snapshot segment.
+ */
+const SnapshotSegment* snapshot_open(const char* name);
+
+/**
+ * snapshot_close() - Unmaps a segment returned by snapshot_open().
+ *
+ * @param segment Mapped segment.
+ */
+void snapshot_close(const SnapshotSegment* segment);
+
+/**
+ * snapshot_read_sample() - Copies a consistent view of the latest sample of a site.
+ *
+ * @param segment Mapped segment.
+ * @param site Site index, below segment->site_count.
+ * @param sample Copy of the sample.
+ *
+ * @return true if the site has a sample, false if none was published yet.
+ */
+bool snapshot_read_sample(const SnapshotSegment* segment, int site, SnapshotSample* sample);
+
+/**
+ * snapshot_read_window() - Copies a consistent view of the last complete window.
+ *
+ * @param segment Mapped segment.
+ * @param window Copy of the window.
+ *
+ * @return true if a window was published, false otherwise.
+ */
+bool snapshot_read_window(const SnapshotSegment* segment, SnapshotWindow* window);
+
+#endif //VOC_SNAPSHOT_H
@@ -0,0 +1,476 @@
+#include "VOC_tslog.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The compressed log format requires a little-endian host"
+#endif
+
+#define TSLOG_ALIGN(size) (((size) + 7) & ~(size_t)7)
+#define TSLOG_VALUES 4          // Temperature, humidity, VOC and VOC index of a site
+#define TSLOG_RAW_BITS 16       // First value of a site in a block
+#define TSLOG_WIDTH_BITS 5      // Width of the deltas, up to 17 bits
+#define TSLOG_SHRINK_AFTER 16   // Narrower deltas in a row before the width is reduced by one bit
+
+_Static_assert(sizeof(TslogHeader) == 32, "TslogHeader must stay 32 bytes");
+_Static_assert(offsetof(TslogHeader, flags) == TSLOG_V1_HEADER_SIZE, "version 1 headers end before flags");
+_Static_assert(sizeof(TslogBlockHeader) == 24, "TslogBlockHeader must stay 24 bytes");
+
+// Worst case of one record: the longest timestamp code, a new presence bitmap and a new width for every value
+#define TSLOG_RECORD_MAX_BITS(site_count) \
+    (4 + 64 + 1 + (size_t)(site_count) + (size_t)(site_count) * TSLOG_VALUES * (2 + TSLOG_WIDTH_BITS + 17))
+
+// Bytes of a block holding bits of stream
+#define TSLOG_BLOCK_BYTES(bits) (sizeof(TslogBlockHeader) + TSLOG_ALIGN(((size_t)(bits) + 7) / 8))
+
+_Static_assert(TSLOG_BLOCK_BYTES(TSLOG_RECORD_MAX_BITS(LOG_RECORD_MAX_SITES)) <= TSLOG_MAX_BLOCK_SIZE,
+               "a block must hold at least one record");
+
+static uint64_t tslog_zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t tslog_unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int tslog_bit_width(uint64_t value) {
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+static bool tslog_test(const uint64_t* bitmap, int site) {
+    return bitmap[site / 64] & ((uint64_t)1 << (site % 64));
+}
+
+// Appends the count low bits of value to the stream, most significant first
+static void tslog_put(TslogEncoder* encoder, uint64_t value, int count) {
+    uint8_t* stream = encoder->block + sizeof(TslogBlockHeader);
+
+    while (count > 0) {
+        int free_bits = 8 - (encoder->bits & 7);
+        int take = count < free_bits ? count : free_bits;
+        uint8_t chunk = (value >> (count - take)) & ((1u << take) - 1);
+        stream[encoder->bits >> 3] |= chunk << (free_bits - take);
+        encoder->bits += take;
+        count -= take;
+    }
+}
+
+int tslog_write_header(FILE* logfile, const BinlogSite sites[], const BinlogSensor sensors[], int site_count,
+                       int oversample_count, int block_records, uint32_t flags) {
+    flags = sensors ? flags | BINLOG_FLAG_SENSORS : flags & ~BINLOG_FLAG_SENSORS;
+    TslogHeader header = {
+        .magic = {TSLOG_MAGIC[0], TSLOG_MAGIC[1], TSLOG_MAGIC[2], TSLOG_MAGIC[3]},
+        .version = TSLOG_VERSION,
+        .header_size = binlog_tables_size(sizeof(TslogHeader), site_count, flags),
+        .site_count = site_count,
+        .oversample_count = oversample_count,
+        .temperature_scale = BINLOG_TEMPERATURE_SCALE,
+        .humidity_scale = BINLOG_HUMIDITY_SCALE,
+        .block_records = block_records,
+        .time_unit_ns = TSLOG_TIME_UNIT_NS,
+        .flags = flags,
+    };
+
+    if (fwrite(&header, sizeof(header), 1, logfile) != 1) return -1;
+    return binlog_write_tables(logfile, sizeof(header), sites, sensors, site_count);
+}
+
+int tslog_encoder_init(TslogEncoder* encoder, int site_count, int block_records) {
+    encoder->site_count = site_count;
+    encoder->block_records = block_records;
+    encoder->capacity = TSLOG_BLOCK_BYTES(block_records * TSLOG_RECORD_MAX_BITS(site_count));
+    if (encoder->capacity > TSLOG_MAX_BLOCK_SIZE) encoder->capacity = TSLOG_MAX_BLOCK_SIZE;
+    encoder->block = calloc(1, encoder->capacity);
+    if (!encoder->block) {
+        perror("Failed to allocate log block");
+        return -1;
+    }
+    encoder->bits = 0;
+    encoder->record_count = 0;
+    return 0;
+}
+
+// Clears the block written last and the state, so the new block decodes on its own
+static void tslog_begin_block(TslogEncoder* encoder, int64_t timestamp) {
+    memset(encoder->block, 0, TSLOG_BLOCK_BYTES(encoder->bits));
+    encoder->bits = 0;
+    encoder->last_timestamp = timestamp;
+    encoder->last_delta = 0;
+    memset(encoder->last_valid, 0, sizeof(encoder->last_valid));
+    memset(encoder->seen, 0, sizeof(encoder->seen));
+    memset(encoder->width, 0, sizeof(encoder->width));
+    memset(encoder->narrow, 0, sizeof(encoder->narrow));
+
+    TslogBlockHeader* header = (TslogBlockHeader*)encoder->block;
+    header->first_timestamp = timestamp;
+}
+
+// '0' for a steady interval, then '10', '110', '1110' and '1111' for 7, 12, 20 and 64 bit zigzag values
+static void tslog_put_timestamp(TslogEncoder* encoder, int64_t timestamp) {
+    int64_t delta = timestamp - encoder->last_timestamp;
+    uint64_t dod = tslog_zigzag(delta - encoder->last_delta);
+
+    if (dod == 0) {
+        tslog_put(encoder, 0, 1);
+    } else if (dod < (1 << 7)) {
+        tslog_put(encoder, 0x2, 2);
+        tslog_put(encoder, dod, 7);
+    } else if (dod < (1 << 12)) {
+        tslog_put(encoder, 0x6, 3);
+        tslog_put(encoder, dod, 12);
+    } else if (dod < (1 << 20)) {
+        tslog_put(encoder, 0xe, 4);
+        tslog_put(encoder, dod, 20);
+    } else {
+        tslog_put(encoder, 0xf, 4);
+        tslog_put(encoder, dod, 64);
+    }
+    encoder->last_timestamp = timestamp;
+    encoder->last_delta = delta;
+}
+
+// '0' for an unchanged value, '10' + width bits, or '11' + a new width + the delta in that width
+static void tslog_put_value(TslogEncoder* encoder, int kind, int site, int32_t value) {
+    uint64_t delta = tslog_zigzag(value - encoder->last_value[kind][site]);
+    int needed = tslog_bit_width(delta);
+    int width = encoder->width[kind][site];
+
+    encoder->last_value[kind][site] = value;
+    if (needed < width) {
+        encoder->narrow[kind][site]++;
+    } else {
+        encoder->narrow[kind][site] = 0;
+    }
+
+    if (delta == 0 && encoder->narrow[kind][site] < TSLOG_SHRINK_AFTER) {
+        tslog_put(encoder, 0, 1);
+        return;
+    }
+    if (needed <= width && encoder->narrow[kind][site] < TSLOG_SHRINK_AFTER) {
+        tslog_put(encoder, 0x2, 2);
+        tslog_put(encoder, delta, width);
+        return;
+    }
+
+    width = needed > width ? needed : width - 1;
+    tslog_put(encoder, 0x3, 2);
+    tslog_put(encoder, width, TSLOG_WIDTH_BITS);
+    tslog_put(encoder, delta, width);
+    encoder->width[kind][site] = width;
+    encoder->narrow[kind][site] = 0;
+}
+
+size_t tslog_encoder_append(TslogEncoder* encoder, const LogRecord* record) {
+    int n = encoder->site_count;
+    int words = (n + 63) / 64;
+    int kinds = record->has_voc_index ? 4 : 3;
+    int64_t timestamp = (int64_t)record->timestamp * 1000000000 / TSLOG_TIME_UNIT_NS;
+
+    if (encoder->record_count == 0) {
+        tslog_begin_block(encoder, timestamp);
+    } else {
+        tslog_put_timestamp(encoder, timestamp);
+    }
+
+    if (memcmp(record->valid, encoder->last_valid, words * sizeof(uint64_t)) == 0) {
+        tslog_put(encoder, 0, 1);
+    } else {
+        tslog_put(encoder, 1, 1);
+        for (int word = 0; word < words; word++) {
+            int count = n - 64 * word < 64 ? n - 64 * word : 64;
+            tslog_put(encoder, record->valid[word], count);
+            encoder->last_valid[word] = record->valid[word];
+        }
+    }
+
+    for (int site = 0; site < n; site++) {
+        if (!tslog_test(record->valid, site)) continue;
+        int32_t values[TSLOG_VALUES] = {
+            binlog_scale(record->temperature[site], BINLOG_TEMPERATURE_SCALE),
+            binlog_scale(record->humidity[site], BINLOG_HUMIDITY_SCALE),
+            record->voc[site],
+            record->has_voc_index ? record->voc_index[site] : 0,
+        };
+
+        if (!tslog_test(encoder->seen, site)) {
+            encoder->seen[site / 64] |= (uint64_t)1 << (site % 64);
+            for (int kind = 0; kind < kinds; kind++) {
+                tslog_put(encoder, (uint16_t)values[kind], TSLOG_RAW_BITS);
+                encoder->last_value[kind][site] = values[kind];
+            }
+            continue;
+        }
+        for (int kind = 0; kind < kinds; kind++) {
+            tslog_put_value(encoder, kind, site, values[kind]);
+        }
+    }
+
+    ((TslogBlockHeader*)encoder->block)->last_timestamp = timestamp;
+    if (++encoder->record_count < encoder->block_records &&
+        TSLOG_BLOCK_BYTES(encoder->bits + TSLOG_RECORD_MAX_BITS(n)) <= TSLOG_MAX_BLOCK_SIZE) {
+        return 0;
+    }
+    return tslog_encoder_flush(encoder);
+}
+
+size_t tslog_encoder_flush(TslogEncoder* encoder) {
+    if (encoder->record_count == 0) return 0;
+
+    TslogBlockHeader* header = (TslogBlockHeader*)encoder->block;
+    header->size = (encoder->bits + 7) / 8;
+    header->record_count = encoder->record_count;
+    encoder->record_count = 0;
+    return TSLOG_BLOCK_BYTES(encoder->bits);
+}
+
+void tslog_encoder_free(TslogEncoder* encoder) {
+    free(encoder->block);
+    encoder->block = NULL;
+}
+
+int tslog_open(TslogReader* reader, const char* path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < TSLOG_V1_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    reader->map = map;
+    reader->size = st.st_size;
+    reader->header = map;
+    reader->blocks = NULL;
+    reader->block_count = 0;
+    reader->record_count = 0;
+    reader->skipped = 0;
+    reader->corrupt = false;
+
+    // Version 1 headers stop before flags, and the site table follows them
+    const TslogHeader* header = reader->header;
+    bool v1 = header->version == 1;
+    size_t fixed_size = v1 ? TSLOG_V1_HEADER_SIZE : sizeof(TslogHeader);
+    if (memcmp(header->magic, TSLOG_MAGIC, 4) != 0 || (!v1 && header->version != TSLOG_VERSION) ||
+        header->header_size > reader->size || header->site_count > LOG_RECORD_MAX_SITES ||
+        header->block_records == 0 || header->block_records > TSLOG_MAX_BLOCK_RECORDS ||
+        header->time_unit_ns == 0 || (!v1 && (header->flags & ~(BINLOG_FLAG_VOC_INDEX | BINLOG_FLAG_SENSORS))) ||
+        header->header_size < binlog_tables_size(fixed_size, header->site_count, v1 ? 0 : header->flags)) {
+        tslog_close(reader);
+        return -1;
+    }
+    reader->sites = (const BinlogSite*)(reader->map + fixed_size);
+    reader->flags = v1 ? 0 : header->flags;
+    reader->sensors = binlog_sensor_table(reader->map, fixed_size, header->site_count, reader->flags);
+
+    // Blocks are chained by their sizes, the scan stops at the first incomplete one
+    size_t capacity = 0;
+    size_t offset = header->header_size;
+    while (offset + sizeof(TslogBlockHeader) <= reader->size) {
+        const TslogBlockHeader* block = (const TslogBlockHeader*)(reader->map + offset);
+        size_t end = offset + sizeof(TslogBlockHeader) + TSLOG_ALIGN((size_t)block->size);
+        if (block->record_count == 0 || block->record_count > header->block_records ||
+            block->first_timestamp > block->last_timestamp ||
+            block->size > (block->record_count * TSLOG_RECORD_MAX_BITS(header->site_count) + 7) / 8) {
+            reader->corrupt = true;
+            break;
+        }
+        if (end > reader->size) break;
+
+        if (reader->block_count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            size_t* blocks = realloc(reader->blocks, capacity * sizeof(size_t));
+            if (!blocks) {
+                tslog_close(reader);
+                return -1;
+            }
+            reader->blocks = blocks;
+        }
+        reader->blocks[reader->block_count++] = offset;
+        reader->record_count += block->record_count;
+        offset = end;
+    }
+    reader->skipped = reader->size - offset;
+    return 0;
+}
+
+void tslog_close(TslogReader* reader) {
+    if (reader->map) munmap((void*)reader->map, reader->size);
+    reader->map = NULL;
+    free(reader->blocks);
+    reader->blocks = NULL;
+}
+
+const TslogBlockHeader* tslog_block_header(const TslogReader* reader, size_t block) {
+    return (const TslogBlockHeader*)(reader->map + reader->blocks[block]);
+}
+
+size_t tslog_find_block(const TslogReader* reader, int64_t timestamp_ns) {
+    int64_t timestamp = timestamp_ns / reader->header->time_unit_ns;
+    size_t low = 0;
+    size_t high = reader->block_count;
+
+    // First block starting after timestamp, the one before it holds timestamp
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (tslog_block_header(reader, mid)->first_timestamp <= timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low ? low - 1 : 0;
+}
+
+/**
+ * @struct TslogBits
+ * @brief Read position in the bit stream of a block.
+ */
+typedef struct {
+    const uint8_t* stream;
+    uint64_t pos;
+    uint64_t end;
+    bool overrun;
+} TslogBits;
+
+static uint64_t tslog_get(TslogBits* bits, int count) {
+    uint64_t value = 0;
+
+    if (bits->pos + count > bits->end) {
+        bits->overrun = true;
+        return 0;
+    }
+    while (count > 0) {
+        int left = 8 - (bits->pos & 7);
+        int take = count < left ? count : left;
+        uint8_t byte = bits->stream[bits->pos >> 3];
+        value = (value << take) | ((byte >> (left - take)) & ((1u << take) - 1));
+        bits->pos += take;
+        count -= take;
+    }
+    return value;
+}
+
+// Reads the 1 bits of a prefix code, up to max of them
+static int tslog_get_prefix(TslogBits* bits, int max) {
+    int ones = 0;
+    while (ones < max && tslog_get(bits, 1)) ones++;
+    return ones;
+}
+
+int tslog_decode_block(const TslogReader* reader, size_t block, LogRecord records[]) {
+    static const int timestamp_bits[] = {0, 7, 12, 20, 64};
+    const TslogBlockHeader* header = tslog_block_header(reader, block);
+    int n = reader->header->site_count;
+    int words = (n + 63) / 64;
+    int kinds = (reader->flags & BINLOG_FLAG_VOC_INDEX) ? 4 : 3;
+    float scales[2] = {reader->header->temperature_scale, reader->header->humidity_scale};
+    int32_t last_value[TSLOG_VALUES][LOG_RECORD_MAX_SITES];
+    uint8_t width[TSLOG_VALUES][LOG_RECORD_MAX_SITES] = {{0}};
+    uint64_t valid[LOG_RECORD_MAX_SITES / 64] = {0};
+    uint64_t seen[LOG_RECORD_MAX_SITES / 64] = {0};
+    TslogBits bits = {
+        .stream = (const uint8_t*)(header + 1),
+        .end = (uint64_t)header->size * 8,
+    };
+    int64_t timestamp = header->first_timestamp;
+    int64_t delta = 0;
+
+    for (int i = 0; i < header->record_count; i++) {
+        LogRecord* record = &records[i];
+
+        if (i > 0) {
+            int code = tslog_get_prefix(&bits, 4);
+            delta += tslog_unzigzag(tslog_get(&bits, timestamp_bits[code]));
+            timestamp += delta;
+        }
+        record->timestamp = (time_t)(timestamp * reader->header->time_unit_ns / 1000000000);
+        record->site_count = n;
+        record->has_voc_index = kinds == 4;
+
+        if (tslog_get(&bits, 1)) {
+            for (int word = 0; word < words; word++) {
+                int count = n - 64 * word < 64 ? n - 64 * word : 64;
+                valid[word] = tslog_get(&bits, count);
+            }
+        }
+        memcpy(record->valid, valid, words * sizeof(uint64_t));
+
+        for (int site = 0; site < n; site++) {
+            if (!tslog_test(valid, site)) {
+                record->temperature[site] = NAN;
+                record->humidity[site] = NAN;
+                record->voc[site] = 0;
+                record->voc_index[site] = 0;
+                continue;
+            }
+
+            int32_t values[TSLOG_VALUES];
+            for (int kind = 0; kind < kinds; kind++) {
+                if (!tslog_test(seen, site)) {
+                    uint16_t raw = tslog_get(&bits, TSLOG_RAW_BITS);
+                    values[kind] = kind >= 2 ? raw : (int16_t)raw;
+                } else if (tslog_get(&bits, 1) == 0) {
+                    values[kind] = last_value[kind][site];
+                } else {
+                    if (tslog_get(&bits, 1)) width[kind][site] = tslog_get(&bits, TSLOG_WIDTH_BITS);
+                    values[kind] = last_value[kind][site] + tslog_unzigzag(tslog_get(&bits, width[kind][site]));
+                }
+                last_value[kind][site] = values[kind];
+            }
+            seen[site / 64] |= (uint64_t)1 << (site % 64);
+
+            record->temperature[site] = values[0] / scales[0];
+            record->humidity[site] = values[1] / scales[1];
+            record->voc[site] = values[2];
+            record->voc_index[site] = kinds == 4 ? values[3] : 0;
+        }
+        if (bits.overrun) return -1;
+    }
+    return header->record_count;
+}
+
+int tslog_write_csv(const TslogReader* reader, FILE* out) {
+    int site_count = reader->header->site_count;
+    bool voc_index = reader->flags & BINLOG_FLAG_VOC_INDEX;
+    LogRecord* records = malloc(reader->header->block_records * sizeof(LogRecord));
+    if (!records) return -1;
+
+    binlog_write_csv_header(out, reader->sites, reader->sensors, site_count, voc_index, false);
+    for (size_t block = 0; block < reader->block_count; block++) {
+        int count = tslog_decode_block(reader, block, records);
+        if (count < 0) {
+            free(records);
+            return -1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            char timestamp[32];
+            struct tm tm;
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", localtime_r(&records[i].timestamp, &tm));
+            fprintf(out, "%s", timestamp);
+
+            for (int site = 0; site < site_count; site++) {
+                if (tslog_test(records[i].valid, site)) {
+                    fprintf(out, ",%.2f,%.2f,%u", records[i].temperature[site], records[i].humidity[site],
+                            records[i].voc[site]);
+                    if (voc_index) fprintf(out, ",%u", records[i].voc_index[site]);
+                } else {
+                    fprintf(out, voc_index ? ",NaN,NaN,NaN,NaN" : ",NaN,NaN,NaN");
+                }
+            }
+            fprintf(out, "\n");
+        }
+    }
+    free(records);
+    return ferror(out) ? -1 : 0;
+}
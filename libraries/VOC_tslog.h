@@ -0,0 +1,228 @@
+//
+// Compressed log format: blocks of delta-of-delta timestamps and delta encoded values.
+//
+
+#ifndef VOC_TSLOG_H
+#define VOC_TSLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "VOC_binlog.h"
+#include "VOC_essentials.h"
+
+#define TSLOG_MAGIC "VOCZ"
+#define TSLOG_VERSION 2
+#define TSLOG_V1_HEADER_SIZE 24       /**< Size of the header of version 1, which has no flags. */
+#define TSLOG_TIME_UNIT_NS 1000000000  /**< Records start on whole seconds. */
+#define TSLOG_MAX_BLOCK_RECORDS 4096
+#define TSLOG_MAX_BLOCK_SIZE (32 * 1024)  /**< Most bytes of a block, header included, so it fits the log sink buffer. */
+#define DEFAULT_LOG_BLOCK_RECORDS 60
+
+/**
+ * @struct TslogHeader
+ * @brief Start of a compressed log file, followed by the site and sensor tables of BinlogHeader.
+ *
+ * All fields are little-endian. header_size is a multiple of 8 and so is every block, so block headers
+ * are aligned in a mapped file. Version 1 headers end before flags and are read with flags of zero.
+ */
+typedef struct {
+    char magic[4];               /**< TSLOG_MAGIC. */
+    uint16_t version;            /**< TSLOG_VERSION. */
+    uint16_t header_size;        /**< Bytes before the first block, site table and padding included. */
+    uint16_t site_count;         /**< Number of sites in every record. */
+    uint16_t oversample_count;   /**< Samples averaged per record. */
+    uint16_t temperature_scale;  /**< Counts per °C of the temperatures. */
+    uint16_t humidity_scale;     /**< Counts per %RH of the humidities. */
+    uint32_t block_records;      /**< Most records in one block, fewer when TSLOG_MAX_BLOCK_SIZE is reached. */
+    uint32_t time_unit_ns;       /**< Nanoseconds per timestamp unit. */
+    uint32_t flags;              /**< BINLOG_FLAG_* bits: with BINLOG_FLAG_VOC_INDEX, sites have a 4th value. */
+    uint32_t reserved;           /**< Zero. */
+} TslogHeader;
+
+/**
+ * @struct TslogBlockHeader
+ * @brief Start of a block, followed by size bytes of bit stream padded to a multiple of 8.
+ *
+ * A block is decoded without any state from the blocks before it, and the bounds of its timestamps are
+ * stored in clear so a reader finds the blocks of a time range without decoding the others.
+ */
+typedef struct {
+    uint32_t size;               /**< Bytes of bit stream, padding excluded. */
+    uint16_t record_count;       /**< Records in the block, at least 1. */
+    uint16_t reserved;           /**< Zero. */
+    int64_t first_timestamp;     /**< Timestamp of the first record, in time units. */
+    int64_t last_timestamp;      /**< Timestamp of the last record, in time units. */
+} TslogBlockHeader;
+
+/**
+ * @struct TslogEncoder
+ * @brief Streaming encoder collecting records into the current block.
+ *
+ * Every record is appended to the bit stream of the block as it arrives:
+ *  - the timestamp as the difference between its delta and the previous delta, which is 0 for a steady
+ *    log window and takes a single bit;
+ *  - the presence bitmap, as a single bit when it did not change;
+ *  - for every valid site, the difference of each scaled value with the last value of that site (VOC
+ *    index included when the record has one), zigzag
+ *    encoded in a bit width kept per site and value, which follows the noise of the sensor: a single bit
+ *    when the value did not change, 2 + width bits usually, and 7 + width bits when the width changes.
+ *
+ * The state is reset at every block, so the first values of a block cost 16 bits each. A block is completed
+ * before block_records when one more record could take it past TSLOG_MAX_BLOCK_SIZE.
+ */
+typedef struct {
+    int site_count;                                /**< Number of sites in every record. */
+    uint32_t block_records;                        /**< Most records per block. */
+    uint8_t* block;                                /**< Block header and bit stream. */
+    size_t capacity;                               /**< Size of block, for a full block in the worst case. */
+    uint64_t bits;                                 /**< Bits written to the stream. */
+    uint32_t record_count;                         /**< Records in the current block. */
+    int64_t last_timestamp;                        /**< Timestamp of the last record. */
+    int64_t last_delta;                            /**< Difference of the last two timestamps. */
+    uint64_t last_valid[LOG_RECORD_MAX_SITES / 64]; /**< Presence bitmap of the last record. */
+    uint64_t seen[LOG_RECORD_MAX_SITES / 64];      /**< Sites with a value earlier in the block. */
+    int32_t last_value[4][LOG_RECORD_MAX_SITES];   /**< Last temperature, humidity, VOC and VOC index of each site. */
+    uint8_t width[4][LOG_RECORD_MAX_SITES];        /**< Current width of the deltas of each site and value. */
+    uint8_t narrow[4][LOG_RECORD_MAX_SITES];       /**< Consecutive deltas narrower than the width. */
+} TslogEncoder;
+
+/**
+ * @struct TslogReader
+ * @brief Compressed log file mapped in memory, with an index of its blocks.
+ */
+typedef struct {
+    const uint8_t* map;          /**< Mapped file. */
+    size_t size;                 /**< Size of the mapping. */
+    const TslogHeader* header;   /**< Header at the start of the mapping. */
+    const BinlogSite* sites;     /**< Site table following the header. */
+    const BinlogSensor* sensors; /**< Sensor table following the site table, NULL without BINLOG_FLAG_SENSORS. */
+    uint32_t flags;              /**< Flags of the header, zero for version 1. */
+    size_t* blocks;              /**< Offset of every complete block. */
+    size_t block_count;          /**< Complete blocks in the file. */
+    size_t record_count;         /**< Records in the complete blocks. */
+    size_t skipped;              /**< Bytes after the last complete block, not decoded. */
+    bool corrupt;                /**< The skipped bytes start with an invalid block rather than a truncated one. */
+} TslogReader;
+
+/**
+ * tslog_write_header() - Writes the header and site table of a new compressed log.
+ *
+ * @param logfile Empty file opened for writing.
+ * @param sites Site table, one entry per site of the records.
+ * @param sensors Identity of the sensors of each site, NULL for none.
+ * @param site_count Number of entries in sites, at most LOG_RECORD_MAX_SITES.
+ * @param oversample_count Samples averaged per record.
+ * @param block_records Records per block, at most TSLOG_MAX_BLOCK_RECORDS.
+ * @param flags BINLOG_FLAG_VOC_INDEX if the records have VOC indices, 0 otherwise. BINLOG_FLAG_SENSORS
+ * follows sensors.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tslog_write_header(FILE* logfile, const BinlogSite sites[], const BinlogSensor sensors[], int site_count,
+                       int oversample_count, int block_records, uint32_t flags);
+
+/**
+ * tslog_encoder_init() - Allocates the block of an encoder.
+ *
+ * @param encoder Encoder to initialize.
+ * @param site_count Number of sites in every record.
+ * @param block_records Records per block, at most TSLOG_MAX_BLOCK_RECORDS.
+ *
+ * @return 0 on success, -1 if the block could not be allocated.
+ */
+int tslog_encoder_init(TslogEncoder* encoder, int site_count, int block_records);
+
+/**
+ * tslog_encoder_append() - Appends a record to the current block.
+ *
+ * @param encoder Initialized encoder.
+ * @param record Record to append, with the site_count of the encoder. Its has_voc_index must match the flags
+ *        of the header.
+ *
+ * @return Size of the block to write when the record completed it, 0 otherwise. The block is read from
+ *         encoder->block and stays valid until the next call.
+ */
+size_t tslog_encoder_append(TslogEncoder* encoder, const LogRecord* record);
+
+/**
+ * tslog_encoder_flush() - Completes the current block, even if it is not full.
+ *
+ * @param encoder Initialized encoder.
+ *
+ * @return Size of the block to write from encoder->block, 0 if it holds no record.
+ */
+size_t tslog_encoder_flush(TslogEncoder* encoder);
+
+/**
+ * tslog_encoder_free() - Releases the block of an encoder, records not flushed are lost.
+ *
+ * @param encoder Initialized encoder.
+ */
+void tslog_encoder_free(TslogEncoder* encoder);
+
+/**
+ * tslog_open() - Maps a compressed log file and indexes its blocks.
+ *
+ * The scan of the blocks stops at the first one that is truncated or invalid, and the bytes from there on
+ * are counted in reader->skipped. A block truncated by the end of the file is the one being written, or the
+ * last one of a run that was killed. reader->corrupt is set otherwise: the header of the block is invalid,
+ * and the records after it are lost.
+ *
+ * @param reader Reader to initialize.
+ * @param path Path of the compressed log.
+ *
+ * @return 0 on success, -1 if the file cannot be mapped or is not a compressed log.
+ */
+int tslog_open(TslogReader* reader, const char* path);
+
+/**
+ * tslog_close() - Unmaps a compressed log and frees its index.
+ *
+ * @param reader Open reader.
+ */
+void tslog_close(TslogReader* reader);
+
+/**
+ * tslog_block_header() - Returns the header of a block.
+ *
+ * @param reader Open reader.
+ * @param block Block index, below reader->block_count.
+ *
+ * @return Header of the block, inside the mapping.
+ */
+const TslogBlockHeader* tslog_block_header(const TslogReader* reader, size_t block);
+
+/**
+ * tslog_find_block() - Finds the block holding a time, by binary search on the block headers.
+ *
+ * @param reader Open reader.
+ * @param timestamp_ns Wall-clock time in nanoseconds since the epoch.
+ *
+ * @return Index of the last block starting at or before timestamp_ns, 0 if every block starts after it.
+ */
+size_t tslog_find_block(const TslogReader* reader, int64_t timestamp_ns);
+
+/**
+ * tslog_decode_block() - Decodes all records of one block.
+ *
+ * @param reader Open reader.
+ * @param block Block index, below reader->block_count.
+ * @param records Destination, room for header->block_records records.
+ *
+ * @return Number of records decoded, -1 if the block is corrupted.
+ */
+int tslog_decode_block(const TslogReader* reader, size_t block, LogRecord records[]);
+
+/**
+ * tslog_write_csv() - Converts a compressed log to the CSV format of the acquisition program.
+ *
+ * @param reader Open reader.
+ * @param out Destination of the CSV text, header line included.
+ *
+ * @return 0 on success, -1 on write error or corrupted block.
+ */
+int tslog_write_csv(const TslogReader* reader, FILE* out);
+
+#endif //VOC_TSLOG_H
@@ -0,0 +1,51 @@
+#include "VOC_window_filter.h"
+
+// Ratio of the standard deviation of normal noise to its median absolute deviation
+#define WINDOW_FILTER_MAD_SCALE 1.4826f
+
+void window_filter_insert(float sorted[], int count, float sample) {
+    int i = count;
+
+    while (i > 0 && sorted[i - 1] > sample) {
+        sorted[i] = sorted[i - 1];
+        i--;
+    }
+    sorted[i] = sample;
+}
+
+void window_filter_apply(const float sorted[], int count, float threshold, float resolution,
+                         WindowFilterResult* result) {
+    int mid = (count - 1) / 2;
+    float median = (sorted[mid] + sorted[count / 2]) * 0.5f;
+
+    // The deviations grow away from the middle on both sides, so merging the two sides walks them in
+    // ascending order and their median needs no sort
+    int lo = mid, hi = mid + 1;
+    float mad_lo = 0.f, mad_hi = 0.f;
+    for (int k = 0; k <= count / 2; k++) {
+        float deviation;
+        if (hi >= count || (lo >= 0 && median - sorted[lo] <= sorted[hi] - median)) {
+            deviation = median - sorted[lo--];
+        } else {
+            deviation = sorted[hi++] - median;
+        }
+        if (k == mid) mad_lo = deviation;
+        if (k == count / 2) mad_hi = deviation;
+    }
+    float mad = (mad_lo + mad_hi) * 0.5f;
+    if (mad < resolution) mad = resolution;
+    float limit = threshold * WINDOW_FILTER_MAD_SCALE * mad;
+
+    // The samples kept are a contiguous run of the sorted window around the median
+    int first = 0, last = count - 1;
+    while (median - sorted[first] > limit) first++;
+    while (sorted[last] - median > limit) last--;
+    float sum = 0.f;
+    for (int i = first; i <= last; i++) {
+        sum += sorted[i];
+    }
+
+    result->median = median;
+    result->mean = sum / (last - first + 1);
+    result->outliers = count - (last - first + 1);
+}
@@ -0,0 +1,60 @@
+//
+// Robust averages of the samples of one oversampling window: median and Hampel-filtered mean.
+//
+
+#ifndef VOC_WINDOW_FILTER_H
+#define VOC_WINDOW_FILTER_H
+
+#define WINDOW_FILTER_MAX_SAMPLES 32
+#define DEFAULT_WINDOW_FILTER_THRESHOLD 3.0f
+
+/**
+ * @enum WindowFilter
+ * @brief Average of the samples of a window logged for each channel.
+ */
+typedef enum {
+    WINDOW_FILTER_NONE = 0,    /**< Mean of all samples. */
+    WINDOW_FILTER_MEDIAN = 1,  /**< Median of the samples. */
+    WINDOW_FILTER_HAMPEL = 2,  /**< Mean of the samples within the Hampel threshold of the median. */
+} WindowFilter;
+
+/**
+ * @struct WindowFilterResult
+ * @brief Robust averages of the samples of one window.
+ */
+typedef struct {
+    float median;   /**< Median of the samples. */
+    float mean;     /**< Mean of the samples that are not outliers. */
+    int outliers;   /**< Number of samples further than the threshold from the median. */
+} WindowFilterResult;
+
+/**
+ * window_filter_insert() - Adds a sample to the samples of a window, kept in ascending order.
+ *
+ * An insertion into a buffer of at most WINDOW_FILTER_MAX_SAMPLES floats, so a sample costs a few
+ * dozen comparisons at worst and the window is ready to filter when it ends.
+ *
+ * @param sorted Samples of the window so far, in ascending order, with room for one more.
+ * @param count Number of samples in sorted, below WINDOW_FILTER_MAX_SAMPLES.
+ * @param sample Sample to add.
+ */
+void window_filter_insert(float sorted[], int count, float sample);
+
+/**
+ * window_filter_apply() - Computes the robust averages of the samples of a window.
+ *
+ * A sample is an outlier when it is further from the median than threshold times the median absolute
+ * deviation, scaled by 1.4826 to estimate the standard deviation of normal noise: the Hampel filter.
+ * On a quiet signal the median absolute deviation can be 0, so it is never taken below resolution,
+ * which keeps samples a quantization step away from the median.
+ *
+ * @param sorted Samples of the window, in ascending order.
+ * @param count Number of samples in sorted, at least 1.
+ * @param threshold Number of scaled median absolute deviations beyond which a sample is an outlier.
+ * @param resolution Smallest step of the channel, in the unit of the samples.
+ * @param result Set to the averages of the window.
+ */
+void window_filter_apply(const float sorted[], int count, float threshold, float resolution,
+                         WindowFilterResult* result);
+
+#endif //VOC_WINDOW_FILTER_H
@@ -9,24 +9,63 @@
 #include "sensirion_config.h"
 #include "sensirion_i2c_hal.h"
 
+/*
+ * CRC-8 of every byte value with polynomial CRC8_POLYNOMIAL, i.e. the result
+ * of eight shift/xor steps, so that one lookup processes a whole byte.
+ */
+static const uint8_t crc8_table[256] = {
+    0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA,
+    0x7D, 0x4C, 0x1F, 0x2E, 0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4,
+    0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D, 0x86, 0xB7, 0xE4, 0xD5,
+    0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
+    0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F,
+    0xB8, 0x89, 0xDA, 0xEB, 0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA,
+    0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13, 0x7E, 0x4F, 0x1C, 0x2D,
+    0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
+    0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51,
+    0xC6, 0xF7, 0xA4, 0x95, 0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F,
+    0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6, 0x7A, 0x4B, 0x18, 0x29,
+    0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
+    0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3,
+    0x44, 0x75, 0x26, 0x17, 0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B,
+    0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2, 0xBF, 0x8E, 0xDD, 0xEC,
+    0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
+    0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD,
+    0x3A, 0x0B, 0x58, 0x69, 0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93,
+    0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A, 0xC1, 0xF0, 0xA3, 0x92,
+    0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
+    0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68,
+    0xFF, 0xCE, 0x9D, 0xAC,
+};
+
 uint8_t sensirion_i2c_generate_crc(const uint8_t* data, uint16_t count) {
     uint16_t current_byte;
     uint8_t crc = CRC8_INIT;
-    uint8_t crc_bit;
 
     /* calculates 8-Bit checksum with given polynomial */
     for (current_byte = 0; current_byte < count; ++current_byte) {
-        crc ^= (data[current_byte]);
-        for (crc_bit = 8; crc_bit > 0; --crc_bit) {
-            if (crc & 0x80)
-                crc = (crc << 1) ^ CRC8_POLYNOMIAL;
-            else
-                crc = (crc << 1);
-        }
+        crc = crc8_table[crc ^ data[current_byte]];
     }
     return crc;
 }
 
+uint8_t sensirion_i2c_generate_word_crc(uint16_t word) {
+    return crc8_table[crc8_table[CRC8_INIT ^ (uint8_t)(word >> 8)] ^
+                      (uint8_t)word];
+}
+
+int8_t sensirion_i2c_check_words_crc(const uint8_t* data, uint16_t num_words) {
+    uint8_t mismatch = 0;
+    uint16_t i;
+
+    /* no early exit, the words are independent and a failure is rare */
+    for (i = 0; i < num_words; ++i, data += SENSIRION_WORD_SIZE + CRC8_LEN) {
+        mismatch |= crc8_table[crc8_table[CRC8_INIT ^ data[0]] ^ data[1]] ^
+                    data[SENSIRION_WORD_SIZE];
+    }
+    return mismatch ? CRC_ERROR : NO_ERROR;
+}
+
 int8_t sensirion_i2c_check_crc(const uint8_t* data, uint16_t count,
                                uint8_t checksum) {
     if (sensirion_i2c_generate_crc(data, count) != checksum)
@@ -51,10 +90,7 @@ uint16_t sensirion_i2c_fill_cmd_send_buf(uint8_t* buf, uint16_t cmd,
     for (i = 0; i < num_args; ++i) {
         buf[idx++] = (uint8_t)((args[i] & 0xFF00) >> 8);
         buf[idx++] = (uint8_t)((args[i] & 0x00FF) >> 0);
-
-        uint8_t crc = sensirion_i2c_generate_crc((uint8_t*)&buf[idx - 2],
-                                                 SENSIRION_WORD_SIZE);
-        buf[idx++] = crc;
+        buf[idx++] = sensirion_i2c_generate_word_crc(args[i]);
     }
     return idx;
 }
@@ -71,14 +107,12 @@ int16_t sensirion_i2c_read_words_as_bytes(uint8_t address, uint8_t* data,
     if (ret != NO_ERROR)
         return ret;
 
-    /* check the CRC for each word */
-    for (i = 0, j = 0; i < size; i += SENSIRION_WORD_SIZE + CRC8_LEN) {
-
-        ret = sensirion_i2c_check_crc(&buf8[i], SENSIRION_WORD_SIZE,
-                                      buf8[i + SENSIRION_WORD_SIZE]);
-        if (ret != NO_ERROR)
-            return ret;
+    /* check the CRC of all words, then strip them */
+    ret = sensirion_i2c_check_words_crc(buf8, num_words);
+    if (ret != NO_ERROR)
+        return ret;
 
+    for (i = 0, j = 0; i < size; i += SENSIRION_WORD_SIZE + CRC8_LEN) {
         data[j++] = buf8[i];
         data[j++] = buf8[i + 1];
     }
@@ -177,9 +211,7 @@ uint16_t sensirion_i2c_add_uint16_t_to_buffer(uint8_t* buffer, uint16_t offset,
                                               uint16_t data) {
     buffer[offset++] = (uint8_t)((data & 0xFF00) >> 8);
     buffer[offset++] = (uint8_t)((data & 0x00FF) >> 0);
-    buffer[offset] = sensirion_i2c_generate_crc(
-        &buffer[offset - SENSIRION_WORD_SIZE], SENSIRION_WORD_SIZE);
-    offset++;
+    buffer[offset++] = sensirion_i2c_generate_word_crc(data);
 
     return offset;
 }
@@ -235,13 +267,44 @@ uint16_t sensirion_i2c_add_bytes_to_buffer(uint8_t* buffer, uint16_t offset,
 
 int16_t sensirion_i2c_write_data(uint8_t address, const uint8_t* data,
                                  uint16_t data_length) {
-    return sensirion_i2c_hal_write(address, data, data_length);
+    return sensirion_i2c_bus_write_data(NULL, address, data, data_length);
+}
+
+int16_t sensirion_i2c_bus_write_data(sensirion_i2c_hal_bus* bus,
+                                     uint8_t address, const uint8_t* data,
+                                     uint16_t data_length) {
+    return sensirion_i2c_hal_bus_write(bus, address, data, data_length);
+}
+
+static int16_t sensirion_i2c_unpack_words_inplace(uint8_t* buffer,
+                                                  uint16_t size) {
+    int16_t error;
+    uint16_t i, j;
+
+    error = sensirion_i2c_check_words_crc(
+        buffer, size / (SENSIRION_WORD_SIZE + CRC8_LEN));
+    if (error) {
+        return error;
+    }
+
+    for (i = 0, j = 0; i < size; i += SENSIRION_WORD_SIZE + CRC8_LEN) {
+        buffer[j++] = buffer[i];
+        buffer[j++] = buffer[i + 1];
+    }
+
+    return NO_ERROR;
 }
 
 int16_t sensirion_i2c_read_data_inplace(uint8_t address, uint8_t* buffer,
                                         uint16_t expected_data_length) {
+    return sensirion_i2c_bus_read_data_inplace(NULL, address, buffer,
+                                               expected_data_length);
+}
+
+int16_t sensirion_i2c_bus_read_data_inplace(sensirion_i2c_hal_bus* bus,
+                                            uint8_t address, uint8_t* buffer,
+                                            uint16_t expected_data_length) {
     int16_t error;
-    uint16_t i, j;
     uint16_t size = (expected_data_length / SENSIRION_WORD_SIZE) *
                     (SENSIRION_WORD_SIZE + CRC8_LEN);
 
@@ -249,21 +312,37 @@ int16_t sensirion_i2c_read_data_inplace(uint8_t address, uint8_t* buffer,
         return BYTE_NUM_ERROR;
     }
 
-    error = sensirion_i2c_hal_read(address, buffer, size);
+    error = sensirion_i2c_hal_bus_read(bus, address, buffer, size);
     if (error) {
         return error;
     }
 
-    for (i = 0, j = 0; i < size; i += SENSIRION_WORD_SIZE + CRC8_LEN) {
+    return sensirion_i2c_unpack_words_inplace(buffer, size);
+}
 
-        error = sensirion_i2c_check_crc(&buffer[i], SENSIRION_WORD_SIZE,
-                                        buffer[i + SENSIRION_WORD_SIZE]);
-        if (error) {
-            return error;
-        }
-        buffer[j++] = buffer[i];
-        buffer[j++] = buffer[i + 1];
+int16_t sensirion_i2c_write_read_data_inplace(uint8_t address, uint8_t* buffer,
+                                              uint16_t write_length,
+                                              uint16_t expected_data_length) {
+    return sensirion_i2c_bus_write_read_data_inplace(
+        NULL, address, buffer, write_length, expected_data_length);
+}
+
+int16_t sensirion_i2c_bus_write_read_data_inplace(
+    sensirion_i2c_hal_bus* bus, uint8_t address, uint8_t* buffer,
+    uint16_t write_length, uint16_t expected_data_length) {
+    int16_t error;
+    uint16_t size = (expected_data_length / SENSIRION_WORD_SIZE) *
+                    (SENSIRION_WORD_SIZE + CRC8_LEN);
+
+    if (expected_data_length % SENSIRION_WORD_SIZE != 0) {
+        return BYTE_NUM_ERROR;
     }
 
-    return NO_ERROR;
+    error = sensirion_i2c_hal_bus_write_read(bus, address, buffer,
+                                             write_length, buffer, size);
+    if (error) {
+        return error;
+    }
+
+    return sensirion_i2c_unpack_words_inplace(buffer, size);
 }
@@ -8,6 +8,7 @@
 #define SENSIRION_I2C_H
 
 #include "sensirion_config.h"
+#include "sensirion_i2c_hal.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,6 +33,25 @@ uint8_t sensirion_i2c_generate_crc(const uint8_t* data, uint16_t count);
 int8_t sensirion_i2c_check_crc(const uint8_t* data, uint16_t count,
                                uint8_t checksum);
 
+/**
+ * sensirion_i2c_generate_word_crc() - CRC of one data word, as sent after the
+ * word on the bus.
+ * @word:   Data word
+ *
+ * @return  Same as sensirion_i2c_generate_crc() on the big endian bytes of word
+ */
+uint8_t sensirion_i2c_generate_word_crc(uint16_t word);
+
+/**
+ * sensirion_i2c_check_words_crc() - Verify the CRC of a batch of words as
+ * received from a sensor, each word being followed by its CRC byte.
+ * @data:       Received bytes, num_words * (SENSIRION_WORD_SIZE + CRC8_LEN)
+ * @num_words:  Number of words to verify
+ *
+ * @return      NO_ERROR if all words match their CRC, CRC_ERROR otherwise
+ */
+int8_t sensirion_i2c_check_words_crc(const uint8_t* data, uint16_t num_words);
+
 /**
  * sensirion_i2c_general_call_reset() - Send a general call reset.
  *
@@ -283,6 +303,46 @@ int16_t sensirion_i2c_write_data(uint8_t address, const uint8_t* data,
  */
 int16_t sensirion_i2c_read_data_inplace(uint8_t address, uint8_t* buffer,
                                         uint16_t expected_data_length);
+
+/**
+ * sensirion_i2c_write_read_data_inplace() - Writes a command and reads the
+ * response in one combined transaction.
+ *
+ * @note Only use this for commands whose response is available without a
+ *       processing delay.
+ *
+ * @param address              Sensor I2C address
+ * @param buffer               Buffer holding write_length bytes to send. The
+ *                             response is stored in the same buffer, see
+ *                             sensirion_i2c_read_data_inplace().
+ * @param write_length         Number of bytes to send to the Sensor.
+ * @param expected_data_length Number of bytes to read (without CRC). Needs
+ *                             to be a multiple of SENSIRION_WORD_SIZE,
+ *                             otherwise the function returns BYTE_NUM_ERROR.
+ *
+ * @return            NO_ERROR on success, an error code otherwise
+ */
+int16_t sensirion_i2c_write_read_data_inplace(uint8_t address, uint8_t* buffer,
+                                              uint16_t write_length,
+                                              uint16_t expected_data_length);
+/**
+ * sensirion_i2c_bus_write_data(), sensirion_i2c_bus_read_data_inplace() and
+ * sensirion_i2c_bus_write_read_data_inplace() - Reentrant versions of the
+ * functions above operating on an explicit bus handle (NULL for the bus
+ * selected by the calling thread).
+ */
+int16_t sensirion_i2c_bus_write_data(sensirion_i2c_hal_bus* bus,
+                                     uint8_t address, const uint8_t* data,
+                                     uint16_t data_length);
+
+int16_t sensirion_i2c_bus_read_data_inplace(sensirion_i2c_hal_bus* bus,
+                                            uint8_t address, uint8_t* buffer,
+                                            uint16_t expected_data_length);
+
+int16_t sensirion_i2c_bus_write_read_data_inplace(
+    sensirion_i2c_hal_bus* bus, uint8_t address, uint8_t* buffer,
+    uint16_t write_length, uint16_t expected_data_length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -10,96 +10,582 @@
 #include "sensirion_i2c_hal.h"
 #include "sensirion_common.h"
 #include "sensirion_config.h"
+#include "sensirion_i2c_hal_fault.h"
+#include "sensirion_i2c_hal_sim.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 /**
  * Linux specific configuration. Adjust the following define to the device path
- * of your sensor.
+ * of your sensor. Further buses can be configured at runtime with
+ * sensirion_i2c_hal_set_bus_path(). Paths starting with
+ * SENSIRION_I2C_SIM_PREFIX are simulated, see sensirion_i2c_hal_sim.h; building
+ * with VOC_SIMULATED_I2C makes the default bus simulated.
  */
+#ifdef VOC_SIMULATED_I2C
+#define I2C_DEVICE_PATH SENSIRION_I2C_SIM_PREFIX
+#else
 #define I2C_DEVICE_PATH "/dev/i2c-1"
+#endif
+
+#define I2C_WRITE_FAILED -1
+#define I2C_READ_FAILED -1
 
 /**
- * The following define was taken from i2c-dev.h. Alternatively the header file
- * can be included. The define was added in Linux v3.10 and never changed since
- * then.
+ * Largest write that can be deferred with sensirion_i2c_hal_defer_write().
  */
-#define I2C_SLAVE 0x0703
+#define I2C_DEFERRED_MAX_BYTES 4
 
-#define I2C_WRITE_FAILED -1
-#define I2C_READ_FAILED -1
+#define I2C_PATH_MAX_LENGTH 64
+
+/**
+ * State of one i2c adapter. Each bus is meant to be driven by a single thread,
+ * so no locking is done.
+ */
+struct sensirion_i2c_hal_bus {
+    char path[I2C_PATH_MAX_LENGTH];
+    int device;
+    sensirion_i2c_sim* sim; /* set instead of device for simulated buses */
+    sensirion_i2c_fault* fault; /* optional, see sensirion_i2c_hal_set_bus_faults() */
+    unsigned long funcs;
+    bool deferred_pending;
+    uint8_t deferred_address;
+    uint8_t deferred_data[I2C_DEFERRED_MAX_BYTES];
+    uint16_t deferred_count;
+    bool probing; /* within sensirion_i2c_hal_bus_probe() */
+    sensirion_i2c_hal_stats stats;
+};
+
+typedef struct sensirion_i2c_hal_bus i2c_bus;
+
+static i2c_bus i2c_buses[SENSIRION_I2C_HAL_MAX_BUSES] = {
+    [0] = {.path = I2C_DEVICE_PATH, .device = -1},
+};
+
+/* bus used by the calling thread, see sensirion_i2c_hal_select_bus() */
+static _Thread_local i2c_bus* current_bus = &i2c_buses[0];
 
-static int i2c_device = -1;
-static uint8_t i2c_address = 0;
+/**
+ * Set the device path of a bus. Must be called before
+ * sensirion_i2c_hal_init().
+ *
+ * @param bus_idx Bus index
+ * @param path    Device path of the adapter, e.g. "/dev/i2c-3"
+ * @returns 0 on success, an error code otherwise
+ */
+int16_t sensirion_i2c_hal_set_bus_path(uint8_t bus_idx, const char* path) {
+    if (bus_idx >= SENSIRION_I2C_HAL_MAX_BUSES ||
+        strlen(path) >= I2C_PATH_MAX_LENGTH)
+        return -1;
+
+    strcpy(i2c_buses[bus_idx].path, path);
+    i2c_buses[bus_idx].device = -1;
+    return 0;
+}
+
+/**
+ * Insert a fault injection layer in front of the adapter of a bus, see
+ * sensirion_i2c_hal_fault.h for the options. Must be called before
+ * sensirion_i2c_hal_init().
+ *
+ * @param bus_idx Bus index
+ * @param options Fault options, e.g. "nack=1:blackhole=0x59"
+ * @returns 0 on success, an error code otherwise
+ */
+int16_t sensirion_i2c_hal_set_bus_faults(uint8_t bus_idx, const char* options) {
+    if (bus_idx >= SENSIRION_I2C_HAL_MAX_BUSES)
+        return -1;
+
+    sensirion_i2c_fault* fault = sensirion_i2c_fault_create(options);
+    if (!fault)
+        return -1;
+    sensirion_i2c_fault_destroy(i2c_buses[bus_idx].fault);
+    i2c_buses[bus_idx].fault = fault;
+    return 0;
+}
+
+/**
+ * Select the current i2c bus by index for the calling thread.
+ * All following i2c operations of that thread will be directed at that bus.
+ *
+ * @param bus_idx   Bus index to select
+ * @returns         0 on success, an error code otherwise
+ */
+int16_t sensirion_i2c_hal_select_bus(uint8_t bus_idx) {
+    if (bus_idx >= SENSIRION_I2C_HAL_MAX_BUSES || !i2c_buses[bus_idx].path[0])
+        return -1;
+
+    current_bus = &i2c_buses[bus_idx];
+    return 0;
+}
 
 /**
  * Initialize all hard- and software components that are needed for the I2C
  * communication.
  */
 void sensirion_i2c_hal_init(void) {
-    /* open i2c adapter */
-    i2c_device = open(I2C_DEVICE_PATH, O_RDWR);
-    if (i2c_device == -1)
-        return; /* no error handling */
+    for (int i = 0; i < SENSIRION_I2C_HAL_MAX_BUSES; i++) {
+        i2c_bus* bus = &i2c_buses[i];
+        if (!bus->path[0])
+            continue;
+
+        if (strncmp(bus->path, SENSIRION_I2C_SIM_PREFIX,
+                    strlen(SENSIRION_I2C_SIM_PREFIX)) == 0) {
+            bus->sim = sensirion_i2c_sim_create(
+                bus->path + strlen(SENSIRION_I2C_SIM_PREFIX), (uint8_t)i);
+            bus->funcs = I2C_FUNC_I2C | I2C_FUNC_PROTOCOL_MANGLING;
+            continue;
+        }
+
+        /* open i2c adapter */
+        bus->device = open(bus->path, O_RDWR);
+        if (bus->device == -1)
+            continue; /* no error handling */
+
+        bus->stats.syscalls++;
+        if (ioctl(bus->device, I2C_FUNCS, &bus->funcs) < 0)
+            bus->funcs = 0;
+    }
 }
 
 /**
  * Release all resources initialized by sensirion_i2c_hal_init().
  */
 void sensirion_i2c_hal_free(void) {
-    if (i2c_device >= 0)
-        close(i2c_device);
+    for (int i = 0; i < SENSIRION_I2C_HAL_MAX_BUSES; i++) {
+        i2c_bus* bus = &i2c_buses[i];
+        if (bus->device >= 0)
+            close(bus->device);
+        bus->device = -1;
+        sensirion_i2c_sim_destroy(bus->sim);
+        bus->sim = NULL;
+        sensirion_i2c_fault_destroy(bus->fault);
+        bus->fault = NULL;
+        bus->deferred_pending = false;
+    }
+}
+
+/**
+ * Hand a list of messages to the kernel as one combined transaction. The
+ * messages are separated by repeated starts and the transfer ends with a
+ * single stop condition.
+ */
+static int8_t i2c_rdwr(i2c_bus* bus, struct i2c_msg* msgs, uint32_t count) {
+    uint32_t acknowledged = count;
+    int ret = 0;
+
+    /* Nothing to send: I2C_RDWR rejects an empty transfer */
+    if (count == 0)
+        return 0;
+
+    /* An injected NACK still sends the messages before it, like the adapter */
+    if (bus->fault)
+        acknowledged = sensirion_i2c_fault_before(bus->fault, msgs, count);
+
+    bus->stats.syscalls++;
+    bus->stats.messages += count;
+    if (acknowledged) {
+        struct i2c_rdwr_ioctl_data transfer = {.msgs = msgs,
+                                               .nmsgs = acknowledged};
+        ret = bus->sim
+                  ? sensirion_i2c_sim_transfer(bus->sim, msgs, acknowledged)
+                  : ioctl(bus->device, I2C_RDWR, &transfer);
+    }
+    if (ret < 0 || acknowledged < count) {
+        /* an absent device leaves its address unacknowledged, which the
+         * adapters report as ENXIO or EREMOTEIO */
+        if (bus->probing && (ret == 0 || bus->sim || errno == ENXIO ||
+                             errno == EREMOTEIO))
+            bus->stats.probe_nacks++;
+        else
+            bus->stats.errors++;
+        return -1;
+    }
+    if (bus->fault)
+        sensirion_i2c_fault_after(bus->fault, msgs, count);
+    return 0;
+}
+
+/**
+ * Take the pending deferred write as a message of its own.
+ */
+static struct i2c_msg i2c_take_deferred(i2c_bus* bus) {
+    struct i2c_msg msg = {
+        .addr = bus->deferred_address,
+        .flags = 0,
+        .len = bus->deferred_count,
+        .buf = bus->deferred_data,
+    };
+
+    bus->deferred_pending = false;
+    return msg;
+}
+
+/**
+ * Send the pending deferred write alone, as one transaction.
+ */
+static int8_t i2c_flush_deferred(i2c_bus* bus) {
+    struct i2c_msg msg = i2c_take_deferred(bus);
+
+    bus->stats.transactions++;
+    return i2c_rdwr(bus, &msg, 1) != 0 ? I2C_WRITE_FAILED : 0;
+}
+
+/**
+ * Execute one transaction, prefixed by the pending deferred write if there is
+ * one. The deferred write is terminated by its own stop condition, since
+ * devices such as the TCA9548A only latch a write on stop. If the adapter
+ * cannot force a stop in the middle of a combined transfer, the deferred write
+ * is sent as a separate transfer instead.
+ */
+static int8_t i2c_transfer(i2c_bus* bus, struct i2c_msg* msgs, uint32_t count) {
+    struct i2c_msg combined[3];
+    uint32_t n = 0;
+
+    bus->stats.transactions++;
+    if (bus->deferred_pending) {
+        struct i2c_msg prefix = i2c_take_deferred(bus);
+
+        if (bus->funcs & I2C_FUNC_PROTOCOL_MANGLING) {
+            prefix.flags = I2C_M_STOP;
+            combined[n++] = prefix;
+        } else if (i2c_rdwr(bus, &prefix, 1) != 0) {
+            return I2C_WRITE_FAILED;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        combined[n++] = msgs[i];
+    }
+    return i2c_rdwr(bus, combined, n);
 }
 
 /**
- * Execute one read transaction on the I2C bus, reading a given number of bytes.
- * If the device does not acknowledge the read command, an error shall be
- * returned.
+ * Resolve a bus handle, NULL standing for the bus selected by the calling
+ * thread.
+ */
+static inline i2c_bus* i2c_resolve_bus(sensirion_i2c_hal_bus* bus) {
+    return bus ? bus : current_bus;
+}
+
+/**
+ * Get the handle of a bus, to be passed to the sensirion_i2c_hal_bus_*()
+ * functions.
  *
+ * @param bus_idx Bus index
+ * @returns the bus handle, NULL if the bus index is not configured
+ */
+sensirion_i2c_hal_bus* sensirion_i2c_hal_get_bus(uint8_t bus_idx) {
+    if (bus_idx >= SENSIRION_I2C_HAL_MAX_BUSES || !i2c_buses[bus_idx].path[0])
+        return NULL;
+
+    return &i2c_buses[bus_idx];
+}
+
+/**
+ * Execute one read transaction on the given bus, reading a given number of
+ * bytes.
+ *
+ * @param bus     bus handle, NULL for the bus selected by the calling thread
  * @param address 7-bit I2C address to read from
  * @param data    pointer to the buffer where the data is to be stored
  * @param count   number of bytes to read from I2C and store in the buffer
  * @returns 0 on success, error code otherwise
  */
-int8_t sensirion_i2c_hal_read(uint8_t address, uint8_t* data, uint16_t count) {
-    if (i2c_address != address) {
-        ioctl(i2c_device, I2C_SLAVE, address);
-        i2c_address = address;
-    }
+int8_t sensirion_i2c_hal_bus_read(sensirion_i2c_hal_bus* bus, uint8_t address,
+                                  uint8_t* data, uint16_t count) {
+    struct i2c_msg msg = {
+        .addr = address,
+        .flags = I2C_M_RD,
+        .len = count,
+        .buf = data,
+    };
 
-    if (read(i2c_device, data, count) != count) {
+    if (i2c_transfer(i2c_resolve_bus(bus), &msg, 1) != 0) {
         return I2C_READ_FAILED;
     }
     return 0;
 }
 
 /**
- * Execute one write transaction on the I2C bus, sending a given number of
- * bytes. The bytes in the supplied buffer must be sent to the given address. If
- * the slave device does not acknowledge any of the bytes, an error shall be
- * returned.
+ * Execute one write transaction on the given bus, sending a given number of
+ * bytes.
  *
+ * @param bus     bus handle, NULL for the bus selected by the calling thread
  * @param address 7-bit I2C address to write to
  * @param data    pointer to the buffer containing the data to write
  * @param count   number of bytes to read from the buffer and send over I2C
  * @returns 0 on success, error code otherwise
  */
-int8_t sensirion_i2c_hal_write(uint8_t address, const uint8_t* data,
-                               uint16_t count) {
-    if (i2c_address != address) {
-        ioctl(i2c_device, I2C_SLAVE, address);
-        i2c_address = address;
-    }
+int8_t sensirion_i2c_hal_bus_write(sensirion_i2c_hal_bus* bus, uint8_t address,
+                                   const uint8_t* data, uint16_t count) {
+    struct i2c_msg msg = {
+        .addr = address,
+        .flags = 0,
+        .len = count,
+        .buf = (uint8_t*)data,
+    };
 
-    if (write(i2c_device, data, count) != count) {
+    if (i2c_transfer(i2c_resolve_bus(bus), &msg, 1) != 0) {
         return I2C_WRITE_FAILED;
     }
     return 0;
 }
 
+int8_t sensirion_i2c_hal_bus_probe(sensirion_i2c_hal_bus* bus, uint8_t address,
+                                   const uint8_t* data, uint16_t count) {
+    int8_t error;
+
+    bus = i2c_resolve_bus(bus);
+    bus->stats.probes++;
+    bus->probing = true;
+    error = sensirion_i2c_hal_bus_write(bus, address, data, count);
+    bus->probing = false;
+    return error;
+}
+
+/**
+ * Execute a write followed by a read from the same device in one transaction
+ * on the given bus, separated by a repeated start.
+ *
+ * @param bus         bus handle, NULL for the bus selected by the calling
+ *                    thread
+ * @param address     7-bit I2C address of the device
+ * @param write_data  pointer to the buffer containing the data to write
+ * @param write_count number of bytes to write
+ * @param read_data   pointer to the buffer where the read data is stored
+ * @param read_count  number of bytes to read
+ * @returns 0 on success, error code otherwise
+ */
+int8_t sensirion_i2c_hal_bus_write_read(sensirion_i2c_hal_bus* bus,
+                                        uint8_t address,
+                                        const uint8_t* write_data,
+                                        uint16_t write_count,
+                                        uint8_t* read_data,
+                                        uint16_t read_count) {
+    struct i2c_msg msgs[2] = {
+        {
+            .addr = address,
+            .flags = 0,
+            .len = write_count,
+            .buf = (uint8_t*)write_data,
+        },
+        {
+            .addr = address,
+            .flags = I2C_M_RD,
+            .len = read_count,
+            .buf = read_data,
+        },
+    };
+
+    if (i2c_transfer(i2c_resolve_bus(bus), msgs, 2) != 0) {
+        return I2C_READ_FAILED;
+    }
+    return 0;
+}
+
+/**
+ * Queue a short write to be sent at the start of the next transaction on the
+ * given bus.
+ *
+ * @param bus     bus handle, NULL for the bus selected by the calling thread
+ * @param address 7-bit I2C address to write to
+ * @param data    pointer to the buffer containing the data to write
+ * @param count   number of bytes to write, at most I2C_DEFERRED_MAX_BYTES
+ * @returns 0 on success, error code otherwise
+ */
+int8_t sensirion_i2c_hal_bus_defer_write(sensirion_i2c_hal_bus* bus,
+                                         uint8_t address, const uint8_t* data,
+                                         uint16_t count) {
+    bus = i2c_resolve_bus(bus);
+    if (count > I2C_DEFERRED_MAX_BYTES) {
+        return sensirion_i2c_hal_bus_write(bus, address, data, count);
+    }
+
+    if (bus->deferred_pending && bus->deferred_address != address) {
+        /* only one deferred write is kept, send the older one now */
+        if (i2c_flush_deferred(bus) != 0) {
+            return I2C_WRITE_FAILED;
+        }
+    }
+
+    memcpy(bus->deferred_data, data, count);
+    bus->deferred_address = address;
+    bus->deferred_count = count;
+    bus->deferred_pending = true;
+    return 0;
+}
+
+/**
+ * Copy the transaction counters of the given bus accumulated since the last
+ * reset.
+ *
+ * @param bus   bus handle, NULL for the bus selected by the calling thread
+ * @param stats pointer to the structure receiving the counters
+ */
+void sensirion_i2c_hal_bus_get_stats(sensirion_i2c_hal_bus* bus,
+                                     sensirion_i2c_hal_stats* stats) {
+    *stats = i2c_resolve_bus(bus)->stats;
+}
+
+/**
+ * Reset the transaction counters of the given bus.
+ *
+ * @param bus bus handle, NULL for the bus selected by the calling thread
+ */
+void sensirion_i2c_hal_bus_reset_stats(sensirion_i2c_hal_bus* bus) {
+    bus = i2c_resolve_bus(bus);
+    memset(&bus->stats, 0, sizeof(bus->stats));
+    if (bus->fault)
+        sensirion_i2c_fault_reset_stats(bus->fault);
+}
+
+/**
+ * Copy the counters of the fault injection layer of the given bus,
+ * accumulated since initialization or the last call to
+ * sensirion_i2c_hal_bus_reset_stats().
+ *
+ * @param bus   bus handle, NULL for the bus selected by the calling thread
+ * @param stats pointer to the structure receiving the counters
+ * @returns 0 on success, an error code if the bus injects no faults
+ */
+int16_t sensirion_i2c_hal_bus_get_fault_stats(sensirion_i2c_hal_bus* bus,
+                                              sensirion_i2c_fault_stats* stats) {
+    bus = i2c_resolve_bus(bus);
+    if (!bus->fault)
+        return -1;
+    sensirion_i2c_fault_get_stats(bus->fault, stats);
+    return 0;
+}
+
+int8_t sensirion_i2c_hal_read(uint8_t address, uint8_t* data, uint16_t count) {
+    return sensirion_i2c_hal_bus_read(NULL, address, data, count);
+}
+
+int8_t sensirion_i2c_hal_write(uint8_t address, const uint8_t* data,
+                               uint16_t count) {
+    return sensirion_i2c_hal_bus_write(NULL, address, data, count);
+}
+
+int8_t sensirion_i2c_hal_write_read(uint8_t address, const uint8_t* write_data,
+                                    uint16_t write_count, uint8_t* read_data,
+                                    uint16_t read_count) {
+    return sensirion_i2c_hal_bus_write_read(NULL, address, write_data,
+                                            write_count, read_data, read_count);
+}
+
+int8_t sensirion_i2c_hal_defer_write(uint8_t address, const uint8_t* data,
+                                     uint16_t count) {
+    return sensirion_i2c_hal_bus_defer_write(NULL, address, data, count);
+}
+
+void sensirion_i2c_hal_get_stats(sensirion_i2c_hal_stats* stats) {
+    sensirion_i2c_hal_bus_get_stats(NULL, stats);
+}
+
+void sensirion_i2c_hal_reset_stats(void) {
+    sensirion_i2c_hal_bus_reset_stats(NULL);
+}
+
+/**
+ * Virtual clock shared by all threads of the process, see
+ * sensirion_i2c_hal_use_virtual_clock(). Time only moves when every attached
+ * thread is asleep, and then jumps to the earliest of their deadlines.
+ *
+ * Sleepers register their deadline once per generation; a generation ends
+ * when the clock advances. Waiting for all of them to register before the
+ * next advance keeps a thread that has not yet rechecked its deadline from
+ * being overtaken.
+ */
+static struct {
+    bool enabled;
+    pthread_mutex_t lock;
+    pthread_cond_t advanced;
+    uint64_t now_usec;
+    uint64_t wall_offset_usec; /* realtime - monotonic at enable time */
+    uint32_t attached;
+    uint32_t registered;
+    uint64_t generation;
+    uint64_t next_deadline;
+} virtual_clock = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .advanced = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t clock_get_usec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sensirion_i2c_hal_use_virtual_clock(void) {
+    virtual_clock.now_usec = clock_get_usec(CLOCK_MONOTONIC);
+    virtual_clock.wall_offset_usec =
+        clock_get_usec(CLOCK_REALTIME) - virtual_clock.now_usec;
+    virtual_clock.attached = 1;
+    virtual_clock.registered = 0;
+    virtual_clock.generation = 0;
+    virtual_clock.next_deadline = UINT64_MAX;
+    virtual_clock.enabled = true;
+}
+
+bool sensirion_i2c_hal_virtual_clock_enabled(void) {
+    return virtual_clock.enabled;
+}
+
+void sensirion_i2c_hal_clock_attach(uint32_t threads) {
+    if (!virtual_clock.enabled)
+        return;
+    pthread_mutex_lock(&virtual_clock.lock);
+    virtual_clock.attached += threads;
+    pthread_mutex_unlock(&virtual_clock.lock);
+}
+
+void sensirion_i2c_hal_clock_detach(void) {
+    if (!virtual_clock.enabled)
+        return;
+    pthread_mutex_lock(&virtual_clock.lock);
+    virtual_clock.attached--;
+    /* The remaining threads may all be asleep now */
+    pthread_cond_broadcast(&virtual_clock.advanced);
+    pthread_mutex_unlock(&virtual_clock.lock);
+}
+
+static void virtual_clock_sleep_until(uint64_t deadline_usec) {
+    uint64_t generation = 0;
+    bool registered = false;
+
+    pthread_mutex_lock(&virtual_clock.lock);
+    while (virtual_clock.now_usec < deadline_usec) {
+        if (!registered || generation != virtual_clock.generation) {
+            registered = true;
+            generation = virtual_clock.generation;
+            virtual_clock.registered++;
+            if (deadline_usec < virtual_clock.next_deadline)
+                virtual_clock.next_deadline = deadline_usec;
+        }
+        if (virtual_clock.registered >= virtual_clock.attached) {
+            virtual_clock.now_usec = virtual_clock.next_deadline;
+            virtual_clock.next_deadline = UINT64_MAX;
+            virtual_clock.registered = 0;
+            virtual_clock.generation++;
+            pthread_cond_broadcast(&virtual_clock.advanced);
+            continue;
+        }
+        pthread_cond_wait(&virtual_clock.advanced, &virtual_clock.lock);
+    }
+    pthread_mutex_unlock(&virtual_clock.lock);
+}
+
 /**
  * Sleep for a given number of microseconds. The function should delay the
  * execution for at least the given time, but may also sleep longer.
@@ -107,5 +593,53 @@ int8_t sensirion_i2c_hal_write(uint8_t address, const uint8_t* data,
  * @param useconds the sleep time in microseconds
  */
 void sensirion_i2c_hal_sleep_usec(uint32_t useconds) {
+    if (virtual_clock.enabled) {
+        virtual_clock_sleep_until(sensirion_i2c_hal_get_time_usec() +
+                                  useconds);
+        return;
+    }
     usleep(useconds);
 }
+
+/**
+ * Return a monotonic time in microseconds, used as the time base of
+ * sensirion_i2c_hal_sleep_until_usec(). The origin is unspecified.
+ *
+ * @returns the current time in microseconds
+ */
+uint64_t sensirion_i2c_hal_get_time_usec(void) {
+    uint64_t now;
+
+    if (!virtual_clock.enabled)
+        return clock_get_usec(CLOCK_MONOTONIC);
+    pthread_mutex_lock(&virtual_clock.lock);
+    now = virtual_clock.now_usec;
+    pthread_mutex_unlock(&virtual_clock.lock);
+    return now;
+}
+
+uint64_t sensirion_i2c_hal_get_realtime_usec(void) {
+    if (!virtual_clock.enabled)
+        return clock_get_usec(CLOCK_REALTIME);
+    return sensirion_i2c_hal_get_time_usec() + virtual_clock.wall_offset_usec;
+}
+
+/**
+ * Sleep until the given time of sensirion_i2c_hal_get_time_usec(). Returns
+ * at once if the time has already passed.
+ *
+ * @param deadline_usec the wake up time in microseconds
+ */
+void sensirion_i2c_hal_sleep_until_usec(uint64_t deadline_usec) {
+    struct timespec ts = {
+        .tv_sec = deadline_usec / 1000000,
+        .tv_nsec = (deadline_usec % 1000000) * 1000,
+    };
+
+    if (virtual_clock.enabled) {
+        virtual_clock_sleep_until(deadline_usec);
+        return;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
@@ -8,11 +8,36 @@
 #define SENSIRION_I2C_HAL_H
 
 #include "sensirion_config.h"
+#include "sensirion_i2c_hal_fault.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+/**
+ * Number of i2c buses the HAL can drive at the same time.
+ */
+#define SENSIRION_I2C_HAL_MAX_BUSES 4
+
+/**
+ * Transaction counters kept by the HAL, see sensirion_i2c_hal_get_stats().
+ */
+typedef struct {
+    uint64_t transactions; /* read, write and write_read calls */
+    uint64_t syscalls;     /* kernel calls issued for these transactions */
+    uint64_t messages;     /* i2c messages (address phases) on the bus */
+    uint64_t errors;       /* failed kernel calls, absent probed devices excluded */
+    uint64_t probes;       /* sensirion_i2c_hal_bus_probe() calls */
+    uint64_t probe_nacks;  /* probes no device acknowledged */
+} sensirion_i2c_hal_stats;
+
+/**
+ * Handle of one i2c bus, see sensirion_i2c_hal_get_bus(). Passing NULL to the
+ * sensirion_i2c_hal_bus_*() functions uses the bus selected with
+ * sensirion_i2c_hal_select_bus() by the calling thread.
+ */
+typedef struct sensirion_i2c_hal_bus sensirion_i2c_hal_bus;
+
 /**
  * Select the current i2c bus by index.
  * All following i2c operations will be directed at that bus.
@@ -20,11 +45,39 @@ extern "C" {
  * THE IMPLEMENTATION IS OPTIONAL ON SINGLE-BUS SETUPS (all sensors on the same
  * bus)
  *
+ * The Linux implementation keeps the selection per thread, so every bus can be
+ * driven by its own thread. A bus must not be used by two threads at once.
+ *
  * @param bus_idx   Bus index to select
  * @returns         0 on success, an error code otherwise
  */
 int16_t sensirion_i2c_hal_select_bus(uint8_t bus_idx);
 
+/**
+ * Set the adapter used for a bus index. Must be called before
+ * sensirion_i2c_hal_init().
+ *
+ * THE IMPLEMENTATION IS OPTIONAL ON SINGLE-BUS SETUPS
+ *
+ * @param bus_idx   Bus index, below SENSIRION_I2C_HAL_MAX_BUSES
+ * @param path      Platform specific adapter name, e.g. "/dev/i2c-3" on Linux
+ * @returns         0 on success, an error code otherwise
+ */
+int16_t sensirion_i2c_hal_set_bus_path(uint8_t bus_idx, const char* path);
+
+/**
+ * Insert a fault injection layer between a bus and its adapter, to exercise
+ * the error paths of the drivers with NACKs, corrupt data, added latency and
+ * dead addresses. Must be called before sensirion_i2c_hal_init().
+ *
+ * THE IMPLEMENTATION IS OPTIONAL, it is meant for testing only
+ *
+ * @param bus_idx   Bus index, below SENSIRION_I2C_HAL_MAX_BUSES
+ * @param options   Fault options, see sensirion_i2c_fault_create()
+ * @returns         0 on success, an error code on invalid options
+ */
+int16_t sensirion_i2c_hal_set_bus_faults(uint8_t bus_idx, const char* options);
+
 /**
  * Initialize all hard- and software components that are needed for the I2C
  * communication.
@@ -62,6 +115,124 @@ int8_t sensirion_i2c_hal_read(uint8_t address, uint8_t* data, uint16_t count);
 int8_t sensirion_i2c_hal_write(uint8_t address, const uint8_t* data,
                                uint16_t count);
 
+/**
+ * Execute a write followed by a read from the same device in one transaction,
+ * separated by a repeated start. Use it only for commands whose response is
+ * available without a conversion delay.
+ *
+ * THE IMPLEMENTATION IS OPTIONAL, sensirion_i2c_hal_write() followed by
+ * sensirion_i2c_hal_read() is equivalent for devices accepting a stop between
+ * command and read header.
+ *
+ * @param address     7-bit I2C address of the device
+ * @param write_data  pointer to the buffer containing the data to write
+ * @param write_count number of bytes to write
+ * @param read_data   pointer to the buffer where the read data is stored
+ * @param read_count  number of bytes to read
+ * @returns 0 on success, error code otherwise
+ */
+int8_t sensirion_i2c_hal_write_read(uint8_t address, const uint8_t* write_data,
+                                    uint16_t write_count, uint8_t* read_data,
+                                    uint16_t read_count);
+
+/**
+ * Queue a short write (e.g. a multiplexer channel selection) to be sent at the
+ * start of the next transaction, so both go out with a single kernel call. The
+ * deferred write is terminated by its own stop condition. Errors of the
+ * deferred write are reported by the transaction that carries it.
+ *
+ * THE IMPLEMENTATION IS OPTIONAL, an immediate sensirion_i2c_hal_write() is
+ * equivalent.
+ *
+ * @param address 7-bit I2C address to write to
+ * @param data    pointer to the buffer containing the data to write
+ * @param count   number of bytes to write
+ * @returns 0 on success, error code otherwise
+ */
+int8_t sensirion_i2c_hal_defer_write(uint8_t address, const uint8_t* data,
+                                     uint16_t count);
+
+/**
+ * Copy the transaction counters of the current bus accumulated since
+ * initialization or the last call to sensirion_i2c_hal_reset_stats().
+ *
+ * @param stats pointer to the structure receiving the counters
+ */
+void sensirion_i2c_hal_get_stats(sensirion_i2c_hal_stats* stats);
+
+/**
+ * Reset the transaction counters of the current bus.
+ */
+void sensirion_i2c_hal_reset_stats(void);
+
+/**
+ * Get the handle of a bus for the reentrant sensirion_i2c_hal_bus_*()
+ * functions. Drivers holding a handle do not depend on the bus selected by
+ * the calling thread, so several buses can be driven from separate threads and
+ * several devices from the same thread.
+ *
+ * THE IMPLEMENTATION IS OPTIONAL ON SINGLE-BUS SETUPS, returning NULL selects
+ * the default bus.
+ *
+ * @param bus_idx   Bus index
+ * @returns         the bus handle, NULL if the bus is not configured
+ */
+sensirion_i2c_hal_bus* sensirion_i2c_hal_get_bus(uint8_t bus_idx);
+
+/**
+ * Reentrant versions of sensirion_i2c_hal_read(), sensirion_i2c_hal_write(),
+ * sensirion_i2c_hal_write_read(), sensirion_i2c_hal_defer_write(),
+ * sensirion_i2c_hal_get_stats() and sensirion_i2c_hal_reset_stats() operating
+ * on an explicit bus handle. The functions without bus handle operate on the
+ * bus selected by the calling thread.
+ */
+int8_t sensirion_i2c_hal_bus_read(sensirion_i2c_hal_bus* bus, uint8_t address,
+                                  uint8_t* data, uint16_t count);
+
+int8_t sensirion_i2c_hal_bus_write(sensirion_i2c_hal_bus* bus, uint8_t address,
+                                   const uint8_t* data, uint16_t count);
+
+int8_t sensirion_i2c_hal_bus_write_read(sensirion_i2c_hal_bus* bus,
+                                        uint8_t address,
+                                        const uint8_t* write_data,
+                                        uint16_t write_count,
+                                        uint8_t* read_data,
+                                        uint16_t read_count);
+
+int8_t sensirion_i2c_hal_bus_defer_write(sensirion_i2c_hal_bus* bus,
+                                         uint8_t address, const uint8_t* data,
+                                         uint16_t count);
+
+/**
+ * Execute one write transaction on the given bus to find out whether a device
+ * answers at an address. An absent device does not acknowledge its address,
+ * which is counted in probe_nacks instead of errors.
+ *
+ * @param bus     bus handle, NULL for the bus selected by the calling thread
+ * @param address 7-bit I2C address to probe
+ * @param data    bytes to write, NULL for none
+ * @param count   number of bytes to write
+ * @returns 0 if the device acknowledged, error code otherwise
+ */
+int8_t sensirion_i2c_hal_bus_probe(sensirion_i2c_hal_bus* bus, uint8_t address,
+                                   const uint8_t* data, uint16_t count);
+
+void sensirion_i2c_hal_bus_get_stats(sensirion_i2c_hal_bus* bus,
+                                     sensirion_i2c_hal_stats* stats);
+
+void sensirion_i2c_hal_bus_reset_stats(sensirion_i2c_hal_bus* bus);
+
+/**
+ * Copy the counters of the fault injection layer of a bus, reset together
+ * with the transaction counters by sensirion_i2c_hal_bus_reset_stats().
+ *
+ * @param bus   bus handle, NULL for the bus selected by the calling thread
+ * @param stats pointer to the structure receiving the counters
+ * @returns     0 on success, an error code if the bus injects no faults
+ */
+int16_t sensirion_i2c_hal_bus_get_fault_stats(sensirion_i2c_hal_bus* bus,
+                                              sensirion_i2c_fault_stats* stats);
+
 /**
  * Sleep for a given number of microseconds. The function should delay the
  * execution approximately, but no less than, the given time.
@@ -80,6 +251,63 @@ int8_t sensirion_i2c_hal_write(uint8_t address, const uint8_t* data,
  */
 void sensirion_i2c_hal_sleep_usec(uint32_t useconds);
 
+/**
+ * Return a monotonic time in microseconds, used as the time base of
+ * sensirion_i2c_hal_sleep_until_usec(). The origin is unspecified.
+ *
+ * @returns the current time in microseconds
+ */
+uint64_t sensirion_i2c_hal_get_time_usec(void);
+
+/**
+ * Sleep until the given time of sensirion_i2c_hal_get_time_usec(). Returns
+ * at once if the time has already passed.
+ *
+ * @param deadline_usec the wake up time in microseconds
+ */
+void sensirion_i2c_hal_sleep_until_usec(uint64_t deadline_usec);
+
+/**
+ * Return the wall-clock time in microseconds since the epoch, following
+ * sensirion_i2c_hal_get_time_usec() when the virtual clock is in use.
+ *
+ * @returns the current wall-clock time in microseconds
+ */
+uint64_t sensirion_i2c_hal_get_realtime_usec(void);
+
+/**
+ * Replace the system clocks by a virtual clock, starting at the current time.
+ * Sleeps then return as soon as every thread using the clock is asleep, with
+ * the time advanced to the earliest of their deadlines, so timing is kept
+ * exact while runs against simulated buses go as fast as the CPU allows.
+ *
+ * Must be called before any other thread uses the HAL. The calling thread is
+ * attached to the clock; further threads must be accounted for with
+ * sensirion_i2c_hal_clock_attach() before they can run, and leave with
+ * sensirion_i2c_hal_clock_detach() before blocking on anything else than a
+ * HAL sleep, otherwise time stands still or jumps ahead of them.
+ */
+void sensirion_i2c_hal_use_virtual_clock(void);
+
+/**
+ * @returns whether sensirion_i2c_hal_use_virtual_clock() was called
+ */
+bool sensirion_i2c_hal_virtual_clock_enabled(void);
+
+/**
+ * Account for threads about to run on the virtual clock. Called by the thread
+ * releasing them, before they are released. No-op on the system clock.
+ *
+ * @param threads number of threads
+ */
+void sensirion_i2c_hal_clock_attach(uint32_t threads);
+
+/**
+ * Stop accounting for the calling thread on the virtual clock, before it
+ * blocks outside of the HAL. No-op on the system clock.
+ */
+void sensirion_i2c_hal_clock_detach(void);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,163 @@
+/*
+ * Fault injection for the Linux HAL, see sensirion_i2c_hal_fault.h.
+ */
+
+/* Enable strtok_r */
+#define _DEFAULT_SOURCE
+
+#include "sensirion_i2c_hal_fault.h"
+#include "sensirion_i2c_hal.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAULT_MAX_ADDRESSES 8
+
+struct sensirion_i2c_fault {
+    uint32_t nack_threshold; /* per 2^32 */
+    uint32_t crc_threshold;  /* per 2^32 */
+    uint32_t latency_usec;
+    uint8_t blackholes[FAULT_MAX_ADDRESSES];
+    uint8_t blackhole_count;
+    uint8_t stuck[FAULT_MAX_ADDRESSES];
+    uint8_t stuck_count;
+    uint64_t rng;
+    sensirion_i2c_fault_stats stats;
+};
+
+static uint32_t fault_random(sensirion_i2c_fault* fault) {
+    /* xorshift64* */
+    uint64_t x = fault->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    fault->rng = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static bool fault_chance(sensirion_i2c_fault* fault, uint32_t threshold) {
+    return threshold && fault_random(fault) < threshold;
+}
+
+static bool fault_listed(const uint8_t* addresses, uint8_t count,
+                         uint16_t address) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (addresses[i] == address)
+            return true;
+    }
+    return false;
+}
+
+static uint32_t fault_threshold(const char* percent) {
+    double p = atof(percent);
+    if (p <= 0)
+        return 0;
+    if (p >= 100)
+        return UINT32_MAX;
+    return (uint32_t)(p / 100.0 * 4294967296.0);
+}
+
+uint32_t sensirion_i2c_fault_before(sensirion_i2c_fault* fault,
+                                    const struct i2c_msg* msgs,
+                                    uint32_t count) {
+    fault->stats.transfers++;
+    if (fault->latency_usec) {
+        sensirion_i2c_hal_sleep_usec(fault->latency_usec);
+        fault->stats.delay_usec += fault->latency_usec;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (fault_listed(fault->blackholes, fault->blackhole_count,
+                         msgs[i].addr)) {
+            fault->stats.blackholed++;
+            return i;
+        }
+        if (fault_chance(fault, fault->nack_threshold)) {
+            fault->stats.nacks++;
+            return i;
+        }
+    }
+    return count;
+}
+
+void sensirion_i2c_fault_after(sensirion_i2c_fault* fault,
+                               struct i2c_msg* msgs, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        struct i2c_msg* msg = &msgs[i];
+        if (!(msg->flags & I2C_M_RD) || !msg->len)
+            continue;
+
+        if (fault_listed(fault->stuck, fault->stuck_count, msg->addr)) {
+            memset(msg->buf, 0xFF, msg->len);
+            fault->stats.stuck++;
+        } else if (fault_chance(fault, fault->crc_threshold)) {
+            uint32_t bit = fault_random(fault) % (msg->len * 8u);
+            msg->buf[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+            fault->stats.corrupted++;
+        }
+    }
+}
+
+sensirion_i2c_fault* sensirion_i2c_fault_create(const char* options) {
+    char buffer[128];
+
+    if (strlen(options) >= sizeof(buffer))
+        return NULL;
+    strcpy(buffer, options);
+
+    sensirion_i2c_fault* fault = calloc(1, sizeof(*fault));
+    if (!fault)
+        return NULL;
+    fault->rng = 1;
+
+    char* saveptr = NULL;
+    for (char* option = strtok_r(buffer, ":", &saveptr); option;
+         option = strtok_r(NULL, ":", &saveptr)) {
+        char* value = strchr(option, '=');
+        if (!value)
+            goto invalid;
+        *value++ = '\0';
+
+        if (strcmp(option, "nack") == 0) {
+            fault->nack_threshold = fault_threshold(value);
+        } else if (strcmp(option, "crc") == 0) {
+            fault->crc_threshold = fault_threshold(value);
+        } else if (strcmp(option, "latency") == 0) {
+            fault->latency_usec = (uint32_t)strtoul(value, NULL, 0);
+        } else if (strcmp(option, "blackhole") == 0) {
+            if (fault->blackhole_count == FAULT_MAX_ADDRESSES)
+                goto invalid;
+            fault->blackholes[fault->blackhole_count++] =
+                (uint8_t)strtoul(value, NULL, 0);
+        } else if (strcmp(option, "stuck") == 0) {
+            if (fault->stuck_count == FAULT_MAX_ADDRESSES)
+                goto invalid;
+            fault->stuck[fault->stuck_count++] =
+                (uint8_t)strtoul(value, NULL, 0);
+        } else if (strcmp(option, "seed") == 0) {
+            /* xorshift must not start from 0 */
+            fault->rng = strtoull(value, NULL, 0) * 0x9E3779B97F4A7C15ULL | 1;
+        } else {
+            goto invalid;
+        }
+    }
+    return fault;
+
+invalid:
+    free(fault);
+    return NULL;
+}
+
+void sensirion_i2c_fault_destroy(sensirion_i2c_fault* fault) {
+    free(fault);
+}
+
+void sensirion_i2c_fault_get_stats(const sensirion_i2c_fault* fault,
+                                   sensirion_i2c_fault_stats* stats) {
+    *stats = fault->stats;
+}
+
+void sensirion_i2c_fault_reset_stats(sensirion_i2c_fault* fault) {
+    memset(&fault->stats, 0, sizeof(fault->stats));
+}
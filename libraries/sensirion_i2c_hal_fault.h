@@ -0,0 +1,90 @@
+/*
+ * Fault injection for the Linux HAL.
+ */
+
+#ifndef SENSIRION_I2C_HAL_FAULT_H
+#define SENSIRION_I2C_HAL_FAULT_H
+
+#include <linux/i2c.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Counters of the faults injected on one bus.
+ */
+typedef struct {
+    uint64_t transfers;  /* transfers seen by the fault layer */
+    uint64_t nacks;      /* transfers cut short by a random NACK */
+    uint64_t blackholed; /* transfers cut short by a blackholed address */
+    uint64_t stuck;      /* read messages answered by a stuck device */
+    uint64_t corrupted;  /* read messages with a flipped bit */
+    uint64_t delay_usec; /* latency added to the transfers */
+} sensirion_i2c_fault_stats;
+
+/**
+ * Fault layer sitting between the HAL and the adapter, real or simulated.
+ * Each bus gets its own layer and random generator, so the injected faults
+ * are reproducible per bus for a given seed.
+ */
+typedef struct sensirion_i2c_fault sensirion_i2c_fault;
+
+/**
+ * Create a fault layer from a colon separated list of options, all of them
+ * optional:
+ *   nack=P       percentage of messages not acknowledged (default 0)
+ *   crc=P        percentage of read messages with one bit flipped, which the
+ *                drivers see as a CRC error (default 0)
+ *   latency=N    microseconds added to every transfer (default 0)
+ *   blackhole=A  address that never acknowledges, e.g. 0x59; may be repeated
+ *   stuck=A      address that acknowledges but reads as all ones, like a
+ *                device holding SDA released; may be repeated
+ *   seed=N       seed of the random faults (default 1)
+ *
+ * @param options Options, e.g. "nack=1:crc=0.5:blackhole=0x59"
+ * @returns the fault layer, NULL on invalid options or allocation failure
+ */
+sensirion_i2c_fault* sensirion_i2c_fault_create(const char* options);
+
+/**
+ * Release a fault layer.
+ */
+void sensirion_i2c_fault_destroy(sensirion_i2c_fault* fault);
+
+/**
+ * Decide the faults of a transfer before it is handed to the adapter, and
+ * sleep for the configured latency.
+ *
+ * @returns the number of leading messages to transfer; if lower than count,
+ *          the following message is not acknowledged and the transfer must
+ *          fail after the returned messages went out
+ */
+uint32_t sensirion_i2c_fault_before(sensirion_i2c_fault* fault,
+                                    const struct i2c_msg* msgs,
+                                    uint32_t count);
+
+/**
+ * Corrupt the data of the read messages of a successful transfer.
+ */
+void sensirion_i2c_fault_after(sensirion_i2c_fault* fault,
+                               struct i2c_msg* msgs, uint32_t count);
+
+/**
+ * Copy the counters of a fault layer accumulated since its creation or the
+ * last call to sensirion_i2c_fault_reset_stats().
+ */
+void sensirion_i2c_fault_get_stats(const sensirion_i2c_fault* fault,
+                                   sensirion_i2c_fault_stats* stats);
+
+/**
+ * Reset the counters of a fault layer.
+ */
+void sensirion_i2c_fault_reset_stats(sensirion_i2c_fault* fault);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSIRION_I2C_HAL_FAULT_H */
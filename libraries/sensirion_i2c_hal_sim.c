@@ -0,0 +1,408 @@
+/*
+ * Simulated i2c bus for the Linux HAL, see sensirion_i2c_hal_sim.h.
+ */
+
+/* Enable strtok_r and M_PI */
+#define _DEFAULT_SOURCE
+
+#include "sensirion_i2c_hal_sim.h"
+#include "sensirion_common.h"
+#include "sensirion_i2c.h"
+#include "sensirion_i2c_hal.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_MAX_MUXES 8
+#define SIM_PORTS 8
+#define SIM_MUX_ADDRESS 0x70
+#define SIM_SHT3X_ADDRESS 0x44
+#define SIM_SHT3X_ALT_ADDRESS 0x45
+#define SIM_SGP40_ADDRESS 0x59
+
+/* conversion times, maximum values of the datasheets */
+#define SIM_SHT3X_HIGH_USEC 15500
+#define SIM_SHT3X_MEDIUM_USEC 6500
+#define SIM_SHT3X_LOW_USEC 4500
+#define SIM_SGP40_RAW_SIGNAL_USEC 30000
+#define SIM_SGP40_SELF_TEST_USEC 320000
+
+#define SIM_SHT3X_STATUS_RESET 0x0010
+#define SIM_SHT3X_STATUS_COMMAND_FAILED 0x0002
+#define SIM_SHT3X_STATUS_HEATER 0x2000
+
+/**
+ * State of one simulated sensor, SHT3x or SGP40. A result is readable once
+ * pending is set and ready_usec has passed.
+ */
+typedef struct {
+    bool present;
+    bool pending;
+    bool stretching;
+    uint64_t ready_usec;
+    uint8_t result[9];
+    uint8_t result_len;
+    uint16_t status;
+    uint32_t periodic_usec; /* 0 outside periodic mode */
+    uint32_t conversion_usec;
+    uint64_t periodic_start_usec;
+    uint64_t periodic_fetched;
+    uint32_t rng;
+    float phase;
+    float temperature_base;
+    float humidity_base;
+    uint16_t serial[3];
+} sim_sensor;
+
+struct sensirion_i2c_sim {
+    int mux_count;
+    uint8_t mux_mask[SIM_MAX_MUXES];
+    sim_sensor sht[SIM_MAX_MUXES][SIM_PORTS];
+    sim_sensor sht_alt[SIM_MAX_MUXES][SIM_PORTS]; /* second SHT3x at 0x45 */
+    sim_sensor sgp[SIM_MAX_MUXES][SIM_PORTS];
+    uint32_t khz;
+};
+
+static float sim_noise(sim_sensor* sensor) {
+    /* xorshift32, uniform in [-1, 1] */
+    uint32_t x = sensor->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sensor->rng = x;
+    return (float)x / 2147483648.0f - 1.0f;
+}
+
+static float sim_wave(uint64_t now_usec, float period_sec, float phase) {
+    return sinf(2.0f * (float)M_PI * (float)(now_usec / 1000) /
+                    (period_sec * 1000.0f) +
+                phase);
+}
+
+static uint16_t sim_clamp_ticks(float ticks) {
+    if (ticks < 0.0f)
+        return 0;
+    if (ticks > 65535.0f)
+        return 65535;
+    return (uint16_t)ticks;
+}
+
+static void sim_set_result(sim_sensor* sensor, const uint16_t* words,
+                           uint8_t num_words, uint64_t ready_usec) {
+    uint8_t offset = 0;
+    for (uint8_t i = 0; i < num_words; i++) {
+        offset =
+            sensirion_i2c_add_uint16_t_to_buffer(sensor->result, offset, words[i]);
+    }
+    sensor->result_len = offset;
+    sensor->ready_usec = ready_usec;
+    sensor->pending = true;
+}
+
+static void sim_sht3x_measure(sim_sensor* sensor, uint64_t now_usec,
+                              uint64_t ready_usec) {
+    float temperature = sensor->temperature_base +
+                        0.8f * sim_wave(now_usec, 600.0f, sensor->phase) +
+                        0.05f * sim_noise(sensor);
+    float humidity = sensor->humidity_base +
+                     5.0f * sim_wave(now_usec, 900.0f, sensor->phase) +
+                     0.2f * sim_noise(sensor);
+    uint16_t words[2] = {
+        sim_clamp_ticks((temperature + 45.0f) * 65535.0f / 175.0f),
+        sim_clamp_ticks(humidity * 65535.0f / 100.0f),
+    };
+    sim_set_result(sensor, words, 2, ready_usec);
+}
+
+static bool sim_sht3x_write(sim_sensor* sensor, const uint8_t* data,
+                            uint16_t len, uint64_t now) {
+    if (len < 2)
+        return true;
+
+    uint16_t command = (uint16_t)(data[0] << 8 | data[1]);
+    uint8_t msb = data[0];
+    uint8_t lsb = data[1];
+
+    if (msb == 0x24 || msb == 0x2C) {
+        /* single shot, 0x2C with clock stretching */
+        uint32_t usec = lsb == 0x00 || lsb == 0x06   ? SIM_SHT3X_HIGH_USEC
+                        : lsb == 0x0B || lsb == 0x0D ? SIM_SHT3X_MEDIUM_USEC
+                                                     : SIM_SHT3X_LOW_USEC;
+        sensor->stretching = msb == 0x2C;
+        sensor->periodic_usec = 0;
+        sim_sht3x_measure(sensor, now, now + usec);
+        return true;
+    }
+
+    static const uint8_t periodic_msb[] = {0x20, 0x21, 0x22, 0x23, 0x27};
+    static const uint32_t periodic_usec[] = {2000000, 1000000, 500000, 250000,
+                                             100000};
+    for (unsigned i = 0; i < sizeof(periodic_msb); i++) {
+        if (msb == periodic_msb[i]) {
+            sensor->periodic_usec = periodic_usec[i];
+            sensor->conversion_usec = SIM_SHT3X_HIGH_USEC;
+            sensor->periodic_start_usec = now;
+            sensor->periodic_fetched = 0;
+            sensor->pending = false;
+            return true;
+        }
+    }
+
+    switch (command) {
+        case 0xE000: { /* fetch data of the periodic mode */
+            uint64_t available = 0;
+            uint64_t first = sensor->periodic_start_usec + sensor->conversion_usec;
+            if (sensor->periodic_usec && now >= first)
+                available = (now - first) / sensor->periodic_usec + 1;
+            if (available > sensor->periodic_fetched) {
+                sensor->periodic_fetched = available;
+                sensor->stretching = false;
+                sim_sht3x_measure(sensor, now, now);
+            } else {
+                sensor->pending = false;
+            }
+            return true;
+        }
+        case 0x3093: /* break */
+            sensor->periodic_usec = 0;
+            return true;
+        case 0xF32D: /* read status register */
+            sim_set_result(sensor, &sensor->status, 1, now);
+            return true;
+        case 0x3041: /* clear status register */
+            sensor->status &= ~(SIM_SHT3X_STATUS_RESET |
+                                SIM_SHT3X_STATUS_COMMAND_FAILED);
+            return true;
+        case 0x30A2: /* soft reset */
+            sensor->periodic_usec = 0;
+            sensor->pending = false;
+            sensor->status = SIM_SHT3X_STATUS_RESET;
+            return true;
+        case 0x306D: /* heater on */
+            sensor->status |= SIM_SHT3X_STATUS_HEATER;
+            return true;
+        case 0x3066: /* heater off */
+            sensor->status &= ~SIM_SHT3X_STATUS_HEATER;
+            return true;
+        case 0x3780: /* serial number */
+        case 0x3682:
+            sim_set_result(sensor, sensor->serial, 2, now);
+            return true;
+        default:
+            sensor->status |= SIM_SHT3X_STATUS_COMMAND_FAILED;
+            return true;
+    }
+}
+
+static bool sim_sgp40_write(sim_sensor* sensor, const uint8_t* data,
+                            uint16_t len, uint64_t now) {
+    if (len < 2)
+        return true;
+
+    uint16_t command = (uint16_t)(data[0] << 8 | data[1]);
+    switch (command) {
+        case 0x260F: { /* measure raw signal with compensation */
+            if (len != 8 ||
+                sensirion_i2c_check_words_crc(&data[2], 2) != NO_ERROR)
+                return false;
+
+            uint16_t humidity_ticks = (uint16_t)(data[2] << 8 | data[3]);
+            float sraw = 27000.0f +
+                         1500.0f * sim_wave(now, 1800.0f, sensor->phase) +
+                         0.03f * ((float)humidity_ticks - 32768.0f) +
+                         20.0f * sim_noise(sensor);
+            uint16_t word = sim_clamp_ticks(sraw);
+            sim_set_result(sensor, &word, 1, now + SIM_SGP40_RAW_SIGNAL_USEC);
+            return true;
+        }
+        case 0x280E: { /* execute self test */
+            uint16_t word = 0xD400;
+            sim_set_result(sensor, &word, 1, now + SIM_SGP40_SELF_TEST_USEC);
+            return true;
+        }
+        case 0x3615: /* turn heater off */
+            sensor->pending = false;
+            return true;
+        case 0x3682: /* serial number */
+            sim_set_result(sensor, sensor->serial, 3, now);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* returns false if the sensor does not acknowledge the read */
+static bool sim_sensor_read(sim_sensor* sensor, uint8_t* buf, uint16_t len) {
+    if (!sensor->pending)
+        return false;
+
+    uint64_t now = sensirion_i2c_hal_get_time_usec();
+    if (now < sensor->ready_usec) {
+        if (!sensor->stretching)
+            return false;
+        sensirion_i2c_hal_sleep_until_usec(sensor->ready_usec);
+    }
+
+    for (uint16_t i = 0; i < len; i++) {
+        uint8_t byte = i < sensor->result_len ? sensor->result[i] : 0xFF;
+        buf[i] &= byte; /* open drain, several devices read as a wired AND */
+    }
+    sensor->pending = false;
+    return true;
+}
+
+static bool sim_message(sensirion_i2c_sim* sim, struct i2c_msg* msg) {
+    bool is_read = msg->flags & I2C_M_RD;
+    uint64_t now = sensirion_i2c_hal_get_time_usec();
+    bool acknowledged = false;
+
+    if (msg->addr >= SIM_MUX_ADDRESS &&
+        msg->addr < SIM_MUX_ADDRESS + sim->mux_count) {
+        uint8_t* mask = &sim->mux_mask[msg->addr - SIM_MUX_ADDRESS];
+        if (is_read) {
+            memset(msg->buf, *mask, msg->len);
+        } else if (msg->len > 0) {
+            *mask = msg->buf[msg->len - 1];
+        }
+        return true;
+    }
+
+    if (is_read)
+        memset(msg->buf, 0xFF, msg->len);
+
+    for (int mux = 0; mux < sim->mux_count; mux++) {
+        for (int port = 0; port < SIM_PORTS; port++) {
+            if (!(sim->mux_mask[mux] & (1 << port)))
+                continue;
+
+            sim_sensor* sensor = NULL;
+            bool is_sht = msg->addr == SIM_SHT3X_ADDRESS ||
+                          msg->addr == SIM_SHT3X_ALT_ADDRESS;
+            if (msg->addr == SIM_SHT3X_ADDRESS && sim->sht[mux][port].present)
+                sensor = &sim->sht[mux][port];
+            else if (msg->addr == SIM_SHT3X_ALT_ADDRESS &&
+                     sim->sht_alt[mux][port].present)
+                sensor = &sim->sht_alt[mux][port];
+            else if (msg->addr == SIM_SGP40_ADDRESS &&
+                     sim->sgp[mux][port].present)
+                sensor = &sim->sgp[mux][port];
+            if (!sensor)
+                continue;
+
+            if (is_read) {
+                acknowledged |= sim_sensor_read(sensor, msg->buf, msg->len);
+            } else if (is_sht) {
+                acknowledged |= sim_sht3x_write(sensor, msg->buf, msg->len, now);
+            } else {
+                acknowledged |= sim_sgp40_write(sensor, msg->buf, msg->len, now);
+            }
+        }
+    }
+    return acknowledged;
+}
+
+int sensirion_i2c_sim_transfer(sensirion_i2c_sim* sim, struct i2c_msg* msgs,
+                               uint32_t count) {
+    uint32_t bits = 0;
+    int ret = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        /* address byte, data bytes, each with its acknowledge bit */
+        bits += 9 * (1 + msgs[i].len) + 2;
+        if (!sim_message(sim, &msgs[i])) {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (sim->khz)
+        sensirion_i2c_hal_sleep_usec(bits * 1000 / sim->khz);
+    return ret;
+}
+
+sensirion_i2c_sim* sensirion_i2c_sim_create(const char* options,
+                                            uint8_t bus_idx) {
+    char buffer[128];
+    int mux_count = 1;
+    int sensors = -1;
+    int alt_sensors = 0;
+    uint32_t khz = 0;
+    uint32_t seed = 1;
+
+    if (strlen(options) >= sizeof(buffer))
+        return NULL;
+    strcpy(buffer, options);
+
+    char* saveptr = NULL;
+    for (char* option = strtok_r(buffer, ":", &saveptr); option;
+         option = strtok_r(NULL, ":", &saveptr)) {
+        char* value = strchr(option, '=');
+        if (!value)
+            return NULL;
+        *value++ = '\0';
+
+        if (strcmp(option, "muxes") == 0)
+            mux_count = atoi(value);
+        else if (strcmp(option, "sensors") == 0)
+            sensors = atoi(value);
+        else if (strcmp(option, "sht45") == 0)
+            alt_sensors = atoi(value);
+        else if (strcmp(option, "khz") == 0)
+            khz = (uint32_t)atoi(value);
+        else if (strcmp(option, "seed") == 0)
+            seed = (uint32_t)atoi(value);
+        else
+            return NULL;
+    }
+    if (mux_count < 0 || mux_count > SIM_MAX_MUXES)
+        return NULL;
+    if (sensors < 0 || sensors > mux_count * SIM_PORTS)
+        sensors = mux_count * SIM_PORTS;
+
+    sensirion_i2c_sim* sim = calloc(1, sizeof(*sim));
+    if (!sim)
+        return NULL;
+    sim->mux_count = mux_count;
+    sim->khz = khz;
+
+    for (int site = 0; site < sensors; site++) {
+        int mux = site / SIM_PORTS;
+        int port = site % SIM_PORTS;
+        sim_sensor* sht = &sim->sht[mux][port];
+        sim_sensor* sgp = &sim->sgp[mux][port];
+        /* the bus index in the top byte keeps serials unique across buses */
+        uint32_t id = ((uint32_t)bus_idx << 24) + seed * 1000 + (uint32_t)site;
+
+        sht->present = true;
+        sht->status = SIM_SHT3X_STATUS_RESET;
+        sht->rng = id * 2654435761u | 1;
+        sht->phase = (float)site * 0.7f;
+        sht->temperature_base = 21.0f + 0.25f * (float)site;
+        sht->humidity_base = 40.0f + (float)(site % 10);
+        sht->serial[0] = (uint16_t)(id >> 16);
+        sht->serial[1] = (uint16_t)id;
+
+        /* a second SHT3x beside the first, slightly warmer */
+        if (site < alt_sensors) {
+            sim_sensor* alt = &sim->sht_alt[mux][port];
+            *alt = *sht;
+            alt->rng = (id ^ 0x00800000u) * 2654435761u | 1;
+            alt->temperature_base += 0.2f;
+            alt->serial[0] = (uint16_t)((id ^ 0x00800000u) >> 16);
+        }
+
+        sgp->present = true;
+        sgp->rng = id * 40503u | 1;
+        sgp->phase = (float)site * 1.3f;
+        sgp->serial[0] = 0x0000;
+        sgp->serial[1] = (uint16_t)(id >> 16);
+        sgp->serial[2] = (uint16_t)id;
+    }
+    return sim;
+}
+
+void sensirion_i2c_sim_destroy(sensirion_i2c_sim* sim) {
+    free(sim);
+}
@@ -0,0 +1,71 @@
+/*
+ * Simulated i2c bus for the Linux HAL.
+ */
+
+#ifndef SENSIRION_I2C_HAL_SIM_H
+#define SENSIRION_I2C_HAL_SIM_H
+
+#include <linux/i2c.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Bus paths starting with this prefix are simulated in memory instead of
+ * being opened as an i2c-dev adapter, e.g. "sim:muxes=4:khz=400".
+ */
+#define SENSIRION_I2C_SIM_PREFIX "sim:"
+
+/**
+ * In-memory bus holding TCA9548A multiplexers at 0x70 onwards, each port
+ * populated with an SHT3x at 0x44 and an SGP40 at 0x59.
+ *
+ * The models answer the commands used by the drivers with valid CRCs and
+ * NACK reads issued before a conversion is complete, using the conversion
+ * times of the datasheets. Time is taken from
+ * sensirion_i2c_hal_get_time_usec().
+ */
+typedef struct sensirion_i2c_sim sensirion_i2c_sim;
+
+/**
+ * Create a simulated bus from a colon separated list of options, all of them
+ * optional:
+ *   muxes=N    multiplexers on the bus, 0 to 8 (default 1)
+ *   sensors=N  ports populated with a sensor pair, in order (default all)
+ *   sht45=N    of those, ports with a second SHT3x at 0x45 (default 0)
+ *   khz=N      bus clock used to delay each transfer, 0 for none (default 0)
+ *   seed=N     seed of the simulated readings (default 1)
+ *
+ * The serial numbers of the sensors are derived from the seed and the bus
+ * index, so buses with the same seed still report distinct serials.
+ *
+ * @param options Options, the part of the bus path after
+ *                SENSIRION_I2C_SIM_PREFIX
+ * @param bus_idx Index of the bus being simulated
+ * @returns the simulated bus, NULL on invalid options or allocation failure
+ */
+sensirion_i2c_sim* sensirion_i2c_sim_create(const char* options,
+                                            uint8_t bus_idx);
+
+/**
+ * Release a simulated bus.
+ */
+void sensirion_i2c_sim_destroy(sensirion_i2c_sim* sim);
+
+/**
+ * Execute a combined transaction on a simulated bus, with the semantics of
+ * ioctl(I2C_RDWR): the messages are processed in order and the transfer stops
+ * at the first message that is not acknowledged.
+ *
+ * @returns 0 on success, -1 if a message was not acknowledged
+ */
+int sensirion_i2c_sim_transfer(sensirion_i2c_sim* sim, struct i2c_msg* msgs,
+                               uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSIRION_I2C_HAL_SIM_H */
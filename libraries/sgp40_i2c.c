@@ -15,29 +15,68 @@
 #include "sensirion_common.h"
 #include "sensirion_i2c.h"
 #include "sensirion_i2c_hal.h"
+#include <string.h>
 
 #define SGP40_I2C_ADDRESS 0x59
 
-int16_t sgp40_measure_raw_signal(uint16_t relative_humidity,
-                                 uint16_t temperature, uint16_t* sraw_voc) {
-    int16_t error;
-    uint8_t buffer[8];
-    uint16_t offset = 0;
-    offset = sensirion_i2c_add_command_to_buffer(&buffer[0], offset, 0x260F);
+/* device used by the functions without context, on the thread's current bus */
+static _Thread_local sgp40_dev _default_dev = {
+    NULL, SGP40_I2C_ADDRESS, SGP40_DEFAULT_MEASURE_FRAME};
+
+static const uint8_t sgp40_default_measure_frame[8] =
+    SGP40_DEFAULT_MEASURE_FRAME;
+
+void sgp40_dev_init(sgp40_dev* dev, sensirion_i2c_hal_bus* bus) {
+    dev->bus = bus;
+    dev->i2c_address = SGP40_I2C_ADDRESS;
+    memcpy(dev->measure_frame, sgp40_default_measure_frame,
+           sizeof(dev->measure_frame));
+}
 
-    offset = sensirion_i2c_add_uint16_t_to_buffer(&buffer[0], offset,
-                                                  relative_humidity);
-    offset =
-        sensirion_i2c_add_uint16_t_to_buffer(&buffer[0], offset, temperature);
+/* Store a word and its CRC in a frame, unless the frame already holds it */
+static void sgp40_update_frame_word(uint8_t* frame, uint16_t word) {
+    uint8_t msb = (uint8_t)(word >> 8);
+    uint8_t lsb = (uint8_t)word;
 
-    error = sensirion_i2c_write_data(SGP40_I2C_ADDRESS, &buffer[0], offset);
+    if (frame[0] == msb && frame[1] == lsb) {
+        return;
+    }
+    frame[0] = msb;
+    frame[1] = lsb;
+    frame[2] = sensirion_i2c_generate_word_crc(word);
+}
+
+int16_t sgp40_dev_measure_raw_signal(sgp40_dev* dev, uint16_t relative_humidity,
+                                     uint16_t temperature, uint16_t* sraw_voc) {
+    int16_t error;
+
+    error = sgp40_dev_start_raw_signal(dev, relative_humidity, temperature);
     if (error) {
         return error;
     }
 
-    sensirion_i2c_hal_sleep_usec(30000);
+    sensirion_i2c_hal_sleep_usec(SGP40_MEASURE_RAW_SIGNAL_DURATION_US);
+
+    return sgp40_dev_read_raw_signal(dev, sraw_voc);
+}
+
+int16_t sgp40_dev_start_raw_signal(sgp40_dev* dev, uint16_t relative_humidity,
+                                   uint16_t temperature) {
+    uint8_t* frame = dev->measure_frame;
 
-    error = sensirion_i2c_read_data_inplace(SGP40_I2C_ADDRESS, &buffer[0], 2);
+    sgp40_update_frame_word(&frame[2], relative_humidity);
+    sgp40_update_frame_word(&frame[5], temperature);
+
+    return sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address, frame,
+                                        sizeof(dev->measure_frame));
+}
+
+int16_t sgp40_dev_read_raw_signal(sgp40_dev* dev, uint16_t* sraw_voc) {
+    int16_t error;
+    uint8_t buffer[3];
+
+    error = sensirion_i2c_bus_read_data_inplace(dev->bus, dev->i2c_address,
+                                                &buffer[0], 2);
     if (error) {
         return error;
     }
@@ -45,20 +84,22 @@ int16_t sgp40_measure_raw_signal(uint16_t relative_humidity,
     return NO_ERROR;
 }
 
-int16_t sgp40_execute_self_test(uint16_t* test_result) {
+int16_t sgp40_dev_execute_self_test(sgp40_dev* dev, uint16_t* test_result) {
     int16_t error;
     uint8_t buffer[3];
     uint16_t offset = 0;
     offset = sensirion_i2c_add_command_to_buffer(&buffer[0], offset, 0x280E);
 
-    error = sensirion_i2c_write_data(SGP40_I2C_ADDRESS, &buffer[0], offset);
+    error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                         &buffer[0], offset);
     if (error) {
         return error;
     }
 
     sensirion_i2c_hal_sleep_usec(320000);
 
-    error = sensirion_i2c_read_data_inplace(SGP40_I2C_ADDRESS, &buffer[0], 2);
+    error = sensirion_i2c_bus_read_data_inplace(dev->bus, dev->i2c_address,
+                                                &buffer[0], 2);
     if (error) {
         return error;
     }
@@ -66,13 +107,14 @@ int16_t sgp40_execute_self_test(uint16_t* test_result) {
     return NO_ERROR;
 }
 
-int16_t sgp40_turn_heater_off(void) {
+int16_t sgp40_dev_turn_heater_off(sgp40_dev* dev) {
     int16_t error;
     uint8_t buffer[2];
     uint16_t offset = 0;
     offset = sensirion_i2c_add_command_to_buffer(&buffer[0], offset, 0x3615);
 
-    error = sensirion_i2c_write_data(SGP40_I2C_ADDRESS, &buffer[0], offset);
+    error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                         &buffer[0], offset);
     if (error) {
         return error;
     }
@@ -80,21 +122,23 @@ int16_t sgp40_turn_heater_off(void) {
     return NO_ERROR;
 }
 
-int16_t sgp40_get_serial_number(uint16_t* serial_number,
-                                uint8_t serial_number_size) {
+int16_t sgp40_dev_get_serial_number(sgp40_dev* dev, uint16_t* serial_number,
+                                    uint8_t serial_number_size) {
     int16_t error;
     uint8_t buffer[9];
     uint16_t offset = 0;
     offset = sensirion_i2c_add_command_to_buffer(&buffer[0], offset, 0x3682);
 
-    error = sensirion_i2c_write_data(SGP40_I2C_ADDRESS, &buffer[0], offset);
+    error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                         &buffer[0], offset);
     if (error) {
         return error;
     }
 
     sensirion_i2c_hal_sleep_usec(1000);
 
-    error = sensirion_i2c_read_data_inplace(SGP40_I2C_ADDRESS, &buffer[0], 6);
+    error = sensirion_i2c_bus_read_data_inplace(dev->bus, dev->i2c_address,
+                                                &buffer[0], 6);
     if (error) {
         return error;
     }
@@ -105,3 +149,63 @@ int16_t sgp40_get_serial_number(uint16_t* serial_number,
 
     return NO_ERROR;
 }
+
+int16_t sgp40_measure_raw_signal(uint16_t relative_humidity,
+                                 uint16_t temperature, uint16_t* sraw_voc) {
+    return sgp40_dev_measure_raw_signal(&_default_dev, relative_humidity,
+                                        temperature, sraw_voc);
+}
+
+int16_t sgp40_start_raw_signal(uint16_t relative_humidity,
+                               uint16_t temperature) {
+    return sgp40_dev_start_raw_signal(&_default_dev, relative_humidity,
+                                      temperature);
+}
+
+int16_t sgp40_read_raw_signal(uint16_t* sraw_voc) {
+    return sgp40_dev_read_raw_signal(&_default_dev, sraw_voc);
+}
+
+int16_t sgp40_execute_self_test(uint16_t* test_result) {
+    return sgp40_dev_execute_self_test(&_default_dev, test_result);
+}
+
+int16_t sgp40_turn_heater_off(void) {
+    return sgp40_dev_turn_heater_off(&_default_dev);
+}
+
+int16_t sgp40_get_serial_number(uint16_t* serial_number,
+                                uint8_t serial_number_size) {
+    return sgp40_dev_get_serial_number(&_default_dev, serial_number,
+                                       serial_number_size);
+}
+
+int16_t sgp40_dev_measurement_issue(sgp40_dev* dev,
+                                    sgp40_measurement* measurement,
+                                    uint16_t relative_humidity,
+                                    uint16_t temperature) {
+    measurement->error =
+        sgp40_dev_start_raw_signal(dev, relative_humidity, temperature);
+    if (measurement->error) {
+        measurement->state = SGP40_MEASUREMENT_FAILED;
+        return measurement->error;
+    }
+    measurement->ready_usec =
+        sensirion_i2c_hal_get_time_usec() + SGP40_MEASURE_RAW_SIGNAL_DURATION_US;
+    measurement->state = SGP40_MEASUREMENT_CONVERTING;
+    return NO_ERROR;
+}
+
+bool sgp40_measurement_is_due(const sgp40_measurement* measurement,
+                              uint64_t now_usec) {
+    return measurement->state == SGP40_MEASUREMENT_CONVERTING &&
+           now_usec >= measurement->ready_usec;
+}
+
+int16_t sgp40_dev_measurement_fetch(sgp40_dev* dev,
+                                    sgp40_measurement* measurement) {
+    measurement->error = sgp40_dev_read_raw_signal(dev, &measurement->sraw_voc);
+    measurement->state = measurement->error ? SGP40_MEASUREMENT_FAILED
+                                            : SGP40_MEASUREMENT_DONE;
+    return measurement->error;
+}
@@ -19,6 +19,58 @@ extern "C" {
 #endif
 
 #include "sensirion_config.h"
+#include "sensirion_i2c_hal.h"
+
+#define SGP40_MEASURE_RAW_SIGNAL_DURATION_US 30000
+
+/**
+ * Context of one SGP40 sensor for the reentrant sgp40_dev_*() functions. The
+ * functions without context operate on a per-thread default sensor on the bus
+ * selected by the calling thread.
+ */
+typedef struct {
+    sensirion_i2c_hal_bus* bus; /* NULL for the calling thread's bus */
+    uint8_t i2c_address;
+    uint8_t measure_frame[8]; /* last raw signal command, see below */
+} sgp40_dev;
+
+/**
+ * Raw signal command with the default compensation (50 %RH, 25 °C). The
+ * measure_frame of a context starts from it and only the argument words that
+ * change between two measurements get their CRC recomputed.
+ */
+#define SGP40_DEFAULT_MEASURE_FRAME \
+    { 0x26, 0x0F, 0x80, 0x00, 0xA2, 0x66, 0x66, 0x93 }
+
+typedef enum {
+    SGP40_MEASUREMENT_IDLE,
+    SGP40_MEASUREMENT_CONVERTING,
+    SGP40_MEASUREMENT_DONE,
+    SGP40_MEASUREMENT_FAILED,
+} sgp40_measurement_state;
+
+/**
+ * Non-blocking raw signal measurement. It is issued with
+ * sgp40_dev_measurement_issue(), which returns without waiting for the
+ * conversion, and fetched with sgp40_dev_measurement_fetch() once
+ * sgp40_measurement_is_due().
+ */
+typedef struct {
+    sgp40_measurement_state state;
+    uint64_t ready_usec; /* sensirion_i2c_hal_get_time_usec() of the result */
+    uint16_t sraw_voc;
+    int16_t error;
+} sgp40_measurement;
+
+/**
+ * sgp40_dev_init() - Initialize a sensor context
+ *
+ * @param dev Context to initialize
+ *
+ * @param bus Bus the sensor is connected to, NULL for the bus selected by the
+ * calling thread
+ */
+void sgp40_dev_init(sgp40_dev* dev, sensirion_i2c_hal_bus* bus);
 
 /**
  * sgp40_measure_raw_signal() - This command starts/continues the VOC
@@ -41,6 +93,34 @@ extern "C" {
 int16_t sgp40_measure_raw_signal(uint16_t relative_humidity,
                                  uint16_t temperature, uint16_t* sraw_voc);
 
+/**
+ * sgp40_start_raw_signal() - This command starts a VOC measurement without
+ * waiting for the result. The raw signal is available
+ * SGP40_MEASURE_RAW_SIGNAL_DURATION_US after this call and must be fetched
+ * with sgp40_read_raw_signal().
+ *
+ * @param relative_humidity Humidity compensation in ticks, see
+ * sgp40_measure_raw_signal()
+ *
+ * @param temperature Temperature compensation in ticks, see
+ * sgp40_measure_raw_signal()
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t sgp40_start_raw_signal(uint16_t relative_humidity,
+                               uint16_t temperature);
+
+/**
+ * sgp40_read_raw_signal() - This command fetches the result of a measurement
+ * previously started with sgp40_start_raw_signal()
+ *
+ * @param sraw_voc u16 unsigned integer directly provides the raw signal
+ * SRAW_VOC in ticks
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t sgp40_read_raw_signal(uint16_t* sraw_voc);
+
 /**
  * sgp40_execute_self_test() - This command triggers the built-in self-test
  * checking for integrity of the hotplate and MOX material and returns the
@@ -72,6 +152,60 @@ int16_t sgp40_turn_heater_off(void);
 int16_t sgp40_get_serial_number(uint16_t* serial_number,
                                 uint8_t serial_number_size);
 
+/**
+ * Reentrant versions of the functions above, operating on the sensor described
+ * by dev.
+ */
+int16_t sgp40_dev_measure_raw_signal(sgp40_dev* dev, uint16_t relative_humidity,
+                                     uint16_t temperature, uint16_t* sraw_voc);
+
+int16_t sgp40_dev_start_raw_signal(sgp40_dev* dev, uint16_t relative_humidity,
+                                   uint16_t temperature);
+
+int16_t sgp40_dev_read_raw_signal(sgp40_dev* dev, uint16_t* sraw_voc);
+
+int16_t sgp40_dev_execute_self_test(sgp40_dev* dev, uint16_t* test_result);
+
+int16_t sgp40_dev_turn_heater_off(sgp40_dev* dev);
+
+int16_t sgp40_dev_get_serial_number(sgp40_dev* dev, uint16_t* serial_number,
+                                    uint8_t serial_number_size);
+
+/**
+ * sgp40_dev_measurement_issue() - Start a compensated raw signal measurement
+ * and return at once. The measurement becomes due after
+ * SGP40_MEASURE_RAW_SIGNAL_DURATION_US.
+ *
+ * @param measurement State of the measurement, CONVERTING on success and
+ * FAILED otherwise
+ *
+ * @param relative_humidity Humidity ticks, see sgp40_measure_raw_signal()
+ *
+ * @param temperature Temperature ticks, see sgp40_measure_raw_signal()
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t sgp40_dev_measurement_issue(sgp40_dev* dev,
+                                    sgp40_measurement* measurement,
+                                    uint16_t relative_humidity,
+                                    uint16_t temperature);
+
+/**
+ * sgp40_measurement_is_due() - Tell whether a measurement is converting and
+ * its result is available at now_usec
+ */
+bool sgp40_measurement_is_due(const sgp40_measurement* measurement,
+                              uint64_t now_usec);
+
+/**
+ * sgp40_dev_measurement_fetch() - Read the result of a due measurement, which
+ * becomes DONE, or FAILED on error
+ *
+ * @return 0 on success, an error code otherwise
+ */
+int16_t sgp40_dev_measurement_fetch(sgp40_dev* dev,
+                                    sgp40_measurement* measurement);
+
 #ifdef __cplusplus
 }
 #endif
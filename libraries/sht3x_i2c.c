@@ -43,12 +43,17 @@
 
 #define sensirion_hal_sleep_us sensirion_i2c_hal_sleep_usec
 
-static uint8_t communication_buffer[6] = {0};
-
-static uint8_t _i2c_address;
+/* sensor used by the functions without context, on the thread's current bus */
+static _Thread_local sht3x_dev _default_dev;
 
 void sht3x_init(uint8_t i2c_address) {
-    _i2c_address = i2c_address;
+    sht3x_dev_init(&_default_dev, NULL, i2c_address);
+}
+
+void sht3x_dev_init(sht3x_dev* dev, sensirion_i2c_hal_bus* bus,
+                    uint8_t i2c_address) {
+    dev->bus = bus;
+    dev->i2c_address = i2c_address;
 }
 
 float signal_temperature(uint16_t temperature_ticks) {
@@ -118,6 +123,243 @@ int16_t sht3x_measure_single_shot(repeatability measurement_repeatability,
     return local_error;
 }
 
+int16_t sht3x_dev_start_single_shot(sht3x_dev* dev,
+                                    repeatability measurement_repeatability,
+                                    bool is_clock_stretching) {
+    int16_t local_error = NO_ERROR;
+    uint8_t* buffer_ptr = dev->communication_buffer;
+    uint16_t local_offset = 0;
+    uint16_t command = 0;
+    if (measurement_repeatability == REPEATABILITY_MEDIUM) {
+        command =
+            is_clock_stretching
+                ? MEASURE_SINGLE_SHOT_MEDIUM_REPEATABILITY_CLOCK_STRETCHING_CMD_ID
+                : MEASURE_SINGLE_SHOT_MEDIUM_REPEATABILITY_CMD_ID;
+    } else if (measurement_repeatability == REPEATABILITY_LOW) {
+        command =
+            is_clock_stretching
+                ? MEASURE_SINGLE_SHOT_LOW_REPEATABILITY_CLOCK_STRETCHING_CMD_ID
+                : MEASURE_SINGLE_SHOT_LOW_REPEATABILITY_CMD_ID;
+    } else {
+        command =
+            is_clock_stretching
+                ? MEASURE_SINGLE_SHOT_HIGH_REPEATABILITY_CLOCK_STRETCHING_CMD_ID
+                : MEASURE_SINGLE_SHOT_HIGH_REPEATABILITY_CMD_ID;
+    }
+    local_offset =
+        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, command);
+    local_error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                               buffer_ptr, local_offset);
+    return local_error;
+}
+
+int16_t sht3x_dev_read_single_shot(sht3x_dev* dev,
+                                   uint16_t* temperature_ticks,
+                                   uint16_t* humidity_ticks) {
+    int16_t local_error = NO_ERROR;
+    uint8_t* buffer_ptr = dev->communication_buffer;
+    local_error = sensirion_i2c_bus_read_data_inplace(
+        dev->bus, dev->i2c_address, buffer_ptr, 4);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    *temperature_ticks = sensirion_common_bytes_to_uint16_t(&buffer_ptr[0]);
+    *humidity_ticks = sensirion_common_bytes_to_uint16_t(&buffer_ptr[2]);
+    return local_error;
+}
+
+int16_t sht3x_dev_measure_single_shot(sht3x_dev* dev,
+                                      repeatability measurement_repeatability,
+                                      bool is_clock_stretching,
+                                      uint16_t* temperature_ticks,
+                                      uint16_t* humidity_ticks) {
+    int16_t local_error = NO_ERROR;
+    local_error = sht3x_dev_start_single_shot(dev, measurement_repeatability,
+                                              is_clock_stretching);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    sensirion_i2c_hal_sleep_usec(
+        sht3x_single_shot_duration_us(measurement_repeatability));
+    return sht3x_dev_read_single_shot(dev, temperature_ticks, humidity_ticks);
+}
+
+int16_t sht3x_dev_read_status_register(sht3x_dev* dev,
+                                       uint16_t* status_register) {
+    int16_t local_error = NO_ERROR;
+    uint8_t* buffer_ptr = dev->communication_buffer;
+    uint16_t local_offset = 0;
+    local_offset =
+        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0xf32d);
+    local_error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                               buffer_ptr, local_offset);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    sensirion_i2c_hal_sleep_usec(10 * 1000);
+    local_error = sensirion_i2c_bus_read_data_inplace(
+        dev->bus, dev->i2c_address, buffer_ptr, 2);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    *status_register = sensirion_common_bytes_to_uint16_t(&buffer_ptr[0]);
+    return local_error;
+}
+
+int16_t sht3x_dev_read_serial_number(sht3x_dev* dev, uint32_t* serial_number) {
+    int16_t local_error = NO_ERROR;
+    uint8_t* buffer_ptr = dev->communication_buffer;
+    uint16_t local_offset = 0;
+    local_offset =
+        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x3780);
+    local_error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                               buffer_ptr, local_offset);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    sensirion_i2c_hal_sleep_usec(1 * 1000);
+    local_error = sensirion_i2c_bus_read_data_inplace(
+        dev->bus, dev->i2c_address, buffer_ptr, 4);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    *serial_number = sensirion_common_bytes_to_uint32_t(&buffer_ptr[0]);
+    return local_error;
+}
+
+int16_t sht3x_dev_read_measurement(sht3x_dev* dev, uint16_t* temperature_ticks,
+                                   uint16_t* humidity_ticks) {
+    int16_t local_error = NO_ERROR;
+    uint8_t* buffer_ptr = dev->communication_buffer;
+    uint16_t local_offset = 0;
+    local_offset =
+        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0xe000);
+    local_error = sensirion_i2c_bus_write_read_data_inplace(
+        dev->bus, dev->i2c_address, buffer_ptr, local_offset, 4);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    *temperature_ticks = sensirion_common_bytes_to_uint16_t(&buffer_ptr[0]);
+    *humidity_ticks = sensirion_common_bytes_to_uint16_t(&buffer_ptr[2]);
+    return local_error;
+}
+
+/* Send a command without arguments, then give the sensor time to process it */
+static int16_t sht3x_dev_send_command(sht3x_dev* dev, uint16_t command,
+                                      uint32_t delay_us) {
+    int16_t local_error = NO_ERROR;
+    uint8_t* buffer_ptr = dev->communication_buffer;
+    uint16_t local_offset = 0;
+    local_offset =
+        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, command);
+    local_error = sensirion_i2c_bus_write_data(dev->bus, dev->i2c_address,
+                                               buffer_ptr, local_offset);
+    if (local_error != NO_ERROR) {
+        return local_error;
+    }
+    if (delay_us) {
+        sensirion_i2c_hal_sleep_usec(delay_us);
+    }
+    return local_error;
+}
+
+int16_t sht3x_dev_start_periodic_measurement(
+    sht3x_dev* dev, repeatability measurement_repeatability,
+    mps measurements_per_second) {
+    /* commands of each rate, by repeatability low, medium and high */
+    static const uint16_t commands[][3] = {
+        {START_MEASUREMENT_0_5_MPS_LOW_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_0_5_MPS_MEDIUM_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_0_5_MPS_HIGH_REPEATABILITY_CMD_ID},
+        {START_MEASUREMENT_1_MPS_LOW_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_1_MPS_MEDIUM_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_1_MPS_HIGH_REPEATABILITY_CMD_ID},
+        {START_MEASUREMENT_2_MPS_LOW_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_2_MPS_MEDIUM_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_2_MPS_HIGH_REPEATABILITY_CMD_ID},
+        {START_MEASUREMENT_4_MPS_LOW_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_4_MPS_MEDIUM_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_4_MPS_HIGH_REPEATABILITY_CMD_ID},
+        {START_MEASUREMENT_10_MPS_LOW_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_10_MPS_MEDIUM_REPEATABILITY_CMD_ID,
+         START_MEASUREMENT_10_MPS_HIGH_REPEATABILITY_CMD_ID},
+    };
+    static const uint32_t delays_us[3] = {5 * 1000, 7 * 1000, 16 * 1000};
+    int rate;
+    switch (measurements_per_second) {
+        case MPS_EVERY_TWO_SECONDS:
+            rate = 0;
+            break;
+        case MPS_ONE_PER_SECOND:
+            rate = 1;
+            break;
+        case MPS_TWO_PER_SECOND:
+            rate = 2;
+            break;
+        case MPS_FOUR_PER_SECOND:
+            rate = 3;
+            break;
+        case MPS_TEN_PER_SECOND:
+            rate = 4;
+            break;
+        default:
+            return NOT_IMPLEMENTED_ERROR;
+    }
+    if (measurement_repeatability > REPEATABILITY_HIGH) {
+        return NOT_IMPLEMENTED_ERROR;
+    }
+    return sht3x_dev_send_command(dev,
+                                  commands[rate][measurement_repeatability],
+                                  delays_us[measurement_repeatability]);
+}
+
+int16_t sht3x_dev_start_art_measurement(sht3x_dev* dev) {
+    return sht3x_dev_send_command(dev, START_ART_MEASUREMENT_CMD_ID, 0);
+}
+
+int16_t sht3x_dev_stop_measurement(sht3x_dev* dev) {
+    return sht3x_dev_send_command(dev, STOP_MEASUREMENT_CMD_ID, 1 * 1000);
+}
+
+int16_t sht3x_dev_enable_heater(sht3x_dev* dev) {
+    return sht3x_dev_send_command(dev, ENABLE_HEATER_CMD_ID, 10 * 1000);
+}
+
+int16_t sht3x_dev_disable_heater(sht3x_dev* dev) {
+    return sht3x_dev_send_command(dev, DISABLE_HEATER_CMD_ID, 10 * 1000);
+}
+
+int16_t sht3x_dev_clear_status_register(sht3x_dev* dev) {
+    return sht3x_dev_send_command(dev, CLEAR_STATUS_REGISTER_CMD_ID,
+                                  10 * 1000);
+}
+
+int16_t sht3x_dev_soft_reset(sht3x_dev* dev) {
+    return sht3x_dev_send_command(dev, SOFT_RESET_CMD_ID, 2 * 1000);
+}
+
+int16_t sht3x_start_single_shot(repeatability measurement_repeatability,
+                                bool is_clock_stretching) {
+    return sht3x_dev_start_single_shot(&_default_dev, measurement_repeatability,
+                                       is_clock_stretching);
+}
+
+int16_t sht3x_read_single_shot(uint16_t* temperature_ticks,
+                               uint16_t* humidity_ticks) {
+    return sht3x_dev_read_single_shot(&_default_dev, temperature_ticks,
+                                      humidity_ticks);
+}
+
+uint32_t
+sht3x_single_shot_duration_us(repeatability measurement_repeatability) {
+    if (measurement_repeatability == REPEATABILITY_MEDIUM) {
+        return 7 * 1000;
+    } else if (measurement_repeatability == REPEATABILITY_LOW) {
+        return 5 * 1000;
+    }
+    return 16 * 1000;
+}
+
 int16_t
 sht3x_start_periodic_measurement(repeatability measurement_repeatability,
                                  mps messages_per_second) {
@@ -257,17 +499,18 @@ int16_t
 sht3x_measure_single_shot_high_repeatability(uint16_t* temperature_ticks,
                                              uint16_t* humidity_ticks) {
     int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
+    uint8_t* buffer_ptr = _default_dev.communication_buffer;
     uint16_t local_offset = 0;
     local_offset =
         sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2400);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
+    local_error = sensirion_i2c_write_data(_default_dev.i2c_address,
+                                           buffer_ptr, local_offset);
     if (local_error != NO_ERROR) {
         return local_error;
     }
     sensirion_i2c_hal_sleep_usec(16 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
+    local_error = sensirion_i2c_read_data_inplace(_default_dev.i2c_address,
+                                                  buffer_ptr, 4);
     if (local_error != NO_ERROR) {
         return local_error;
     }
@@ -279,17 +522,18 @@ sht3x_measure_single_shot_high_repeatability(uint16_t* temperature_ticks,
 int16_t sht3x_measure_single_shot_high_repeatability_clock_stretching(
     uint16_t* temperature_ticks, uint16_t* humidity_ticks) {
     int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
+    uint8_t* buffer_ptr = _default_dev.communication_buffer;
     uint16_t local_offset = 0;
     local_offset =
         sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2c06);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
+    local_error = sensirion_i2c_write_data(_default_dev.i2c_address,
+                                           buffer_ptr, local_offset);
     if (local_error != NO_ERROR) {
         return local_error;
     }
     sensirion_i2c_hal_sleep_usec(16 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
+    local_error = sensirion_i2c_read_data_inplace(_default_dev.i2c_address,
+                                                  buffer_ptr, 4);
     if (local_error != NO_ERROR) {
         return local_error;
     }
@@ -302,17 +546,18 @@ int16_t
 sht3x_measure_single_shot_medium_repeatability(uint16_t* temperature_ticks,
                                                uint16_t* humidity_ticks) {
     int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
+    uint8_t* buffer_ptr = _default_dev.communication_buffer;
     uint16_t local_offset = 0;
     local_offset =
         sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x240b);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
+    local_error = sensirion_i2c_write_data(_default_dev.i2c_address,
+                                           buffer_ptr, local_offset);
     if (local_error != NO_ERROR) {
         return local_error;
     }
     sensirion_i2c_hal_sleep_usec(7 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
+    local_error = sensirion_i2c_read_data_inplace(_default_dev.i2c_address,
+                                                  buffer_ptr, 4);
     if (local_error != NO_ERROR) {
         return local_error;
     }
@@ -324,17 +569,18 @@ sht3x_measure_single_shot_medium_repeatability(uint16_t* temperature_ticks,
 int16_t sht3x_measure_single_shot_medium_repeatability_clock_stretching(
     uint16_t* temperature_ticks, uint16_t* humidity_ticks) {
     int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
+    uint8_t* buffer_ptr = _default_dev.communication_buffer;
     uint16_t local_offset = 0;
     local_offset =
         sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2c0d);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
+    local_error = sensirion_i2c_write_data(_default_dev.i2c_address,
+                                           buffer_ptr, local_offset);
     if (local_error != NO_ERROR) {
         return local_error;
     }
     sensirion_i2c_hal_sleep_usec(7 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
+    local_error = sensirion_i2c_read_data_inplace(_default_dev.i2c_address,
+                                                  buffer_ptr, 4);
     if (local_error != NO_ERROR) {
         return local_error;
     }
@@ -346,17 +592,18 @@ int16_t sht3x_measure_single_shot_medium_repeatability_clock_stretching(
 int16_t sht3x_measure_single_shot_low_repeatability(uint16_t* temperature_ticks,
                                                     uint16_t* humidity_ticks) {
     int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
+    uint8_t* buffer_ptr = _default_dev.communication_buffer;
     uint16_t local_offset = 0;
     local_offset =
         sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2416);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
+    local_error = sensirion_i2c_write_data(_default_dev.i2c_address,
+                                           buffer_ptr, local_offset);
     if (local_error != NO_ERROR) {
         return local_error;
     }
     sensirion_i2c_hal_sleep_usec(5 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
+    local_error = sensirion_i2c_read_data_inplace(_default_dev.i2c_address,
+                                                  buffer_ptr, 4);
     if (local_error != NO_ERROR) {
         return local_error;
     }
@@ -368,17 +615,18 @@ int16_t sht3x_measure_single_shot_low_repeatability(uint16_t* temperature_ticks,
 int16_t sht3x_measure_single_shot_low_repeatability_clock_stretching(
     uint16_t* temperature_ticks, uint16_t* humidity_ticks) {
     int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
+    uint8_t* buffer_ptr = _default_dev.communication_buffer;
     uint16_t local_offset = 0;
     local_offset =
         sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2c10);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
+    local_error = sensirion_i2c_write_data(_default_dev.i2c_address,
+                                           buffer_ptr, local_offset);
     if (local_error != NO_ERROR) {
         return local_error;
     }
     sensirion_i2c_hal_sleep_usec(5 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
+    local_error = sensirion_i2c_read_data_inplace(_default_dev.i2c_address,
+                                                  buffer_ptr, 4);
     if (local_error != NO_ERROR) {
         return local_error;
     }
@@ -388,356 +636,142 @@ int16_t sht3x_measure_single_shot_low_repeatability_clock_stretching(
 }
 
 int16_t sht3x_start_measurement_0_5_mps_high_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2032);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(16 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_HIGH, MPS_EVERY_TWO_SECONDS);
 }
 
 int16_t sht3x_start_measurement_0_5_mps_medium_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2024);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(7 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_MEDIUM, MPS_EVERY_TWO_SECONDS);
 }
 
 int16_t sht3x_start_measurement_0_5_mps_low_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x202f);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(5 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_LOW, MPS_EVERY_TWO_SECONDS);
 }
 
 int16_t sht3x_start_measurement_1_mps_high_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2130);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(16 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_HIGH, MPS_ONE_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_1_mps_medium_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2126);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(7 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_MEDIUM, MPS_ONE_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_1_mps_low_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x212d);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(5 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_LOW, MPS_ONE_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_2_mps_high_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2236);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(16 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_HIGH, MPS_TWO_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_2_mps_medium_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2220);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(7 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_MEDIUM, MPS_TWO_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_2_mps_low_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x222b);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(5 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_LOW, MPS_TWO_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_4_mps_high_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2334);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(16 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_HIGH, MPS_FOUR_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_4_mps_medium_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2322);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(7 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_MEDIUM, MPS_FOUR_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_4_mps_low_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2329);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(5 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_LOW, MPS_FOUR_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_10_mps_high_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2737);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(16 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_HIGH, MPS_TEN_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_10_mps_medium_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2721);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(7 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_MEDIUM, MPS_TEN_PER_SECOND);
 }
 
 int16_t sht3x_start_measurement_10_mps_low_repeatability() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x273a);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(5 * 1000);
-    return local_error;
+    return sht3x_dev_start_periodic_measurement(
+        &_default_dev, REPEATABILITY_LOW, MPS_TEN_PER_SECOND);
 }
 
 int16_t sht3x_start_art_measurement() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x2b32);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    return local_error;
+    return sht3x_dev_start_art_measurement(&_default_dev);
 }
 
 int16_t sht3x_read_measurement(uint16_t* temperature_ticks,
                                uint16_t* humidity_ticks) {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0xe000);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 4);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    *temperature_ticks = sensirion_common_bytes_to_uint16_t(&buffer_ptr[0]);
-    *humidity_ticks = sensirion_common_bytes_to_uint16_t(&buffer_ptr[2]);
-    return local_error;
+    return sht3x_dev_read_measurement(&_default_dev, temperature_ticks,
+                                      humidity_ticks);
 }
 
 int16_t sht3x_stop_measurement() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x3093);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(1 * 1000);
-    return local_error;
+    return sht3x_dev_stop_measurement(&_default_dev);
 }
 
 int16_t sht3x_enable_heater() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x306d);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(10 * 1000);
-    return local_error;
+    return sht3x_dev_enable_heater(&_default_dev);
 }
 
 int16_t sht3x_disable_heater() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x3066);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(10 * 1000);
-    return local_error;
+    return sht3x_dev_disable_heater(&_default_dev);
 }
 
 int16_t ll_sht3x_read_status_register(uint16_t* status_register) {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0xf32d);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(10 * 1000);
-    local_error = sensirion_i2c_read_data_inplace(_i2c_address, buffer_ptr, 2);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    *status_register = sensirion_common_bytes_to_uint16_t(&buffer_ptr[0]);
-    return local_error;
+    return sht3x_dev_read_status_register(&_default_dev, status_register);
 }
 
 int16_t sht3x_clear_status_register() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x3041);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(10 * 1000);
-    return local_error;
+    return sht3x_dev_clear_status_register(&_default_dev);
 }
 
 int16_t sht3x_soft_reset() {
-    int16_t local_error = NO_ERROR;
-    uint8_t* buffer_ptr = communication_buffer;
-    uint16_t local_offset = 0;
-    local_offset =
-        sensirion_i2c_add_command_to_buffer(buffer_ptr, local_offset, 0x30a2);
-    local_error =
-        sensirion_i2c_write_data(_i2c_address, buffer_ptr, local_offset);
-    if (local_error != NO_ERROR) {
-        return local_error;
-    }
-    sensirion_i2c_hal_sleep_usec(2 * 1000);
-    return local_error;
+    return sht3x_dev_soft_reset(&_default_dev);
+}
+
+int16_t sht3x_dev_measurement_issue(sht3x_dev* dev,
+                                    sht3x_measurement* measurement,
+                                    repeatability measurement_repeatability) {
+    measurement->error =
+        sht3x_dev_start_single_shot(dev, measurement_repeatability, false);
+    if (measurement->error != NO_ERROR) {
+        measurement->state = SHT3X_MEASUREMENT_FAILED;
+        return measurement->error;
+    }
+    measurement->ready_usec =
+        sensirion_i2c_hal_get_time_usec() +
+        sht3x_single_shot_duration_us(measurement_repeatability);
+    measurement->state = SHT3X_MEASUREMENT_CONVERTING;
+    return NO_ERROR;
+}
+
+bool sht3x_measurement_is_due(const sht3x_measurement* measurement,
+                              uint64_t now_usec) {
+    return measurement->state == SHT3X_MEASUREMENT_CONVERTING &&
+           now_usec >= measurement->ready_usec;
+}
+
+int16_t sht3x_dev_measurement_fetch(sht3x_dev* dev,
+                                    sht3x_measurement* measurement) {
+    measurement->error = sht3x_dev_read_single_shot(
+        dev, &measurement->temperature_ticks, &measurement->humidity_ticks);
+    measurement->state = measurement->error == NO_ERROR
+                             ? SHT3X_MEASUREMENT_DONE
+                             : SHT3X_MEASUREMENT_FAILED;
+    return measurement->error;
 }
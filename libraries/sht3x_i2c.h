@@ -44,6 +44,7 @@ extern "C" {
 #endif
 
 #include "sensirion_config.h"
+#include "sensirion_i2c_hal.h"
 #define SHT30A_I2C_ADDR_44 0x44
 #define SHT30A_I2C_ADDR_45 0x45
 #define SHT30_I2C_ADDR_44 0x44
@@ -89,6 +90,7 @@ typedef enum {
     READ_STATUS_REGISTER_CMD_ID = 0xf32d,
     CLEAR_STATUS_REGISTER_CMD_ID = 0x3041,
     SOFT_RESET_CMD_ID = 0x30a2,
+    READ_SERIAL_NUMBER_CMD_ID = 0x3780,
 } cmd_id_t;
 
 typedef enum {
@@ -105,6 +107,43 @@ typedef enum {
     MPS_TEN_PER_SECOND = 10,
 } mps;
 
+/**
+ * @brief Context of one SHT3x sensor
+ *
+ * Used by the reentrant sht3x_dev_*() functions, so that sensors on several
+ * buses, or at 0x44 and 0x45 on the same bus, can be driven independently. The
+ * functions without context operate on a per-thread default sensor set up by
+ * sht3x_init().
+ */
+typedef struct {
+    sensirion_i2c_hal_bus* bus; /* NULL for the calling thread's bus */
+    uint8_t i2c_address;
+    uint8_t communication_buffer[6];
+} sht3x_dev;
+
+typedef enum {
+    SHT3X_MEASUREMENT_IDLE,
+    SHT3X_MEASUREMENT_CONVERTING,
+    SHT3X_MEASUREMENT_DONE,
+    SHT3X_MEASUREMENT_FAILED,
+} sht3x_measurement_state;
+
+/**
+ * @brief Non-blocking single shot measurement
+ *
+ * A measurement is issued with sht3x_dev_measurement_issue(), which returns
+ * without waiting for the conversion, and fetched with
+ * sht3x_dev_measurement_fetch() once sht3x_measurement_is_due(). The caller
+ * decides when to fetch, so one thread can keep many measurements in flight.
+ */
+typedef struct {
+    sht3x_measurement_state state;
+    uint64_t ready_usec; /* sensirion_i2c_hal_get_time_usec() of the result */
+    uint16_t temperature_ticks;
+    uint16_t humidity_ticks;
+    int16_t error;
+} sht3x_measurement;
+
 /**
  * @brief Initialize i2c address of driver
  *
@@ -113,6 +152,17 @@ typedef enum {
  */
 void sht3x_init(uint8_t i2c_address);
 
+/**
+ * @brief Initialize a sensor context
+ *
+ * @param[out] dev Context to initialize
+ * @param[in] bus Bus the sensor is connected to, NULL for the bus selected by
+ * the calling thread
+ * @param[in] i2c_address Used i2c address
+ */
+void sht3x_dev_init(sht3x_dev* dev, sensirion_i2c_hal_bus* bus,
+                    uint8_t i2c_address);
+
 /**
  * @brief signal_temperature
  *
@@ -147,6 +197,43 @@ int16_t sht3x_measure_single_shot(repeatability measurement_repeatability,
                                   bool is_clock_stretching,
                                   uint16_t* a_temperature, uint16_t* a_humidity);
 
+/**
+ * @brief Start a single shot measurement without waiting for the result
+ *
+ * The measurement is available after sht3x_single_shot_duration_us() and must
+ * be fetched with sht3x_read_single_shot(). Clock stretching should be
+ * disabled when other transactions run on the bus during the conversion.
+ *
+ * @param[in] measurement_repeatability The repeatability of the measurement
+ * @param[in] is_clock_stretching Toggle clock stretching
+ *
+ * @return error_code 0 on success, an error code otherwise.
+ */
+int16_t sht3x_start_single_shot(repeatability measurement_repeatability,
+                                bool is_clock_stretching);
+
+/**
+ * @brief Fetch the result of a single shot measurement
+ *
+ * @param[out] temperature_ticks Raw in ticks
+ * @param[out] humidity_ticks Raw in ticks
+ *
+ * @return error_code 0 on success, an error code otherwise.
+ */
+int16_t sht3x_read_single_shot(uint16_t* temperature_ticks,
+                               uint16_t* humidity_ticks);
+
+/**
+ * @brief Conversion time of a single shot measurement
+ *
+ * @param[in] measurement_repeatability The repeatability of the measurement
+ *
+ * @return Time in microseconds to wait between sht3x_start_single_shot() and
+ * sht3x_read_single_shot()
+ */
+uint32_t
+sht3x_single_shot_duration_us(repeatability measurement_repeatability);
+
 /**
  * @brief sht3x_start_periodic_measurement
  *
@@ -531,6 +618,122 @@ int16_t sht3x_clear_status_register();
  */
 int16_t sht3x_soft_reset();
 
+/**
+ * @brief Reentrant versions of sht3x_start_single_shot(),
+ * sht3x_read_single_shot(), sht3x_measure_single_shot(),
+ * ll_sht3x_read_status_register() and sht3x_read_measurement(), operating on
+ * the sensor described by dev.
+ */
+int16_t sht3x_dev_start_single_shot(sht3x_dev* dev,
+                                    repeatability measurement_repeatability,
+                                    bool is_clock_stretching);
+
+int16_t sht3x_dev_read_single_shot(sht3x_dev* dev,
+                                   uint16_t* temperature_ticks,
+                                   uint16_t* humidity_ticks);
+
+int16_t sht3x_dev_measure_single_shot(sht3x_dev* dev,
+                                      repeatability measurement_repeatability,
+                                      bool is_clock_stretching,
+                                      uint16_t* temperature_ticks,
+                                      uint16_t* humidity_ticks);
+
+int16_t sht3x_dev_read_status_register(sht3x_dev* dev,
+                                       uint16_t* status_register);
+
+int16_t sht3x_dev_read_measurement(sht3x_dev* dev, uint16_t* temperature_ticks,
+                                   uint16_t* humidity_ticks);
+
+/**
+ * @brief sht3x_dev_start_periodic_measurement
+ *
+ * Start the periodic measurement mode, the reentrant version of the
+ * sht3x_start_measurement_*_mps_*_repeatability() functions. Results are read
+ * with sht3x_dev_read_measurement() until sht3x_dev_stop_measurement().
+ *
+ * @param[in] dev Sensor to start
+ * @param[in] measurement_repeatability Repeatability of the measurements
+ * @param[in] measurements_per_second Measurement rate
+ *
+ * @return error_code 0 on success, an error code otherwise.
+ */
+int16_t sht3x_dev_start_periodic_measurement(
+    sht3x_dev* dev, repeatability measurement_repeatability,
+    mps measurements_per_second);
+
+/**
+ * @brief Reentrant versions of sht3x_start_art_measurement(),
+ * sht3x_stop_measurement(), sht3x_enable_heater(), sht3x_disable_heater(),
+ * sht3x_clear_status_register() and sht3x_soft_reset(), operating on the
+ * sensor described by dev.
+ */
+int16_t sht3x_dev_start_art_measurement(sht3x_dev* dev);
+
+int16_t sht3x_dev_stop_measurement(sht3x_dev* dev);
+
+int16_t sht3x_dev_enable_heater(sht3x_dev* dev);
+
+int16_t sht3x_dev_disable_heater(sht3x_dev* dev);
+
+int16_t sht3x_dev_clear_status_register(sht3x_dev* dev);
+
+int16_t sht3x_dev_soft_reset(sht3x_dev* dev);
+
+/**
+ * @brief sht3x_dev_measurement_issue
+ *
+ * Start a single shot measurement without clock stretching and return at
+ * once. The measurement becomes due after sht3x_single_shot_duration_us().
+ *
+ * @param[in] dev Sensor to measure
+ * @param[out] measurement State of the measurement, CONVERTING on success and
+ * FAILED otherwise
+ * @param[in] measurement_repeatability Repeatability of the measurement
+ *
+ * @return error_code 0 on success, an error code otherwise.
+ */
+int16_t sht3x_dev_measurement_issue(sht3x_dev* dev,
+                                    sht3x_measurement* measurement,
+                                    repeatability measurement_repeatability);
+
+/**
+ * @brief sht3x_measurement_is_due
+ *
+ * @param[in] measurement Measurement to check
+ * @param[in] now_usec Current sensirion_i2c_hal_get_time_usec()
+ *
+ * @return true if the measurement is converting and its result is available
+ */
+bool sht3x_measurement_is_due(const sht3x_measurement* measurement,
+                              uint64_t now_usec);
+
+/**
+ * @brief sht3x_dev_measurement_fetch
+ *
+ * Read the result of a due measurement into measurement, which becomes DONE,
+ * or FAILED on error.
+ *
+ * @param[in] dev Sensor the measurement was issued to
+ * @param[in,out] measurement Due measurement
+ *
+ * @return error_code 0 on success, an error code otherwise.
+ */
+int16_t sht3x_dev_measurement_fetch(sht3x_dev* dev,
+                                    sht3x_measurement* measurement);
+
+/**
+ * @brief sht3x_dev_read_serial_number
+ *
+ * Read the 32 bit electronic identification code of the sensor, unique to
+ * each sensor.
+ *
+ * @param[in] dev Sensor to read
+ * @param[out] serial_number Serial number, first word in the high bits
+ *
+ * @return error_code 0 on success, an error code otherwise.
+ */
+int16_t sht3x_dev_read_serial_number(sht3x_dev* dev, uint32_t* serial_number);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,4 @@
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,31 +12,211 @@
 #include "libraries/sgp40_i2c.h"
 #include "libraries/sht3x_i2c.h"
 #include "libraries/VOC_essentials.h"
+#include "libraries/VOC_binlog.h"
+#include "libraries/VOC_bus_pool.h"
+#include "libraries/VOC_index_store.h"
+#include "libraries/VOC_log_writer.h"
+#include "libraries/VOC_scheduler.h"
+#include "libraries/VOC_sensor_map.h"
+#include "libraries/VOC_snapshot.h"
+#include "libraries/VOC_tslog.h"
 
 #define LOG_DIR "../logs"
 
+/**
+ * @struct SweepTiming
+ * @brief Durations of the sweeps of the current log window.
+ */
+typedef struct {
+    uint64_t total_usec;
+    uint64_t max_usec;
+    uint32_t count;
+} SweepTiming;
+
+// Rows go through the writer thread when there is one, so a slow SD card never delays the next sweep
+static void log_window(LogSink* sink, LogEncoder* encoder, LogWriter* writer, Snapshot* snapshot, BusPool* pool,
+                       const SampleScheduler* sched, SweepTiming* timing, uint64_t window, int oversample_count) {
+    time_t window_start = scheduler_tick_time(sched, window * oversample_count);
+    LogRecord local;
+    LogRecord* record = writer ? log_writer_reserve(writer) : &local;
+
+    // A record dropped by a full log queue is still published, from a local copy
+    if (!record) record = &local;
+    finalize_record(record, pool->accum, pool->site_count, oversample_count, window_start, pool->gas_index != NULL,
+                    pool->config->log_stats && pool->config->log_format == LOG_FORMAT_CSV);
+    uint32_t outlier_count = record->outlier_count;
+    int outlier_sites = 0;
+    for (int site = 0; outlier_count && site < record->site_count; site++) {
+        if (record->outliers[site]) outlier_sites++;
+    }
+    if (snapshot) snapshot_publish_window(snapshot->segment, record, sensirion_i2c_hal_get_realtime_usec());
+    if (record != &local) {
+        log_writer_commit(writer);
+    } else if (!writer) {
+        log_encoder_append(encoder, record, sink);
+    }
+    reset_accumulators(pool->accum, pool->site_count);
+
+    // The bus threads are idle between sweeps, so their counters can be read from here
+    for (int bus = 0; bus < pool->bus_count; bus++) {
+        sensirion_i2c_hal_bus* handle = sensirion_i2c_hal_get_bus(bus);
+        sensirion_i2c_hal_stats stats;
+        sensirion_i2c_hal_bus_get_stats(handle, &stats);
+        sensirion_i2c_fault_stats faults;
+        int has_faults = sensirion_i2c_hal_bus_get_fault_stats(handle, &faults) == 0;
+        sensirion_i2c_hal_bus_reset_stats(handle);
+        printf("I2C bus %d | transactions: %llu | syscalls: %llu | messages: %llu | errors: %llu | probes: %llu"
+               " | absent: %llu\n", bus, (unsigned long long)stats.transactions,
+               (unsigned long long)stats.syscalls, (unsigned long long)stats.messages,
+               (unsigned long long)stats.errors, (unsigned long long)stats.probes,
+               (unsigned long long)stats.probe_nacks);
+        PortHealth* health = &pool->workers[bus].sensors.health;
+        printf("Breakers bus %d | open: %d | trips: %llu | recoveries: %llu | skipped: %llu\n", bus,
+               health_open_count(health), (unsigned long long)health->stats.trips,
+               (unsigned long long)health->stats.recoveries, (unsigned long long)health->stats.skipped);
+        health->stats = (PortHealthStats){0};
+        if (has_faults) {
+            printf("Faults bus %d | nacks: %llu | blackholed: %llu | stuck: %llu | corrupted: %llu | delay: %llu us\n",
+                   bus, (unsigned long long)faults.nacks, (unsigned long long)faults.blackholed,
+                   (unsigned long long)faults.stuck, (unsigned long long)faults.corrupted,
+                   (unsigned long long)faults.delay_usec);
+        }
+    }
+    if (writer) {
+        LogWriterStats stats;
+        log_writer_get_stats(writer, &stats);
+        printf("Log queue | depth: %u | max depth: %u | pushed: %llu | dropped: %llu | written: %llu | batches: %llu\n",
+               stats.depth, stats.max_depth, (unsigned long long)stats.pushed, (unsigned long long)stats.dropped,
+               (unsigned long long)stats.written, (unsigned long long)stats.batches);
+    }
+    LogSinkStats sink_stats;
+    log_sink_get_stats(sink, &sink_stats);
+    printf("Log file | rows: %llu | writes: %llu | syncs: %llu | write amplification: %.1f | sync mean: %.1f ms | "
+           "sync max: %.1f ms\n",
+           (unsigned long long)sink_stats.rows, (unsigned long long)sink_stats.writes,
+           (unsigned long long)sink_stats.syncs,
+           sink_stats.payload_bytes ? (double)sink_stats.device_bytes / sink_stats.payload_bytes : 0.0,
+           sink_stats.syncs ? sink_stats.sync_usec_total / 1000.0 / sink_stats.syncs : 0.0,
+           sink_stats.sync_usec_max / 1000.0);
+    if (timing->count) {
+        printf("Sweep | mean: %.1f ms | max: %.1f ms\n", timing->total_usec / 1000.0 / timing->count,
+               timing->max_usec / 1000.0);
+    }
+    *timing = (SweepTiming){0};
+    printf("Scheduler | overruns: %llu | missed ticks: %llu\n", (unsigned long long)sched->overruns,
+           (unsigned long long)sched->missed);
+    if (pool->accum->filter != WINDOW_FILTER_NONE) {
+        printf("Window filter | rejected samples: %u | sites: %d\n", (unsigned)outlier_count, outlier_sites);
+    }
+}
+
+// The bus threads are idle between sweeps, so the VOC index engine can be read from here
+static void checkpoint_voc_state(IndexStore* store, const BusPool* pool) {
+    BinlogSensor sensors[LOG_RECORD_MAX_SITES];
+
+    bus_pool_get_sensors(pool, sensors);
+    index_store_save(store, pool->gas_index, sensors, sensirion_i2c_hal_get_realtime_usec());
+}
+
+// Sensors swapped during the run had their VOC index restarted by the sweeps; a known one resumes from its
+// checkpoint, and the map records where it now is
+static void handle_replaced_sensors(BusPool* pool, IndexStore* store, const VOCConfig* config,
+                                    const BinlogSite sites[], int site_count) {
+    BinlogSensor sensors[LOG_RECORD_MAX_SITES];
+    int replaced[LOG_RECORD_MAX_SITES];
+
+    int count = bus_pool_take_replaced(pool, replaced);
+    if (count == 0) return;
+
+    bus_pool_get_sensors(pool, sensors);
+    for (int i = 0; store && i < count; i++) {
+        index_store_restore_site(store, pool->gas_index, replaced[i], sensors[replaced[i]].sgp_serial,
+                                 sensirion_i2c_hal_get_realtime_usec(), config->voc_state_max_age);
+    }
+    if (config->sensor_map_file[0]) sensor_map_update(config->sensor_map_file, sites, sensors, site_count);
+}
+
+// Set by SIGINT and SIGTERM, the main loop ends at the next tick and the log is completed
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
+
 int main(int argc, char* argv[]) {
     char filename[128];
     char timestamp[32];
 
-    // Generate timestamp for filename
-    time_t now = time(NULL);
-    struct tm* t = localtime(&now);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H-%M-%S", t);
+    // SA_RESTART keeps the I2C transfers of the bus threads from failing when one of them takes the signal
+    struct sigaction stop_action = {.sa_handler = request_stop, .sa_flags = SA_RESTART};
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
 
-    if (argc >= 2) {
-        snprintf(filename, sizeof(filename), "%s/%s_%s.csv", LOG_DIR, argv[1], timestamp);
+    VOCConfig config = {
+        .oversample_count = 5,
+        .humidity_offset = 0,
+        .sweep_mode = SWEEP_SEQUENTIAL,
+        .reprobe_interval = DEFAULT_REPROBE_INTERVAL,
+        .breaker_threshold = DEFAULT_BREAKER_THRESHOLD,
+        .breaker_max_backoff = DEFAULT_BREAKER_MAX_BACKOFF,
+        .log_queue = DEFAULT_LOG_QUEUE,
+        .log_block = false,
+        .log_sync_rows = DEFAULT_LOG_SYNC_ROWS,
+        .log_sync_interval = DEFAULT_LOG_SYNC_INTERVAL,
+        .log_block_records = DEFAULT_LOG_BLOCK_RECORDS,
+        .log_stats = false,
+        .window_filter = WINDOW_FILTER_NONE,
+        .window_filter_threshold = DEFAULT_WINDOW_FILTER_THRESHOLD,
+        .snapshot_name = DEFAULT_SNAPSHOT_NAME,
+        .sample_echo = true,
+        .sample_echo_interval = 0,
+        .voc_index = true,
+        .voc_state_file = DEFAULT_VOC_STATE_FILE,
+        .voc_state_interval = DEFAULT_VOC_STATE_INTERVAL,
+        .voc_state_max_age = DEFAULT_VOC_STATE_MAX_AGE,
+        .calibration_file = DEFAULT_CALIBRATION_FILE,
+        .sensor_map_file = DEFAULT_SENSOR_MAP_FILE,
+        .serial_columns = true,
+        .bus_count = 1,
+        .single_thread = false,
+        .virtual_clock = false,
+        .run_duration = 0,
+        .bus_paths = {DEFAULT_I2C_BUS},
+    };
+
+    if (read_config(&config) != 0) {
+        printf("Using default config: oversample_count = %d, humidity_offset = %.2f\n", config.oversample_count, config.humidity_offset);
     } else {
-        snprintf(filename, sizeof(filename), "%s/log_%s.csv", LOG_DIR, timestamp);
+        printf("Loaded config: oversample_count = %d, humidity_offset = %.2f, sweep_mode = %s\n", config.oversample_count,
+               config.humidity_offset, sweep_mode_name(config.sweep_mode));
     }
 
-    int oversample_count = 5;
-    float sht31_humidity_offset = 0;
+    // The filters keep every sample of a window in a fixed buffer per site
+    if (config.window_filter != WINDOW_FILTER_NONE && config.oversample_count > WINDOW_FILTER_MAX_SAMPLES) {
+        fprintf(stderr, "window_filter needs oversample_count of at most %d, logging plain means.\n",
+                WINDOW_FILTER_MAX_SAMPLES);
+        config.window_filter = WINDOW_FILTER_NONE;
+    }
+
+    // Everything below, from the file name to the sensor timings, follows the virtual clock
+    if (config.virtual_clock) {
+        sensirion_i2c_hal_use_virtual_clock();
+        printf("Virtual clock enabled\n");
+    }
 
-    if (read_config(&oversample_count, &sht31_humidity_offset) != 0) {
-        printf("Using default config: oversample_count = %d, humidity_offset = %.2f\n", oversample_count, sht31_humidity_offset);
+    // Generate timestamp for filename
+    time_t now = (time_t)(sensirion_i2c_hal_get_realtime_usec() / 1000000);
+    struct tm* t = localtime(&now);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H-%M-%S", t);
+
+    const char* extensions[] = {[LOG_FORMAT_CSV] = "csv", [LOG_FORMAT_BINARY] = "bin", [LOG_FORMAT_COMPRESSED] = "vcz"};
+    const char* extension = extensions[config.log_format];
+    if (argc >= 2) {
+        snprintf(filename, sizeof(filename), "%s/%s_%s.%s", LOG_DIR, argv[1], timestamp, extension);
     } else {
-        printf("Loaded config: oversample_count = %d, humidity_offset = %.2f\n", oversample_count, sht31_humidity_offset);
+        snprintf(filename, sizeof(filename), "%s/log_%s.%s", LOG_DIR, timestamp, extension);
     }
 
     mkdir(LOG_DIR, 0755);
@@ -46,34 +227,141 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    for (int bus = 0; bus < config.bus_count; bus++) {
+        sensirion_i2c_hal_set_bus_path(bus, config.bus_paths[bus]);
+        if (config.fault_options[0] && sensirion_i2c_hal_set_bus_faults(bus, config.fault_options) != 0) {
+            fprintf(stderr, "Invalid i2c_faults: %s\n", config.fault_options);
+            return 1;
+        }
+    }
+    sensirion_i2c_hal_init();
+
+    BusPool pool;
+    if (bus_pool_start(&pool, &config) != 0) {
+        return 1;
+    }
+
+    // Position of every site, in the order of the accumulators and of the log columns
+    BinlogSite sites[LOG_RECORD_MAX_SITES];
+    int site_count = 0;
+    for (int bus = 0; bus < pool.bus_count; bus++) {
+        const SensorBus* sensors = &pool.workers[bus].sensors;
+        for (int site = 0; site < sensors->presence.site_count && site_count < LOG_RECORD_MAX_SITES; site++) {
+            sites[site_count++] = (BinlogSite){
+                .bus = bus,
+                .mux_address = sensors->topology.muxes[SITE_MUX(site)].address,
+                .port = SITE_PORT(site),
+            };
+        }
+    }
+
+    // Serial numbers of the sensors of every site, which name the log columns and key their calibration
+    BinlogSensor sensors[LOG_RECORD_MAX_SITES];
+    bus_pool_get_sensors(&pool, sensors);
+    if (config.sensor_map_file[0]) {
+        int differences = sensor_map_update(config.sensor_map_file, sites, sensors, site_count);
+        if (differences == 0) printf("Sensors are on the same sites as in %s\n", config.sensor_map_file);
+    }
+
+    // Other processes read the latest values from shared memory instead of tailing the log
+    Snapshot shared;
+    Snapshot* snapshot = NULL;
+    if (config.snapshot_name[0] &&
+        snapshot_create(&shared, config.snapshot_name, sites, sensors, site_count, config.oversample_count) == 0) {
+        snapshot = &shared;
+        bus_pool_set_snapshot(&pool, snapshot->segment);
+        printf("Publishing latest values to shared memory %s\n", config.snapshot_name);
+    }
+
+    // Sensors resume from their last checkpoint instead of learning their baseline again for hours
+    IndexStore store;
+    IndexStore* state_store = NULL;
+    if (pool.gas_index && config.voc_state_file[0]) {
+        index_store_open(&store, config.voc_state_file);
+        int restored = index_store_restore(&store, pool.gas_index, sensors, sensirion_i2c_hal_get_realtime_usec(),
+                                           config.voc_state_max_age);
+        state_store = &store;
+        printf("Restored VOC index state of %d of %d sites from %s\n", restored, pool.site_count,
+               config.voc_state_file);
+    }
+
+    // One column group per discovered site, named after its SGP40 or <bus>_<mux address>_<port>
     // Write CSV header if file is empty
+    uint32_t log_flags = config.voc_index ? BINLOG_FLAG_VOC_INDEX : 0;
+    const BinlogSensor* column_sensors = config.serial_columns ? sensors : NULL;
     fseek(logfile, 0, SEEK_END);
-    if (ftell(logfile) == 0) {
-        fprintf(logfile, "Timestamp");
-        for (int i = 0; i < MAX_PORTS; i++) {
-            fprintf(logfile, ",T%d,H%d,VOC%d", i, i, i);
+    if (ftell(logfile) == 0 && config.log_format != LOG_FORMAT_CSV) {
+        if (config.log_format == LOG_FORMAT_COMPRESSED) {
+            tslog_write_header(logfile, sites, column_sensors, site_count, config.oversample_count,
+                               config.log_block_records, log_flags);
+        } else {
+            binlog_write_header(logfile, sites, column_sensors, site_count, config.oversample_count, log_flags);
         }
-        fprintf(logfile, "\n");
+    } else if (ftell(logfile) == 0) {
+        binlog_write_csv_header(logfile, sites, column_sensors, site_count, config.voc_index, config.log_stats);
     }
 
-    sensirion_i2c_hal_init();
-    sht3x_init(SHT31_I2C_ADDR_44);
-    mux_init_address(TCA_ADDR_70);
+    // From here on rows only go through the sink, in groups of sync_rows rows or sync_interval seconds
+    LogSink sink;
+    if (log_sink_open(&sink, logfile, config.log_sync_rows, config.log_sync_interval) != 0) {
+        return 1;
+    }
+    LogEncoder encoder;
+    if (log_encoder_init(&encoder, config.log_format, pool.site_count, config.log_block_records) != 0) {
+        return 1;
+    }
+    LogWriter log_writer;
+    LogWriter* writer = NULL;
+    if (config.log_queue > 0 &&
+        log_writer_start(&log_writer, &sink, &encoder, config.log_queue, config.log_block ? LOG_OVERFLOW_BLOCK : LOG_OVERFLOW_DROP) == 0) {
+        writer = &log_writer;
+    }
 
-    SensorAccumulator accum[MAX_PORTS];
-    reset_accumulators(accum);
+    // Windows of oversample_count ticks, starting on wall-clock multiples of the window length
+    SampleScheduler sched;
+    scheduler_init(&sched, SAMPLE_PERIOD_NS, config.oversample_count * SAMPLE_PERIOD_NS);
+    uint64_t window = 0;
+    SweepTiming timing = {0};
+    uint64_t tick_limit = (uint64_t)(config.run_duration * 1000000000LL / SAMPLE_PERIOD_NS);
+    uint64_t checkpoint_ticks = (uint64_t)(config.voc_state_interval * 1000000000LL / SAMPLE_PERIOD_NS);
+    if (checkpoint_ticks == 0) checkpoint_ticks = 1;
 
     while (1) {
-        for (int i = 0; i < oversample_count; i++) {
-            sample_all_ports(accum, sht31_humidity_offset);
-            sensirion_i2c_hal_sleep_usec(1000000); // 1 second delay per sample
+        uint64_t tick = scheduler_wait(&sched);
+        if (stop_requested) {
+            printf("Stopping on signal\n");
+            break;
+        }
+        if (tick_limit && tick >= tick_limit) break;
+
+        // Missed ticks may have ended the current window before its last sweep
+        while (tick / config.oversample_count > window) {
+            log_window(&sink, &encoder, writer, snapshot, &pool, &sched, &timing, window++, config.oversample_count);
         }
 
-        get_timestamp(timestamp, sizeof(timestamp));
-        finalize_averages(logfile, accum, oversample_count, timestamp);
-        reset_accumulators(accum);
+        uint64_t sweep_start = sensirion_i2c_hal_get_time_usec();
+        bus_pool_sweep(&pool);
+        uint64_t sweep_usec = sensirion_i2c_hal_get_time_usec() - sweep_start;
+        timing.total_usec += sweep_usec;
+        timing.count++;
+        if (sweep_usec > timing.max_usec) timing.max_usec = sweep_usec;
+
+        if ((tick + 1) % config.oversample_count == 0) {
+            log_window(&sink, &encoder, writer, snapshot, &pool, &sched, &timing, window++, config.oversample_count);
+        }
+        handle_replaced_sensors(&pool, state_store, &config, sites, site_count);
+        if (state_store && (tick + 1) % checkpoint_ticks == 0) {
+            checkpoint_voc_state(state_store, &pool);
+        }
     }
 
+    if (state_store) checkpoint_voc_state(state_store, &pool);
+    if (writer) log_writer_stop(writer);
+    log_encoder_finish(&encoder, &sink);
+    log_sink_close(&sink);
+    bus_pool_stop(&pool);
+    if (snapshot) snapshot_destroy(snapshot);
+    sensirion_i2c_hal_free();
     fclose(logfile);
     return 0;
 }
@@ -0,0 +1,47 @@
+#include <stdio.h>
+
+#include "../libraries/VOC_binlog.h"
+#include "../libraries/VOC_tslog.h"
+
+// Converts a binary or compressed log of VOC_multiplexer (log_format = binary or compressed) to its CSV format
+int main(int argc, char* argv[]) {
+    BinlogReader reader;
+    TslogReader compressed;
+    int is_compressed = 0;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <log.bin|log.vcz> [output.csv]\n", argv[0]);
+        return 2;
+    }
+    if (tslog_open(&compressed, argv[1]) == 0) {
+        is_compressed = 1;
+    } else if (binlog_open(&reader, argv[1]) != 0) {
+        fprintf(stderr, "%s is not a readable binary or compressed log\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        perror("Failed to open output file");
+        if (is_compressed) tslog_close(&compressed);
+        else binlog_close(&reader);
+        return 1;
+    }
+
+    int error = is_compressed ? tslog_write_csv(&compressed, out) : binlog_write_csv(&reader, out);
+    if (out != stdout) fclose(out);
+    if (error) fprintf(stderr, "Failed to write CSV\n");
+
+    // A truncated last block is the tail of a run that was killed, an invalid block loses the data after it
+    if (is_compressed && compressed.corrupt) {
+        fprintf(stderr, "%s: invalid block after %zu records, %zu bytes skipped\n", argv[1], compressed.record_count,
+                compressed.skipped);
+        error = 1;
+    } else if (is_compressed && compressed.skipped) {
+        fprintf(stderr, "Warning: %s ends with an incomplete block of %zu bytes, ignored\n", argv[1],
+                compressed.skipped);
+    }
+    if (is_compressed) tslog_close(&compressed);
+    else binlog_close(&reader);
+    return error ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../libraries/sensirion_common.h"
+#include "../libraries/sensirion_i2c.h"
+
+#define DEFAULT_WORDS 4096
+#define DEFAULT_ROUNDS 2000
+#define FRAME_SIZE (SENSIRION_WORD_SIZE + CRC8_LEN)
+
+// The CRC-8 of the Sensirion driver before the lookup table: eight shift/xor steps per byte
+static uint8_t bitwise_crc(const uint8_t* data, uint16_t count) {
+    uint8_t crc = CRC8_INIT;
+
+    for (uint16_t current_byte = 0; current_byte < count; ++current_byte) {
+        crc ^= data[current_byte];
+        for (int bit = 8; bit > 0; --bit) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ CRC8_POLYNOMIAL) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Verify of a batch with the bitwise CRC, word by word like the driver used to
+static int8_t bitwise_check_words(const uint8_t* data, uint16_t num_words) {
+    for (uint16_t i = 0; i < num_words; ++i, data += FRAME_SIZE) {
+        if (bitwise_crc(data, SENSIRION_WORD_SIZE) != data[SENSIRION_WORD_SIZE]) return CRC_ERROR;
+    }
+    return NO_ERROR;
+}
+
+static uint64_t now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Checks the table-driven CRC of sensirion_i2c.c against the bitwise one, then times both on batched verifies
+int main(int argc, char* argv[]) {
+    int words = argc > 1 ? atoi(argv[1]) : DEFAULT_WORDS;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    int failures = 0;
+
+    if (argc > 3 || words <= 0 || words > UINT16_MAX || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [words per batch, at most %d] [rounds]\n", argv[0], UINT16_MAX);
+        return 2;
+    }
+
+    // Every word, then buffers of every length up to 64 bytes
+    for (uint32_t word = 0; word <= UINT16_MAX; word++) {
+        uint8_t bytes[SENSIRION_WORD_SIZE] = {(uint8_t)(word >> 8), (uint8_t)word};
+        uint8_t expected = bitwise_crc(bytes, sizeof(bytes));
+        if (sensirion_i2c_generate_word_crc((uint16_t)word) != expected ||
+            sensirion_i2c_generate_crc(bytes, sizeof(bytes)) != expected) {
+            if (failures++ < 10) fprintf(stderr, "CRC mismatch on word 0x%04x\n", (unsigned)word);
+        }
+    }
+    srand(1);
+    for (uint16_t count = 0; count <= 64; count++) {
+        uint8_t buffer[64];
+        for (uint16_t i = 0; i < count; i++) buffer[i] = (uint8_t)rand();
+        if (sensirion_i2c_generate_crc(buffer, count) != bitwise_crc(buffer, count)) {
+            if (failures++ < 10) fprintf(stderr, "CRC mismatch on a buffer of %u bytes\n", (unsigned)count);
+        }
+    }
+
+    uint8_t* batch = malloc((size_t)words * FRAME_SIZE);
+    if (!batch) {
+        perror("Failed to allocate batch");
+        return 1;
+    }
+    for (int i = 0; i < words; i++) {
+        uint8_t* frame = batch + (size_t)i * FRAME_SIZE;
+        frame[0] = (uint8_t)rand();
+        frame[1] = (uint8_t)rand();
+        frame[SENSIRION_WORD_SIZE] = bitwise_crc(frame, SENSIRION_WORD_SIZE);
+    }
+    if (sensirion_i2c_check_words_crc(batch, (uint16_t)words) != NO_ERROR) {
+        fprintf(stderr, "Valid batch rejected\n");
+        failures++;
+    }
+    batch[(size_t)(words - 1) * FRAME_SIZE + SENSIRION_WORD_SIZE] ^= 0x01;
+    if (sensirion_i2c_check_words_crc(batch, (uint16_t)words) != CRC_ERROR) {
+        fprintf(stderr, "Corrupted batch accepted\n");
+        failures++;
+    }
+    batch[(size_t)(words - 1) * FRAME_SIZE + SENSIRION_WORD_SIZE] ^= 0x01;
+    printf("Check | %d mismatches against the bitwise CRC\n", failures);
+
+    // The results are summed so the calls are not optimized away
+    volatile int sink = 0;
+    uint16_t buffer_size = (size_t)words * FRAME_SIZE > UINT16_MAX ? UINT16_MAX : (uint16_t)(words * FRAME_SIZE);
+    uint64_t nsec[4];
+    for (int variant = 0; variant < 4; variant++) {
+        uint64_t start = now_nsec();
+        for (int round = 0; round < rounds; round++) {
+            switch (variant) {
+                case 0: sink += bitwise_check_words(batch, (uint16_t)words); break;
+                case 1: sink += sensirion_i2c_check_words_crc(batch, (uint16_t)words); break;
+                case 2: sink += bitwise_crc(batch, buffer_size); break;
+                default: sink += sensirion_i2c_generate_crc(batch, buffer_size); break;
+            }
+        }
+        nsec[variant] = now_nsec() - start;
+    }
+
+    double total_words = (double)words * rounds;
+    double total_bytes = (double)buffer_size * rounds;
+    printf("Verify %d words x %d rounds | bitwise: %.2f ns/word | table: %.2f ns/word | speedup: %.1fx\n", words,
+           rounds, nsec[0] / total_words, nsec[1] / total_words, (double)nsec[0] / (nsec[1] ? nsec[1] : 1));
+    printf("CRC of %u bytes x %d rounds | bitwise: %.2f ns/byte | table: %.2f ns/byte | speedup: %.1fx\n",
+           (unsigned)buffer_size, rounds, nsec[2] / total_bytes, nsec[3] / total_bytes,
+           (double)nsec[2] / (nsec[3] ? nsec[3] : 1));
+    free(batch);
+    return (failures || sink < 0) ? 1 : 0;
+}
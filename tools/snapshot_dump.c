@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "../libraries/VOC_snapshot.h"
+
+// Prints the latest samples and window averages published by a running VOC_multiplexer
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [shared memory name]\n", argv[0]);
+        return 2;
+    }
+
+    const char* name = argc == 2 ? argv[1] : DEFAULT_SNAPSHOT_NAME;
+    const SnapshotSegment* segment = snapshot_open(name);
+    if (!segment) {
+        fprintf(stderr, "No snapshot published under %s\n", name);
+        return 1;
+    }
+
+    static SnapshotWindow window;
+    bool has_window = snapshot_read_window(segment, &window);
+    printf("Publisher pid %d | sites: %u | oversample_count: %u\n", segment->pid, segment->site_count,
+           segment->oversample_count);
+    if (has_window) {
+        char timestamp[32];
+        struct tm tm;
+        time_t start = (time_t)window.timestamp;
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", localtime_r(&start, &tm));
+        printf("Window %llu | start: %s\n", (unsigned long long)window.count, timestamp);
+    }
+
+    for (int site = 0; site < segment->site_count; site++) {
+        const BinlogSite* s = &segment->sites[site];
+        SnapshotSample sample;
+        printf("Site %d_%02x_%d", s->bus, s->mux_address, s->port);
+        uint64_t serial = segment->sensors[site].sgp_serial;
+        if (serial) printf(" | SGP40 %012llx", (unsigned long long)serial);
+        if (snapshot_read_sample(segment, site, &sample)) {
+            printf(" | Temp: %.2f °C | Humidity: %.2f %% | VOC: %u ticks | at %llu.%06llu", sample.temperature,
+                   sample.humidity, sample.voc, (unsigned long long)(sample.time_usec / 1000000),
+                   (unsigned long long)(sample.time_usec % 1000000));
+            if (sample.voc_index) printf(" | VOC index: %u", sample.voc_index);
+        }
+        if (has_window && (window.valid[site / 64] & ((uint64_t)1 << (site % 64)))) {
+            printf(" | Window: %.2f °C, %.2f %%, %u ticks", window.temperature[site], window.humidity[site],
+                   window.voc[site]);
+            if (window.flags & BINLOG_FLAG_VOC_INDEX) printf(", VOC index %u", window.voc_index[site]);
+        }
+        printf("\n");
+    }
+    snapshot_close(segment);
+    return 0;
+}